@@ -0,0 +1,283 @@
+#pragma once
+
+#include "IntrusiveHashTable.h"
+#include "OrderBook.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+/*
+** BookDirectory
+** - symbol to OrderBook lookup
+** - symbols are fixed width (8, 16 or 32 bytes) and zero padded
+** - keys are hashed a word at a time and compared with one word or SIMD compare
+** - buildPerfectHash() replaces the hash table with a collision free table for the day's symbols
+*/
+
+template<size_t N>
+struct Symbol
+{
+	uint64_t _words[N / 8];
+
+	Symbol() { memset(_words, 0, N); }
+	explicit Symbol(const char *symbol) { set(symbol); }
+	// returns false if the symbol is longer than N, the key is then empty
+	bool set(const char *symbol) { return set(symbol, N + 1); }
+	// symbol is terminated or width bytes long
+	bool set(const char *symbol, size_t width)
+	{
+		memset(_words, 0, N);
+		size_t length(0);
+		for (; length < width && symbol[length]; ++length);
+		if (length > N) return false;
+		memcpy(_words, symbol, length);
+		return true;
+	}
+	const char *c_str() const { return reinterpret_cast<const char*>(_words); }
+};
+
+// compare N zero padded bytes
+template<size_t N>
+struct SymbolCompare;
+
+template<>
+struct SymbolCompare<8>
+{
+	static bool equal(const void *l, const void *r)
+	{
+		uint64_t lw, rw;
+		memcpy(&lw, l, 8);
+		memcpy(&rw, r, 8);
+		return lw == rw;
+	}
+};
+
+template<>
+struct SymbolCompare<16>
+{
+	static bool equal(const void *l, const void *r)
+	{
+		__m128i cmp = _mm_cmpeq_epi8(_mm_loadu_si128(static_cast<const __m128i*>(l)), _mm_loadu_si128(static_cast<const __m128i*>(r)));
+		return _mm_movemask_epi8(cmp) == 0xFFFF;
+	}
+};
+
+template<>
+struct SymbolCompare<32>
+{
+	static bool equal(const void *l, const void *r)
+	{
+#ifdef __AVX2__
+		__m256i cmp = _mm256_cmpeq_epi8(_mm256_loadu_si256(static_cast<const __m256i*>(l)), _mm256_loadu_si256(static_cast<const __m256i*>(r)));
+		return _mm256_movemask_epi8(cmp) == -1;
+#else
+		const __m128i *lp = static_cast<const __m128i*>(l), *rp = static_cast<const __m128i*>(r);
+		__m128i cmp = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(lp), _mm_loadu_si128(rp)),
+			_mm_cmpeq_epi8(_mm_loadu_si128(lp + 1), _mm_loadu_si128(rp + 1)));
+		return _mm_movemask_epi8(cmp) == 0xFFFF;
+#endif
+	}
+};
+
+// multiply / xor shift over whole words
+struct SymbolHashFunction
+{
+	enum : uint64_t { MULTIPLIER = 0x9E3779B97F4A7C15ULL };
+
+	template<size_t N>
+	size_t operator() (const Symbol<N> &key) const
+	{
+		uint64_t value(key._words[0] * MULTIPLIER);
+		for (size_t i = 1; i < N / 8; ++i)
+			value = (value ^ key._words[i]) * MULTIPLIER;
+		return static_cast<size_t>(value ^ (value >> 29));
+	}
+};
+
+template<size_t N>
+struct SymbolEqual
+{
+	bool operator() (const Symbol<N> &key, const OrderBook &orderBook) const { return SymbolCompare<N>::equal(key._words, orderBook.symbol()); }
+};
+
+template<size_t N>
+class BookDirectory
+{
+protected:
+	typedef Intrusive::HashTable<Symbol<N>, OrderBook, SymbolEqual<N>, SymbolHashFunction> BookTable;
+
+	struct PerfectSlot
+	{
+		Symbol<N> _key;
+		OrderBook *_orderBook;
+		PerfectSlot() : _orderBook(0) {}
+	};
+
+	// OrderBook::_symbol, which need not be terminated
+	enum { BOOK_SYMBOL_WIDTH = 32 };
+
+	BookTable _bookTable;
+	std::vector<OrderBook*> _orderBooks;
+	SymbolHashFunction _hash;
+
+	// perfect hash mode
+	enum { MAX_DISPLACEMENT = 1 << 20 };
+	PerfectSlot *_perfectSlots;
+	std::vector<uint32_t> _perfectDisplacements;
+	size_t _perfectBucketMask;
+	unsigned _perfectShift;
+
+	static size_t _displace(size_t hash, uint32_t displacement, unsigned shift)
+	{
+		return static_cast<size_t>(((hash ^ (displacement * SymbolHashFunction::MULTIPLIER)) * 0xBF58476D1CE4E5B9ULL) >> shift);
+	}
+	size_t _perfectSlot(const Symbol<N> &key) const
+	{
+		size_t hash = _hash(key);
+		return _displace(hash, _perfectDisplacements[hash & _perfectBucketMask], _perfectShift);
+	}
+	void _clearPerfectHash() { if (_perfectSlots) delete[] _perfectSlots; _perfectSlots = 0; }
+public:
+	BookDirectory(size_t size) : _bookTable(size), _perfectSlots(0), _perfectBucketMask(0), _perfectShift(0) { _orderBooks.reserve(size); }
+
+	// returns false if the symbol is too long or already present
+	bool add(OrderBook *orderBook);
+	OrderBook *remove(const char *symbol);
+
+	// build a collision free table from the symbols added so far
+	// - any later add or remove reverts to the hash table
+	int buildPerfectHash();
+	bool perfectHash() const { return _perfectSlots != 0; }
+
+	inline OrderBook *find(const Symbol<N> &key);
+	// 0 for a symbol longer than N
+	OrderBook *find(const char *symbol) { Symbol<N> key; return key.set(symbol) ? find(key) : 0; }
+	size_t size() const { return _orderBooks.size(); }
+
+	~BookDirectory() { _clearPerfectHash(); }
+private:
+	BookDirectory(const BookDirectory&) = delete;
+	BookDirectory& operator = (const BookDirectory&) = delete;
+};
+
+template<size_t N>
+bool BookDirectory<N>::add(OrderBook *orderBook)
+{
+	Symbol<N> key;
+	if (!key.set(orderBook->symbol(), BOOK_SYMBOL_WIDTH) || !_bookTable.insert(key, orderBook)) return false;
+	_orderBooks.push_back(orderBook);
+	_clearPerfectHash();
+	return true;
+}
+
+template<size_t N>
+OrderBook *BookDirectory<N>::remove(const char *symbol)
+{
+	Symbol<N> key;
+	if (!key.set(symbol)) return 0;
+	OrderBook *orderBook = _bookTable.remove(key);
+	if (orderBook)
+	{
+		for (typename std::vector<OrderBook*>::iterator itr = _orderBooks.begin(); itr != _orderBooks.end(); ++itr)
+		{
+			if (*itr == orderBook) { _orderBooks.erase(itr); break; }
+		}
+		_clearPerfectHash();
+	}
+	return orderBook;
+}
+
+template<size_t N>
+int BookDirectory<N>::buildPerfectHash()
+{
+	_clearPerfectHash();
+	if (_orderBooks.empty()) return -1;
+
+	// hash and displace
+	// - keys are grouped into buckets by the low bits of their hash
+	// - buckets are placed largest first, each with the first displacement that lands all of its keys in free slots
+	size_t keyCnt = _orderBooks.size();
+	std::vector<Symbol<N>> keys(keyCnt);
+	std::vector<size_t> hashes(keyCnt);
+	for (size_t i = 0; i < keyCnt; ++i)
+	{
+		keys[i].set(_orderBooks[i]->symbol(), BOOK_SYMBOL_WIDTH);
+		hashes[i] = _hash(keys[i]);
+	}
+
+	size_t bucketCnt(1);
+	for (; bucketCnt < keyCnt / 2; bucketCnt <<= 1);
+	std::vector<std::vector<size_t>> buckets(bucketCnt);
+	for (size_t i = 0; i < keyCnt; ++i) buckets[hashes[i] & (bucketCnt - 1)].push_back(i);
+	std::vector<size_t> order(bucketCnt);
+	for (size_t i = 0; i < bucketCnt; ++i) order[i] = i;
+	std::sort(order.begin(), order.end(), [&buckets](size_t l, size_t r) { return buckets[l].size() > buckets[r].size(); });
+
+	unsigned bits(1);
+	for (; (size_t(1) << bits) < keyCnt + keyCnt / 4; ++bits);
+	std::vector<unsigned char> used;
+	std::vector<size_t> slots;
+	for (unsigned maxBits = bits + 2; bits <= maxBits; ++bits)
+	{
+		size_t slotCnt = size_t(1) << bits;
+		unsigned shift = 64 - bits;
+		used.assign(slotCnt, 0);
+		_perfectDisplacements.assign(bucketCnt, 0);
+
+		size_t placed(0);
+		for (; placed < bucketCnt; ++placed)
+		{
+			std::vector<size_t> &bucket = buckets[order[placed]];
+			if (bucket.empty()) { placed = bucketCnt; break; }
+			uint32_t displacement(0);
+			for (; displacement < MAX_DISPLACEMENT; ++displacement)
+			{
+				slots.clear();
+				for (size_t k : bucket)
+				{
+					size_t slot = _displace(hashes[k], displacement, shift);
+					if (used[slot]) break;
+					used[slot] = 1;
+					slots.push_back(slot);
+				}
+				if (slots.size() == bucket.size()) break;
+				for (size_t slot : slots) used[slot] = 0;
+			}
+			if (displacement == MAX_DISPLACEMENT) break;
+			_perfectDisplacements[order[placed]] = displacement;
+		}
+		if (placed < bucketCnt) continue;
+
+		_perfectSlots = new PerfectSlot[slotCnt];
+		_perfectBucketMask = bucketCnt - 1;
+		_perfectShift = shift;
+		for (size_t i = 0; i < keyCnt; ++i)
+		{
+			PerfectSlot &slot = _perfectSlots[_perfectSlot(keys[i])];
+			slot._key = keys[i];
+			slot._orderBook = _orderBooks[i];
+		}
+		return 0;
+	}
+	_perfectDisplacements.clear();
+	return -1;
+}
+
+template<size_t N>
+OrderBook *BookDirectory<N>::find(const Symbol<N> &key)
+{
+	if (_perfectSlots)
+	{
+		PerfectSlot &slot = _perfectSlots[_perfectSlot(key)];
+		return SymbolCompare<N>::equal(slot._key._words, key._words) ? slot._orderBook : 0;
+	}
+	return _bookTable.find(key);
+}
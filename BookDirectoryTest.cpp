@@ -0,0 +1,174 @@
+#include "BookDirectory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define SYMBOL_CNT 8000
+#define MISS_CNT 1000
+#define LOOKUP_CNT (1 << 20)
+#define TRIAL_CNT 5
+
+// the lookup ahead of BookDirectory, FNV over the string and a byte by byte compare
+struct StringHashFunction
+{
+	size_t operator() (const char *key) const
+	{
+		size_t value(Intrusive::DefaultHashFunction::FNV_64_INIT);
+		for (char c = *key; c; c = *++key)
+			value = (value ^ c) * Intrusive::DefaultHashFunction::FNV_64_PRIME;
+		return value;
+	}
+};
+
+struct StringEqual
+{
+	bool operator() (const char *key, const OrderBook &orderBook) const { return strncmp(key, orderBook.symbol(), 32) == 0; }
+};
+
+// unique symbols of 1 to N characters, plus symbols that are not in the directory
+static void generateSymbols(size_t width, std::vector<std::string> &symbols, std::vector<std::string> &misses)
+{
+	std::mt19937_64 generator(width);
+	std::uniform_int_distribution<size_t> length(1, width);
+	std::uniform_int_distribution<int> character('A', 'Z');
+	std::set<std::string> unique;
+	while (unique.size() < SYMBOL_CNT + MISS_CNT)
+	{
+		std::string symbol(length(generator), ' ');
+		for (char &c : symbol) c = static_cast<char>(character(generator));
+		unique.insert(symbol);
+	}
+	std::vector<std::string> shuffled(unique.begin(), unique.end());
+	std::shuffle(shuffled.begin(), shuffled.end(), generator);
+	symbols.assign(shuffled.begin(), shuffled.begin() + SYMBOL_CNT);
+	misses.assign(shuffled.begin() + SYMBOL_CNT, shuffled.end());
+}
+
+template<size_t N>
+static bool checkFind(BookDirectory<N> &directory, const std::vector<std::string> &symbols, const std::vector<std::string> &misses, OrderBook *orderBooks, const char *mode)
+{
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		if (directory.find(symbols[i].c_str()) != orderBooks + i || directory.find(Symbol<N>(symbols[i].c_str())) != orderBooks + i)
+		{
+			printf("ERROR: %u byte %s find %s\n", static_cast<unsigned>(N), mode, symbols[i].c_str());
+			return false;
+		}
+	}
+	for (const std::string &symbol : misses)
+	{
+		if (directory.find(symbol.c_str()))
+		{
+			printf("ERROR: %u byte %s found missing %s\n", static_cast<unsigned>(N), mode, symbol.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+template<size_t N>
+static void checkDirectory()
+{
+	std::vector<std::string> symbols, misses;
+	generateSymbols(N, symbols, misses);
+
+	// the FNV table needs books of its own, a book hooks into one table
+	OrderBook *orderBooks = new OrderBook[SYMBOL_CNT];
+	OrderBook *stringBooks = new OrderBook[SYMBOL_CNT];
+	BookDirectory<N> directory(SYMBOL_CNT);
+	Intrusive::HashTable<const char*, OrderBook, StringEqual, StringHashFunction> stringTable(SYMBOL_CNT);
+	for (size_t i = 0; i < SYMBOL_CNT; ++i)
+	{
+		orderBooks[i].initialize(0, symbols[i].c_str());
+		stringBooks[i].initialize(0, symbols[i].c_str());
+		if (!directory.add(orderBooks + i)) printf("ERROR: %u byte add %s\n", static_cast<unsigned>(N), symbols[i].c_str());
+		stringTable.insert(stringBooks[i].symbol(), stringBooks + i);
+	}
+	if (directory.size() != SYMBOL_CNT) printf("ERROR: %u byte directory holds %zu\n", static_cast<unsigned>(N), directory.size());
+	OrderBook duplicate;
+	duplicate.initialize(0, symbols[0].c_str());
+	if (directory.add(&duplicate)) printf("ERROR: %u byte added a duplicate\n", static_cast<unsigned>(N));
+	if (N < 32)
+	{
+		OrderBook tooLong;
+		tooLong.initialize(0, std::string(N + 1, 'X').c_str());
+		if (directory.add(&tooLong)) printf("ERROR: %u byte added a symbol too long\n", static_cast<unsigned>(N));
+	}
+	// a symbol of exactly N bytes is found, a longer one never matches on its first N bytes
+	std::string fullSymbol(N, 'Y'), longer(N + 1, 'Y'), longest(40, 'Y');
+	OrderBook full;
+	full.initialize(0, fullSymbol.c_str());
+	if (!directory.add(&full) || directory.find(fullSymbol.c_str()) != &full) printf("ERROR: %u byte find %s\n", static_cast<unsigned>(N), fullSymbol.c_str());
+	if (directory.find(longer.c_str()) || directory.find(longest.c_str()) || directory.remove(longer.c_str())) printf("ERROR: %u byte found a symbol too long\n", static_cast<unsigned>(N));
+	if (directory.remove(fullSymbol.c_str()) != &full) printf("ERROR: %u byte remove %s\n", static_cast<unsigned>(N), fullSymbol.c_str());
+
+	checkFind(directory, symbols, misses, orderBooks, "hash");
+	if (directory.buildPerfectHash() || !directory.perfectHash()) printf("ERROR: %u byte buildPerfectHash\n", static_cast<unsigned>(N));
+	checkFind(directory, symbols, misses, orderBooks, "perfect");
+
+	// add and remove drop back to the hash table
+	OrderBook *removed = directory.remove(symbols[0].c_str());
+	if (removed != orderBooks || directory.perfectHash() || directory.find(symbols[0].c_str())) printf("ERROR: %u byte remove\n", static_cast<unsigned>(N));
+	if (directory.remove(misses[0].c_str())) printf("ERROR: %u byte removed a missing symbol\n", static_cast<unsigned>(N));
+	if (directory.buildPerfectHash() || directory.find(symbols[0].c_str())) printf("ERROR: %u byte perfect find after remove\n", static_cast<unsigned>(N));
+	if (!directory.add(orderBooks) || directory.perfectHash()) printf("ERROR: %u byte add after buildPerfectHash\n", static_cast<unsigned>(N));
+	checkFind(directory, symbols, misses, orderBooks, "hash after add");
+
+	// messages carry the symbol at its fixed width
+	std::mt19937_64 generator(1);
+	std::vector<Symbol<N>> keys(LOOKUP_CNT);
+	std::vector<const char*> strings(LOOKUP_CNT);
+	for (size_t i = 0; i < LOOKUP_CNT; ++i)
+	{
+		size_t symbol = generator() % SYMBOL_CNT;
+		keys[i].set(symbols[symbol].c_str());
+		strings[i] = symbols[symbol].c_str();
+	}
+
+	std::chrono::hours hour(1);
+	std::chrono::duration<long long, std::nano> minString(hour), minHash(hour), minPerfect(hour);
+	size_t stringCnt(0), hashCnt(0), perfectCnt(0);
+	for (int trial = 0; trial < TRIAL_CNT; ++trial)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < LOOKUP_CNT; ++i) if (stringTable.find(strings[i])) ++stringCnt;
+		std::chrono::duration<long long, std::nano> duration = std::chrono::steady_clock::now() - start;
+		if (minString > duration) minString = duration;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < LOOKUP_CNT; ++i) if (directory.find(keys[i])) ++hashCnt;
+		duration = std::chrono::steady_clock::now() - start;
+		if (minHash > duration) minHash = duration;
+	}
+	directory.buildPerfectHash();
+	for (int trial = 0; trial < TRIAL_CNT; ++trial)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < LOOKUP_CNT; ++i) if (directory.find(keys[i])) ++perfectCnt;
+		std::chrono::duration<long long, std::nano> duration = std::chrono::steady_clock::now() - start;
+		if (minPerfect > duration) minPerfect = duration;
+	}
+	if (stringCnt != size_t(TRIAL_CNT) * LOOKUP_CNT || hashCnt != stringCnt || perfectCnt != stringCnt) printf("ERROR: %u byte lookups %zu %zu %zu\n", static_cast<unsigned>(N), stringCnt, hashCnt, perfectCnt);
+	std::cout << N << ',' << SYMBOL_CNT << ',' << (double)minString.count() / LOOKUP_CNT << ',' << (double)minHash.count() / LOOKUP_CNT << ',' << (double)minPerfect.count() / LOOKUP_CNT << std::endl;
+
+	delete[] stringBooks;
+	delete[] orderBooks;
+}
+
+int main(int argc, const char *argv[])
+{
+	std::cout << "Width,Symbols,FNV string ns,Hash ns,Perfect hash ns" << std::endl;
+	checkDirectory<8>();
+	checkDirectory<16>();
+	checkDirectory<32>();
+	return 0;
+}
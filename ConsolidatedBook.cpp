@@ -0,0 +1,78 @@
+#include "ConsolidatedBook.h"
+
+unsigned ConsolidatedBook::addVenue(OrderBook *orderBook)
+{
+	Venue *venue = new Venue;
+	venue->_orderBook = orderBook;
+	unsigned venueNumber = static_cast<unsigned>(_venues.size());
+	for (int side = 0; side < 2; ++side)
+	{
+		venue->_quotes[side]._venue = venue->_cursors[side]._venue = venueNumber;
+		venue->_quotes[side]._level = venue->_cursors[side]._level = 0;
+	}
+	venue->_quotes[0]._price = orderBook->bid();
+	venue->_quotes[1]._price = orderBook->ask();
+	memset(&venue->_depth, 0, sizeof(venue->_depth));
+	_venues.push_back(venue);
+	_bids.push(venue->_quotes);
+	_asks.push(venue->_quotes + 1);
+	return venueNumber;
+}
+
+template<typename Q>
+void ConsolidatedBook::_merge(Q &merge, int side, DepthSnapshot &snapshot, unsigned levels)
+{
+	merge.clear();
+	for (Venue *venue : _venues)
+	{
+		VenuePrice *cursor = venue->_cursors + side;
+		cursor->_level = 0;
+		if (!venue->_depth._levelCnt[side]) continue;
+		cursor->_price = venue->_depth._prices[side][0];
+		merge.push(cursor);
+	}
+	unsigned cnt(0);
+	while (merge.size())
+	{
+		VenuePrice *cursor = merge.top();
+		const DepthSnapshot &depth = _venues[cursor->_venue]->_depth;
+		if (!cnt || snapshot._prices[side][cnt - 1] != cursor->_price)
+		{
+			if (cnt == levels) break;
+			snapshot._prices[side][cnt] = cursor->_price;
+			snapshot._shares[side][cnt] = snapshot._orderCnts[side][cnt] = 0;
+			++cnt;
+		}
+		snapshot._shares[side][cnt - 1] += depth._shares[side][cursor->_level];
+		snapshot._orderCnts[side][cnt - 1] += depth._orderCnts[side][cursor->_level];
+		// the venue's next level, or it drops out of the merge
+		if (++cursor->_level < depth._levelCnt[side])
+		{
+			cursor->_price = depth._prices[side][cursor->_level];
+			merge.reprioritize(cursor);
+		}
+		else merge.pop();
+	}
+	snapshot._levelCnt[side] = cnt;
+}
+
+void ConsolidatedBook::copyDepth(DepthSnapshot &snapshot, unsigned levels)
+{
+	if (levels > DepthSnapshot::MAX_LEVELS) levels = DepthSnapshot::MAX_LEVELS;
+	// each venue's best levels are enough, the consolidated top levels can not come from deeper in any one venue
+	for (Venue *venue : _venues)
+	{
+		if (venue->_orderBook->copyDepth(venue->_depth)) venue->_depth._levelCnt[0] = venue->_depth._levelCnt[1] = 0;
+	}
+	_merge(_bidMerge, 0, snapshot, levels);
+	_merge(_askMerge, 1, snapshot, levels);
+}
+
+ConsolidatedBook::~ConsolidatedBook()
+{
+	_bids.clear();
+	_asks.clear();
+	_bidMerge.clear();
+	_askMerge.clear();
+	for (Venue *venue : _venues) delete venue;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "DepthCache.h"
+#include "OrderBook.h"
+#include "PriorityQueue.h"
+
+#include <vector>
+
+/*
+** ConsolidatedBook
+** - best bid and offer of one symbol across venues, each venue an OrderBook with its own Exchange
+** - each venue's top price sits in a bid heap and an ask heap, the consolidated price is the top of the heap
+**   and a venue's top of book change is one reprioritize, O(log venues)
+** - an empty side keeps the book's sentinel price (0 bid, -1 ask), which sorts below every real price
+** - consolidated depth is a k-way merge of the venues' depth caches, venues without one are left out
+** - single threaded, update is called on the venues' thread, typically from Exchange::publishTopOfBook
+*/
+class ConsolidatedBook
+{
+protected:
+	struct VenuePrice : public Intrusive::HeapObject
+	{
+		unsigned _price;
+		unsigned _venue;
+		// position in the venue's depth while merging
+		unsigned _level;
+	};
+	// ties go to the lower venue so the order is stable
+	struct BidLess
+	{
+		bool operator()(const VenuePrice &a, const VenuePrice &b) const { return a._price < b._price || (a._price == b._price && a._venue > b._venue); }
+	};
+	struct AskLess
+	{
+		bool operator()(const VenuePrice &a, const VenuePrice &b) const { return a._price > b._price || (a._price == b._price && a._venue > b._venue); }
+	};
+	struct Venue
+	{
+		OrderBook *_orderBook;
+		VenuePrice _quotes[2];
+		VenuePrice _cursors[2];
+		DepthSnapshot _depth;
+	};
+
+	std::vector<Venue*> _venues;
+	Intrusive::PriorityQueue<VenuePrice, BidLess> _bids;
+	Intrusive::PriorityQueue<VenuePrice, AskLess> _asks;
+	Intrusive::PriorityQueue<VenuePrice, BidLess> _bidMerge;
+	Intrusive::PriorityQueue<VenuePrice, AskLess> _askMerge;
+
+	template<typename Q>
+	unsigned _topShares(const Q &quotes, int side) const;
+	template<typename Q>
+	void _merge(Q &merge, int side, DepthSnapshot &snapshot, unsigned levels);
+public:
+	ConsolidatedBook(unsigned venueCnt = 4) : _bids(venueCnt), _asks(venueCnt), _bidMerge(venueCnt), _askMerge(venueCnt) {}
+	// returns the venue number
+	unsigned addVenue(OrderBook *orderBook);
+	unsigned venueCnt() const { return static_cast<unsigned>(_venues.size()); }
+	OrderBook *orderBook(unsigned venue) { return _venues[venue]->_orderBook; }
+
+	// picks up the venue's current top of book
+	inline void update(unsigned venue);
+
+	unsigned bid() const { return _bids.size() ? _bids.top()->_price : 0; }
+	unsigned ask() const { return _asks.size() ? _asks.top()->_price : (unsigned)-1; }
+	// venue with the best price, the lowest numbered one on a tie, -1 if there are no venues
+	int bidVenue() const { return _bids.size() ? static_cast<int>(_bids.top()->_venue) : -1; }
+	int askVenue() const { return _asks.size() ? static_cast<int>(_asks.top()->_venue) : -1; }
+	// shares at the best price summed over the venues quoting it
+	unsigned bidShares() const { return _topShares(_bids, 0); }
+	unsigned askShares() const { return _topShares(_asks, 1); }
+
+	// top levels (at most DepthSnapshot::MAX_LEVELS) of both sides, shares and order counts summed by price
+	void copyDepth(DepthSnapshot &snapshot, unsigned levels);
+
+	~ConsolidatedBook();
+private:
+	ConsolidatedBook(const ConsolidatedBook&) = delete;
+	ConsolidatedBook& operator = (const ConsolidatedBook&) = delete;
+};
+
+inline
+void ConsolidatedBook::update(unsigned venue)
+{
+	Venue *v = _venues[venue];
+	unsigned bid = v->_orderBook->bid(), ask = v->_orderBook->ask();
+	if (v->_quotes[0]._price != bid)
+	{
+		v->_quotes[0]._price = bid;
+		_bids.reprioritize(v->_quotes);
+	}
+	if (v->_quotes[1]._price != ask)
+	{
+		v->_quotes[1]._price = ask;
+		_asks.reprioritize(v->_quotes + 1);
+	}
+}
+
+template<typename Q>
+unsigned ConsolidatedBook::_topShares(const Q &quotes, int side) const
+{
+	if (!quotes.size()) return 0;
+	unsigned price = quotes.top()->_price, shares(0);
+	if (price == (side ? (unsigned)-1 : 0)) return 0;
+	// venues at the best price form a subtree under the top, anything below a worse price is worse still
+	size_t stack[64], depth(0);
+	stack[depth++] = 1;
+	while (depth)
+	{
+		size_t position = stack[--depth];
+		VenuePrice *quote = quotes.getPosition(position);
+		if (!quote || quote->_price != price) continue;
+		OrderBook *orderBook = _venues[quote->_venue]->_orderBook;
+		shares += side ? orderBook->askShares() : orderBook->bidShares();
+		stack[depth++] = 2 * position;
+		stack[depth++] = 2 * position + 1;
+	}
+	return shares;
+}
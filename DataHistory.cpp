@@ -1,202 +1,186 @@
 #include "DataHistory.h"
 
-int Aggregator::initialize(uint64_t beginOffset, uint64_t endOffset, DataBucket * dataBucket)
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+** HugePages
+*/
+void *HugePages::allocate(size_t &size)
 {
-	_beginOffset = beginOffset;
-	_endOffset = endOffset;
-	_dataBucket = dataBucket;
-	return _beginOffset < _endOffset ? 0: -1;
+	const size_t hugePageSize = 2 << 20;
+	size = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+#ifdef _MSC_VER
+	// large pages need SeLockMemoryPrivilege, fall back to normal ones
+	size_t largePageSize = GetLargePageMinimum();
+	if (largePageSize && !(size % largePageSize))
+	{
+		void *memory = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (memory) return memory;
+	}
+	return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	// reserved huge pages first, then transparent huge pages
+	void *memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (memory != MAP_FAILED) return memory;
+	memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+	madvise(memory, size, MADV_HUGEPAGE);
+#endif
+	return memory;
+#endif
 }
 
-inline
-DataBucket* BucketHistory::_bucketForOffset(unsigned offset)
+void HugePages::free(void *memory, size_t size)
 {
-	return reinterpret_cast<DataBucket*>((reinterpret_cast<char*>(_dataBuckets) + offset * _bucketSize));
+#ifdef _MSC_VER
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
 }
 
-BucketHistory::BucketHistory():
-	_bucketCnt(0), _bucketDuration(0), _beginTime(0), _lastTime(0), _previousBucket(0), _previousTime(0), _dataBuckets(0)
+/*
+** BucketFile
+*/
+static size_t bucketFileSize(const BucketFileHeader &header)
 {
+	return sizeof(BucketFileHeader) + static_cast<size_t>(header._bucketCnt) * header._bucketSize;
 }
 
-void BucketHistory::addAggregator(Aggregator * aggregator)
+BucketFile::BucketFile() : _header(0), _size(0), _created(false)
+#ifdef _MSC_VER
+	, _file(INVALID_HANDLE_VALUE), _mapping(0)
+#else
+	, _fd(-1)
+#endif
 {
-	if (!aggregator->beginOffset())
-	{
-		// order by endOffset
-		Intrusive::LinkedListObject *obj = _realTimeAggregators.begin();
-		for (; obj != _realTimeAggregators.end(); obj = obj->next())
-		{
-			if (aggregator->endOffset() > static_cast<Aggregator*>(obj)->endOffset()) break;
-		}
-		obj->linkBefore(aggregator);
-
-	}
-	else
-	{
-		// order by startOffset
-		Intrusive::LinkedListObject *obj = _aggregators.begin();
-		for (; obj != _aggregators.end(); obj = obj->next())
-		{
-			if (aggregator->beginOffset() > static_cast<Aggregator*>(obj)->beginOffset()) break;
-		}
-		obj->linkBefore(aggregator);
-	}
 }
 
-int BucketHistory::addTime(uint64_t currentTime)
+int BucketFile::_map(bool readOnly)
 {
-	if (currentTime > _previousTime)
-	{
-		if (currentTime > _lastTime)
-		{
-			if (_previousBucketInt == _bucketCnt) return 0;
-			currentTime = _lastTime + 1;
-		}
-
-		unsigned currentBucketInt = static_cast<unsigned>((currentTime - _beginTime) / _bucketDuration);
-
-		// close out prior buckets
-		while (currentBucketInt > _previousBucketInt)
-		{
-			uint64_t bucketEndTime = _beginTime + (_previousBucketInt + 1) * _bucketDuration;
-
-			// update buckets
-			if (_previousData)
-			{
-				int64_t duration = bucketEndTime - _previousTime;
-				_previousBucket->addTime(duration, _previousData);
-
-				// add data to real time aggregators
-				for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
-				{
-					Aggregator *aggregator = static_cast<Aggregator*>(obj);
-					aggregator->addTime(duration, _previousData);
-				}
-				
-			}
-
-			// subtract buckets from real time aggregators
-			for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
-			{
-				Aggregator *aggregator = static_cast<Aggregator*>(obj);
-				unsigned subBucketOffset = static_cast<unsigned>(aggregator->endOffset() / _bucketDuration);
-				if (_previousBucketInt < subBucketOffset) break;
-				aggregator->subBucket(bucketForOffset(_previousBucketInt - subBucketOffset));
-			}
-
-			// add buckets to aggregators
-			for (Intrusive::LinkedListObject *obj = _aggregators.begin(); obj != _aggregators.end(); obj = obj->next())
-			{
-				Aggregator *aggregator = static_cast<Aggregator*>(obj);
-				unsigned addBucketOffset = static_cast<unsigned>(aggregator->beginOffset() / _bucketDuration);
-				if (_previousBucketInt < addBucketOffset) break;
-				aggregator->addBucket(bucketForOffset(_previousBucketInt - addBucketOffset));
-				// add buckets from aggregators
-				unsigned subBucketOffset = static_cast<unsigned>(aggregator->endOffset() / _bucketDuration);
-				if (_previousBucketInt< subBucketOffset) continue;
-				aggregator->subBucket(bucketForOffset(_previousBucketInt - subBucketOffset));
-			}
-
-			_previousTime = bucketEndTime;
-			if (++_previousBucketInt == _bucketCnt) return 0;
-			_previousBucket = reinterpret_cast<DataBucket*>(reinterpret_cast<char*>(_previousBucket) + _bucketSize);
-		}
-
-		// update current bucket
-		if (_previousData)
-		{
-			int64_t duration = currentTime - _previousTime;
-			_previousBucket->addTime(duration, _previousData);
-
-			// add data to real time aggregators
-			for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
-			{
-				static_cast<Aggregator*>(obj)->addTime(duration, _previousData);
-			}
-		}
-		_previousTime = currentTime;
-	}
-
+#ifdef _MSC_VER
+	if (!(_mapping = CreateFileMappingA(_file, 0, readOnly ? PAGE_READONLY : PAGE_READWRITE, static_cast<DWORD>(uint64_t(_size) >> 32), static_cast<DWORD>(_size), 0))) return -1;
+	void *data = MapViewOfFile(_mapping, readOnly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, _size);
+	if (!data) return -1;
+#else
+	void *data = mmap(0, _size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (data == MAP_FAILED) return -1;
+#endif
+	_header = static_cast<BucketFileHeader*>(data);
 	return 0;
 }
 
-int BucketHistory::addData(uint64_t currentTime, const void *data)
+int BucketFile::create(const char *fileName, const BucketFileHeader &header)
 {
-	int result(0);
-
-	if (currentTime < _previousTime)
+	close();
+	BucketFileHeader existing = {};
+	uint64_t fileSize;
+#ifdef _MSC_VER
+	_file = CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (_file == INVALID_HANDLE_VALUE) return -1;
+	LARGE_INTEGER size;
+	DWORD readSize(0);
+	if (!GetFileSizeEx(_file, &size)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(size.QuadPart);
+	if (fileSize >= sizeof(existing) && (!ReadFile(_file, &existing, sizeof(existing), &readSize, 0) || readSize != sizeof(existing))) { close(); return -1; }
+#else
+	if ((_fd = ::open(fileName, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+	struct stat st;
+	if (fstat(_fd, &st)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(st.st_size);
+	if (fileSize >= sizeof(existing) && pread(_fd, &existing, sizeof(existing), 0) != sizeof(existing)) { close(); return -1; }
+#endif
+	_size = bucketFileSize(header);
+	if (fileSize)
 	{
-		if (currentTime < _beginTime) _previousData = data;
-		else result = -1;
-	}
-	else
-	{
-		if (currentTime > _previousTime) addTime(currentTime);
-		if (_previousBucketInt < _bucketCnt)
+		// reattached, the schedule and bucket type must be the ones it was written with
+		if (fileSize < _size || existing._magic != BucketFileHeader::MAGIC || existing._version != BucketFileHeader::VERSION ||
+			existing._bucketType != header._bucketType || existing._bucketSize != header._bucketSize || existing._bucketCnt != header._bucketCnt ||
+			existing._bucketDuration != header._bucketDuration || existing._beginTime != header._beginTime || existing._endTime != header._endTime ||
+			existing._previousBucketInt > existing._bucketCnt || _map(false))
 		{
-			_previousBucket->addData(data);
-
-			// add data to real time aggregators
-			for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
-			{
-				static_cast<Aggregator*>(obj)->addData(data);
-			}
+			close();
+			return -1;
 		}
-		_previousData = data;
+		return 0;
 	}
+#ifndef _MSC_VER
+	// the mapping extends the file on windows
+	if (ftruncate(_fd, static_cast<off_t>(_size))) { close(); return -1; }
+#endif
+	if (_map(false)) { close(); return -1; }
+	*_header = header;
+	_created = true;
 	return 0;
 }
 
-unsigned BucketHistory::bucketOffsetForTime(uint64_t timeUnit) const
+int BucketFile::open(const char *fileName)
 {
-	unsigned offset(0);
-	if (timeUnit > _beginTime)
+	close();
+	uint64_t fileSize;
+#ifdef _MSC_VER
+	_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (_file == INVALID_HANDLE_VALUE) return -1;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(size.QuadPart);
+#else
+	if ((_fd = ::open(fileName, O_RDONLY)) < 0) return -1;
+	struct stat st;
+	if (fstat(_fd, &st)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(st.st_size);
+#endif
+	BucketFileHeader header;
+#ifdef _MSC_VER
+	DWORD readSize(0);
+	if (fileSize < sizeof(header) || !ReadFile(_file, &header, sizeof(header), &readSize, 0) || readSize != sizeof(header)) { close(); return -1; }
+#else
+	if (fileSize < sizeof(header) || pread(_fd, &header, sizeof(header), 0) != sizeof(header)) { close(); return -1; }
+#endif
+	_size = bucketFileSize(header);
+	if (header._magic != BucketFileHeader::MAGIC || header._version != BucketFileHeader::VERSION || fileSize < _size || _map(true))
 	{
-		if (timeUnit > _lastTime) offset = _bucketCnt - 1;
-		else offset = static_cast<unsigned>((timeUnit = _beginTime) / _bucketDuration);
+		close();
+		return -1;
 	}
-	return offset;
-}
-
-DataBucket& BucketHistory::bucketForOffset(unsigned offset)
-{
-	if (offset > _bucketCnt - 1) offset = _bucketCnt - 1;
-	return *(DataBucket*)(reinterpret_cast<char*>(_dataBuckets) + offset * _bucketSize);
-}
-
-void BucketHistory::reset()
-{
-	for (unsigned bucketInt(0); bucketInt < _bucketCnt; ++bucketInt)
-	{
-		bucketForOffset(bucketInt).reset();
-	}
-
-	for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
-	{
-		static_cast<Aggregator*>(obj)->reset();
-	}
-
-	for (Intrusive::LinkedListObject *obj = _aggregators.begin(); obj != _aggregators.end(); obj = obj->next())
-	{
-		static_cast<Aggregator*>(obj)->reset();
-	}
-
-	_previousTime = _beginTime;
-	_previousBucketInt = 0;
-	_previousBucket = _dataBuckets;
-	_previousData = 0;
+	return 0;
 }
 
-void BucketHistory::stop(uint64_t currentTime)
+void BucketFile::close()
 {
-	if (_previousData && currentTime > _previousTime) addTime(currentTime);
-	_previousData = 0;
+#ifdef _MSC_VER
+	if (_header) UnmapViewOfFile(_header);
+	if (_mapping) CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+	_mapping = 0;
+	_file = INVALID_HANDLE_VALUE;
+#else
+	if (_header) munmap(_header, _size);
+	if (_fd >= 0) ::close(_fd);
+	_fd = -1;
+#endif
+	_header = 0;
+	_size = 0;
+	_created = false;
 }
 
-BucketHistory::~BucketHistory()
+void BucketFile::sync()
 {
-	if (_dataBuckets) delete[] _dataBuckets;
+	if (!_header) return;
+#ifdef _MSC_VER
+	FlushViewOfFile(_header, 0);
+	FlushFileBuffers(_file);
+#else
+	msync(_header, _size, MS_SYNC);
+#endif
 }
 
 /*
@@ -3,8 +3,21 @@
 #include "IntrusiveLinkedList.h"
 #include "IntrusiveQueue.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 /*
 ** DataBucket
 ** - accumulates data
@@ -32,49 +45,203 @@ public:
 };
 
 /*
-** Aggregator
+** BucketTraits
+** - how a BasicBucketHistory lays out, allocates and calls its buckets
+** - StaticBucketTraits: a typed array, bucket methods called directly, BucketType needs no virtual methods
+** - DynamicBucketTraits: DataBuckets of any derived type with a runtime stride, bucket methods called virtually
+** - close is called once a bucket is complete and will not change again, clear when the history is reset
+** - CallTraits are the bucket calls alone, traits derived for storage keep them, so aggregators of one bucket type
+**   work with every history of it
+*/
+template <typename BucketType>
+struct StaticBucketTraits
+{
+	typedef StaticBucketTraits<BucketType> CallTraits;
+
+	static void addData(BucketType &bucket, const void *data) { bucket.BucketType::addData(data); }
+	static void subData(BucketType &bucket, const void *data) { bucket.BucketType::subData(data); }
+	static void addTime(BucketType &bucket, int64_t duration, const void *data) { bucket.BucketType::addTime(duration, data); }
+	static void subTime(BucketType &bucket, int64_t duration, const void *data) { bucket.BucketType::subTime(duration, data); }
+	static void addBucket(BucketType &bucket, const BucketType &dataBucket) { bucket.BucketType::operator += (dataBucket); }
+	static void subBucket(BucketType &bucket, const BucketType &dataBucket) { bucket.BucketType::operator -= (dataBucket); }
+	static void reset(BucketType &bucket) { bucket.BucketType::reset(); }
+
+	BucketType *allocate(size_t bucketCnt) { return new BucketType[bucketCnt]; }
+	void free(BucketType *dataBuckets) { delete[] dataBuckets; }
+	BucketType *next(BucketType *dataBucket) const { return dataBucket + 1; }
+	BucketType *at(BucketType *dataBuckets, unsigned offset) const { return dataBuckets + offset; }
+	void close(const BucketType &bucket, unsigned offset) {}
+	void clear() {}
+	// the history's partial sums, apart from wherever the buckets live
+	BucketType *allocateSum() { return new BucketType; }
+	void freeSum(BucketType *sum) { delete sum; }
+};
+
+template <typename BucketType>
+struct BucketGenerator
+{
+	DataBucket *generate(size_t bucketCnt) { return new BucketType[bucketCnt]; }
+	size_t bucketSize() { return sizeof(BucketType); }
+	static DataBucket *allocate(size_t bucketCnt) { return new BucketType[bucketCnt]; }
+	static void free(DataBucket *dataBuckets) { delete[] static_cast<BucketType*>(dataBuckets); }
+};
+
+struct DynamicBucketTraits
+{
+	typedef DynamicBucketTraits CallTraits;
+
+	size_t _bucketSize;
+	DataBucket *(*_allocate)(size_t bucketCnt);
+	void (*_free)(DataBucket *dataBuckets);
+
+	DynamicBucketTraits() : _bucketSize(sizeof(DataBucket)), _allocate(&BucketGenerator<DataBucket>::allocate), _free(&BucketGenerator<DataBucket>::free) {}
+	template <typename BucketType>
+	void set(BucketGenerator<BucketType> &bucketGenerator)
+	{
+		_bucketSize = bucketGenerator.bucketSize();
+		_allocate = &BucketGenerator<BucketType>::allocate;
+		_free = &BucketGenerator<BucketType>::free;
+	}
+
+	static void addData(DataBucket &bucket, const void *data) { bucket.addData(data); }
+	static void subData(DataBucket &bucket, const void *data) { bucket.subData(data); }
+	static void addTime(DataBucket &bucket, int64_t duration, const void *data) { bucket.addTime(duration, data); }
+	static void subTime(DataBucket &bucket, int64_t duration, const void *data) { bucket.subTime(duration, data); }
+	static void addBucket(DataBucket &bucket, const DataBucket &dataBucket) { bucket += dataBucket; }
+	static void subBucket(DataBucket &bucket, const DataBucket &dataBucket) { bucket -= dataBucket; }
+	static void reset(DataBucket &bucket) { bucket.reset(); }
+
+	DataBucket *allocate(size_t bucketCnt) { return _allocate(bucketCnt); }
+	void free(DataBucket *dataBuckets) { _free(dataBuckets); }
+	DataBucket *next(DataBucket *dataBucket) const { return reinterpret_cast<DataBucket*>(reinterpret_cast<char*>(dataBucket) + _bucketSize); }
+	DataBucket *at(DataBucket *dataBuckets, unsigned offset) const { return reinterpret_cast<DataBucket*>(reinterpret_cast<char*>(dataBuckets) + offset * _bucketSize); }
+	void close(const DataBucket &bucket, unsigned offset) {}
+	void clear() {}
+	DataBucket *allocateSum() { return _allocate(1); }
+	void freeSum(DataBucket *sum) { _free(sum); }
+};
+
+/*
+** BasicAggregator
 ** - accumulates data for a time range
+** - registered with a BasicBucketHistory it holds no running total, dataBucket() sums its window from the history's
+**   partial sums into the bucket, so read it through dataBucket()
 */
-class Aggregator : public Intrusive::LinkedListObject
+template <typename BucketType, typename Traits = StaticBucketTraits<BucketType>>
+class BasicAggregator : public Intrusive::LinkedListObject
 {
 protected:
 	uint64_t _beginOffset;
 	uint64_t _endOffset;
-	DataBucket *_dataBucket;
+	BucketType *_dataBucket;
+	// partial sums [_sumBegin, _sumEnd) of the history, and its open bucket for a real time window
+	const std::vector<BucketType*> *_sums;
+	unsigned _sumBegin;
+	unsigned _sumEnd;
+	BucketType *const *_openBucket;
 public:
-	Aggregator() : _beginOffset(0), _endOffset(0), _dataBucket(0) {}
+	BasicAggregator() : _beginOffset(0), _endOffset(0), _dataBucket(0), _sums(0), _sumBegin(0), _sumEnd(0), _openBucket(0) {}
 
-	int initialize(uint64_t beginOffset, uint64_t endOffset, DataBucket *dataBucket);
+	int initialize(uint64_t beginOffset, uint64_t endOffset, BucketType *dataBucket);
 	uint64_t beginOffset() const { return _beginOffset; }
 	uint64_t endOffset() const { return _endOffset; }
-	const DataBucket* dataBucket() const { return _dataBucket; }
+	const BucketType* dataBucket() const;
+	// set by the history as its boundaries change, sums 0 when it has no buckets
+	void schedule(const std::vector<BucketType*> *sums, unsigned sumBegin, unsigned sumEnd, BucketType *const *openBucket)
+	{
+		_sums = sums;
+		_sumBegin = sumBegin;
+		_sumEnd = sumEnd;
+		_openBucket = openBucket;
+	}
 
-	void addData(const void *data) { _dataBucket->addData(data); }
-	void subData(const void * data) { _dataBucket->subData(data); }
-	void addTime(int64_t duration, const void *data) { _dataBucket->addTime(duration, data); }
-	void subTime(int64_t duration, const void *data) { _dataBucket->subTime(duration, data); }
+	void addData(const void *data) { Traits::addData(*_dataBucket, data); }
+	void subData(const void * data) { Traits::subData(*_dataBucket, data); }
+	void addTime(int64_t duration, const void *data) { Traits::addTime(*_dataBucket, duration, data); }
+	void subTime(int64_t duration, const void *data) { Traits::subTime(*_dataBucket, duration, data); }
 
-	void addBucket(const DataBucket &dataBucket) { *_dataBucket += dataBucket; }
-	void subBucket(const DataBucket &dataBucket) { *_dataBucket -= dataBucket; }
+	void addBucket(const BucketType &dataBucket) { Traits::addBucket(*_dataBucket, dataBucket); }
+	void subBucket(const BucketType &dataBucket) { Traits::subBucket(*_dataBucket, dataBucket); }
 
-	void reset() { _dataBucket->reset(); }
+	void reset() { Traits::reset(*_dataBucket); }
 };
 
+template <typename BucketType, typename Traits>
+int BasicAggregator<BucketType, Traits>::initialize(uint64_t beginOffset, uint64_t endOffset, BucketType *dataBucket)
+{
+	_beginOffset = beginOffset;
+	_endOffset = endOffset;
+	_dataBucket = dataBucket;
+	return _beginOffset < _endOffset ? 0: -1;
+}
+
+template <typename BucketType, typename Traits>
+const BucketType* BasicAggregator<BucketType, Traits>::dataBucket() const
+{
+	if (_sums)
+	{
+		Traits::reset(*_dataBucket);
+		for (unsigned sumInt = _sumBegin; sumInt < _sumEnd; ++sumInt) Traits::addBucket(*_dataBucket, *(*_sums)[sumInt]);
+		// 0 once the session has ended
+		if (_openBucket && *_openBucket) Traits::addBucket(*_dataBucket, **_openBucket);
+	}
+	return _dataBucket;
+}
+
 /*
-** BucketHistory
-** - uses a vector of DataBuckets to aggregate data
-** - aggregators sum data over time ranges
-** - good for summing over a long period of time
+** AggregatorSchedule
+** - the distinct window boundaries of all aggregators, ascending, as lags in buckets behind the newest closed bucket
+** - the history keeps one partial sum between each pair of adjacent lags, the closed buckets whose lags fall in
+**   [lag, next lag), and a close moves one bucket into and one out of each, so its cost grows with the distinct
+**   boundaries however many aggregators share them
+** - a window is the run of partial sums between its two lags, plus the open bucket if it is real time, summed on read
 */
-template <typename BucketType>
-struct BucketGenerator
+template <typename AggregatorType>
+class AggregatorSchedule
 {
-	DataBucket *generate(size_t bucketCnt) { return new BucketType[bucketCnt]; }
-	size_t bucketSize() { return sizeof(BucketType); }
+protected:
+	std::vector<unsigned> _lags;
+public:
+	// real time aggregators begin at lag 0
+	void build(Intrusive::LinkedList &realTimeAggregators, Intrusive::LinkedList &aggregators, unsigned bucketDuration);
+	const std::vector<unsigned> &lags() const { return _lags; }
+	// the partial sum beginning at a boundary's lag
+	unsigned sumInt(uint64_t offset, unsigned bucketDuration) const
+	{
+		return static_cast<unsigned>(std::lower_bound(_lags.begin(), _lags.end(), static_cast<unsigned>(offset / bucketDuration)) - _lags.begin());
+	}
 };
 
-class BucketHistory
+template <typename AggregatorType>
+void AggregatorSchedule<AggregatorType>::build(Intrusive::LinkedList &realTimeAggregators, Intrusive::LinkedList &aggregators, unsigned bucketDuration)
 {
+	_lags.clear();
+	if (realTimeAggregators.begin() != realTimeAggregators.end()) _lags.push_back(0);
+	for (Intrusive::LinkedListObject *obj = realTimeAggregators.begin(); obj != realTimeAggregators.end(); obj = obj->next())
+	{
+		_lags.push_back(static_cast<unsigned>(static_cast<AggregatorType*>(obj)->endOffset() / bucketDuration));
+	}
+	for (Intrusive::LinkedListObject *obj = aggregators.begin(); obj != aggregators.end(); obj = obj->next())
+	{
+		AggregatorType *aggregator = static_cast<AggregatorType*>(obj);
+		_lags.push_back(static_cast<unsigned>(aggregator->beginOffset() / bucketDuration));
+		_lags.push_back(static_cast<unsigned>(aggregator->endOffset() / bucketDuration));
+	}
+	std::sort(_lags.begin(), _lags.end());
+	_lags.erase(std::unique(_lags.begin(), _lags.end()), _lags.end());
+}
+
+/*
+** BasicBucketHistory
+** - uses an array of buckets to aggregate data
+** - aggregators sum data over time ranges
+** - good for summing over a long period of time
+*/
+template <typename BucketType, typename Traits = StaticBucketTraits<BucketType>>
+class BasicBucketHistory
+{
+public:
+	typedef BasicAggregator<BucketType, typename Traits::CallTraits> AggregatorType;
 protected:
 	unsigned _bucketCnt;
 	unsigned _bucketDuration;
@@ -84,23 +251,42 @@ protected:
 	unsigned _previousBucketInt;
 	uint64_t _previousTime;
 
-	DataBucket *_previousBucket;
-	DataBucket *_dataBuckets;
-	size_t _bucketSize;
+	BucketType *_previousBucket;
+	BucketType *_dataBuckets;
+	Traits _traits;
 
 	const void *_previousData;
 
 	Intrusive::LinkedList _realTimeAggregators;
 	Intrusive::LinkedList _aggregators;
+	AggregatorSchedule<AggregatorType> _schedule;
+	std::vector<BucketType*> _sums;
 
-	DataBucket *_bucketForOffset(unsigned offset);
+	BucketType *_bucketForOffset(unsigned offset) { return _traits.at(_dataBuckets, offset); }
+	void _freeBuckets() { _freeSums(); if (_dataBuckets) _traits.free(_dataBuckets); _dataBuckets = _previousBucket = 0; }
+	void _freeSums() { for (BucketType *sum : _sums) _traits.freeSum(sum); _sums.clear(); }
+	// the schedule and partial sums for the current aggregators, summed from the closed buckets, and each aggregator's run of them
+	void _buildSums();
+	// the previous data's time up to currentTime, into the open bucket
+	void _addDuration(uint64_t currentTime);
+	void _addData(const void *data);
+	// the open bucket is complete, the partial sums take and give up the buckets at their boundaries
+	void _closeBucket();
+	// everything reset() does but the buckets
+	void _resetState();
+	unsigned _bucketIntForTime(uint64_t time) const { return static_cast<unsigned>((time - _beginTime) / _bucketDuration); }
+	uint64_t _bucketEndTime(unsigned bucketInt) const { return _beginTime + uint64_t(bucketInt + 1) * _bucketDuration; }
+	// buckets only, the calls addData and addTime make from bucketInt on, the bucket's own time is left to the shard before
+	// unless ownsBucket, close adds the rest of the last bucket
+	template <typename TimeOf, typename DataOf>
+	void _fill(size_t beginInt, size_t endInt, TimeOf &timeOf, DataOf &dataOf, unsigned bucketInt, uint64_t previousTime, const void *previousData, bool ownsBucket, bool close);
 public:
-	BucketHistory();
+	BasicBucketHistory();
 
-	template <typename BucketType>
-	int initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, BucketGenerator<BucketType> &bucketGenerator);
+	int initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime);
 
-	void addAggregator(Aggregator *aggregator);
+	// an aggregator added during the session starts with its whole window
+	void addAggregator(AggregatorType *aggregator);
 
 	unsigned bucketCount() const { return _bucketCnt; }
 	unsigned bucketDuration() const { return _bucketDuration; }
@@ -108,31 +294,70 @@ public:
 	uint64_t endTime() const { return _lastTime + 1; }
 	uint64_t lastUpdateTime() const { return _previousTime; }
 	unsigned bucketOffsetForTime(uint64_t timeUnit) const;
-	DataBucket& bucketForOffset(unsigned offset);
+	BucketType& bucketForOffset(unsigned offset);
 
+	// returns -1 for data older than the last update inside the session, data before the session only becomes the previous data
 	int addData(uint64_t currentTime, const void *data);
 	int addTime(uint64_t currentTime);
 	void stop(uint64_t currentTime);
+	// the same as addData(timeOf(i), dataOf(i)) for i in [0, dataCnt), in time order, with the buckets filled by threadCnt
+	// threads (0 for every core) over time shards cut on bucket boundaries, so every bucket is built by one thread with
+	// the serial calls and is bit identical, the partial sums then take the new buckets whole on this thread, as the
+	// serial closes would, and every aggregator matches the serial run exactly
+	template <typename TimeOf, typename DataOf>
+	void backfill(size_t dataCnt, TimeOf timeOf, DataOf dataOf, unsigned threadCnt = 0);
 
 	void reset();
 
-	~BucketHistory();
+	~BasicBucketHistory() { _freeBuckets(); }
 private:
-	BucketHistory(const BucketHistory&) = delete;
-	BucketHistory& operator = (const BucketHistory&) = delete;
+	BasicBucketHistory(const BasicBucketHistory&) = delete;
+	BasicBucketHistory& operator = (const BasicBucketHistory&) = delete;
 };
 
-template<typename BucketType>
-inline int BucketHistory::initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, BucketGenerator<BucketType>& bucketGenerator)
+// bucket methods resolved at compile time
+template <typename BucketType>
+using TypedAggregator = BasicAggregator<BucketType>;
+template <typename BucketType>
+using TypedBucketHistory = BasicBucketHistory<BucketType>;
+
+/*
+** Aggregator, BucketHistory
+** - the polymorphic interface, any DataBucket type chosen at run time through its BucketGenerator
+*/
+class Aggregator : public BasicAggregator<DataBucket, DynamicBucketTraits>
+{
+};
+
+class BucketHistory : public BasicBucketHistory<DataBucket, DynamicBucketTraits>
+{
+public:
+	template <typename BucketType>
+	int initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, BucketGenerator<BucketType> &bucketGenerator)
+	{
+		if (! bucketDuration || endTime < beginTime + bucketDuration) return -1;
+		_freeBuckets();
+		_traits.set(bucketGenerator);
+		return BasicBucketHistory::initialize(bucketDuration, beginTime, endTime);
+	}
+};
+
+template <typename BucketType, typename Traits>
+BasicBucketHistory<BucketType, Traits>::BasicBucketHistory():
+	_bucketCnt(0), _bucketDuration(0), _beginTime(0), _lastTime(0), _previousBucketInt(0), _previousTime(0), _previousBucket(0), _dataBuckets(0), _previousData(0)
+{
+}
+
+template <typename BucketType, typename Traits>
+int BasicBucketHistory<BucketType, Traits>::initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime)
 {
 	if (! bucketDuration || endTime < beginTime + bucketDuration) return -1;
 
 	// data buckets
 	_bucketDuration = bucketDuration;
-	if (_dataBuckets) delete[] _dataBuckets;
+	_freeBuckets();
 	_bucketCnt = (endTime - beginTime - 1) / bucketDuration + 1;
-	_dataBuckets = bucketGenerator.generate(_bucketCnt);
-	_bucketSize = bucketGenerator.bucketSize();
+	_dataBuckets = _traits.allocate(_bucketCnt);
 
 	_beginTime = beginTime;
 	_lastTime = endTime - 1;
@@ -142,6 +367,1035 @@ inline int BucketHistory::initialize(unsigned bucketDuration, uint64_t beginTime
 	return 0;
 }
 
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::addAggregator(AggregatorType *aggregator)
+{
+	if (!aggregator->beginOffset())
+	{
+		// order by endOffset
+		Intrusive::LinkedListObject *obj = _realTimeAggregators.begin();
+		for (; obj != _realTimeAggregators.end(); obj = obj->next())
+		{
+			if (aggregator->endOffset() > static_cast<AggregatorType*>(obj)->endOffset()) break;
+		}
+		obj->linkBefore(aggregator);
+
+	}
+	else
+	{
+		// order by startOffset
+		Intrusive::LinkedListObject *obj = _aggregators.begin();
+		for (; obj != _aggregators.end(); obj = obj->next())
+		{
+			if (aggregator->beginOffset() > static_cast<AggregatorType*>(obj)->beginOffset()) break;
+		}
+		obj->linkBefore(aggregator);
+	}
+	_buildSums();
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::_buildSums()
+{
+	if (!_dataBuckets)
+	{
+		_freeSums();
+		for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next()) static_cast<AggregatorType*>(obj)->schedule(0, 0, 0, 0);
+		for (Intrusive::LinkedListObject *obj = _aggregators.begin(); obj != _aggregators.end(); obj = obj->next()) static_cast<AggregatorType*>(obj)->schedule(0, 0, 0, 0);
+		return;
+	}
+	_schedule.build(_realTimeAggregators, _aggregators, _bucketDuration);
+	const std::vector<unsigned> &lags = _schedule.lags();
+	size_t sumCnt = lags.size() > 1 ? lags.size() - 1 : 0;
+	while (_sums.size() > sumCnt)
+	{
+		_traits.freeSum(_sums.back());
+		_sums.pop_back();
+	}
+	while (_sums.size() < sumCnt) _sums.push_back(_traits.allocateSum());
+
+	// the newest closed bucket, the one before the open bucket, is at lag 0
+	for (size_t sumInt = 0; sumInt < sumCnt; ++sumInt)
+	{
+		Traits::reset(*_sums[sumInt]);
+		for (unsigned lag = lags[sumInt]; lag < lags[sumInt + 1] && lag < _previousBucketInt; ++lag) Traits::addBucket(*_sums[sumInt], *_bucketForOffset(_previousBucketInt - 1 - lag));
+	}
+	for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
+	{
+		AggregatorType *aggregator = static_cast<AggregatorType*>(obj);
+		aggregator->schedule(&_sums, 0, _schedule.sumInt(aggregator->endOffset(), _bucketDuration), &_previousBucket);
+	}
+	for (Intrusive::LinkedListObject *obj = _aggregators.begin(); obj != _aggregators.end(); obj = obj->next())
+	{
+		AggregatorType *aggregator = static_cast<AggregatorType*>(obj);
+		aggregator->schedule(&_sums, _schedule.sumInt(aggregator->beginOffset(), _bucketDuration), _schedule.sumInt(aggregator->endOffset(), _bucketDuration), 0);
+	}
+}
+
+template <typename BucketType, typename Traits>
+int BasicBucketHistory<BucketType, Traits>::addTime(uint64_t currentTime)
+{
+	if (currentTime > _previousTime)
+	{
+		if (currentTime > _lastTime)
+		{
+			if (_previousBucketInt == _bucketCnt) return 0;
+			currentTime = _lastTime + 1;
+		}
+
+		unsigned currentBucketInt = static_cast<unsigned>((currentTime - _beginTime) / _bucketDuration);
+
+		// close out prior buckets
+		while (currentBucketInt > _previousBucketInt)
+		{
+			_addDuration(_beginTime + uint64_t(_previousBucketInt + 1) * _bucketDuration);
+			_closeBucket();
+			if (++_previousBucketInt == _bucketCnt)
+			{
+				// no open bucket for the real time aggregators
+				_previousBucket = 0;
+				return 0;
+			}
+			_previousBucket = _traits.next(_previousBucket);
+		}
+
+		// update current bucket
+		_addDuration(currentTime);
+	}
+
+	return 0;
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::_addDuration(uint64_t currentTime)
+{
+	if (_previousData)
+	{
+		Traits::addTime(*_previousBucket, currentTime - _previousTime, _previousData);
+	}
+	_previousTime = currentTime;
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::_addData(const void *data)
+{
+	Traits::addData(*_previousBucket, data);
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::_closeBucket()
+{
+	// the bucket reaching each lag moves from the partial sum ending there to the one beginning there
+	const std::vector<unsigned> &lags = _schedule.lags();
+	for (size_t lagInt = 0; lagInt < lags.size() && lags[lagInt] <= _previousBucketInt; ++lagInt)
+	{
+		const BucketType &dataBucket = *_bucketForOffset(_previousBucketInt - lags[lagInt]);
+		if (lagInt < _sums.size()) Traits::addBucket(*_sums[lagInt], dataBucket);
+		if (lagInt) Traits::subBucket(*_sums[lagInt - 1], dataBucket);
+	}
+	_traits.close(*_previousBucket, _previousBucketInt);
+}
+
+template <typename BucketType, typename Traits>
+template <typename TimeOf, typename DataOf>
+void BasicBucketHistory<BucketType, Traits>::_fill(size_t beginInt, size_t endInt, TimeOf &timeOf, DataOf &dataOf, unsigned bucketInt, uint64_t previousTime, const void *previousData, bool ownsBucket, bool close)
+{
+	BucketType *bucket = _bucketForOffset(bucketInt);
+	for (size_t dataInt = beginInt; dataInt < endInt; ++dataInt)
+	{
+		uint64_t currentTime = timeOf(dataInt);
+		if (currentTime > previousTime)
+		{
+			unsigned currentBucketInt = _bucketIntForTime(currentTime);
+			while (currentBucketInt > bucketInt)
+			{
+				uint64_t bucketEndTime = _bucketEndTime(bucketInt);
+				if (previousData && ownsBucket) Traits::addTime(*bucket, bucketEndTime - previousTime, previousData);
+				previousTime = bucketEndTime;
+				bucket = _bucketForOffset(++bucketInt);
+				ownsBucket = true;
+			}
+			if (previousData) Traits::addTime(*bucket, currentTime - previousTime, previousData);
+			previousTime = currentTime;
+		}
+		previousData = dataOf(dataInt);
+		Traits::addData(*bucket, previousData);
+	}
+	if (close && previousData) Traits::addTime(*bucket, _bucketEndTime(bucketInt) - previousTime, previousData);
+}
+
+template <typename BucketType, typename Traits>
+template <typename TimeOf, typename DataOf>
+void BasicBucketHistory<BucketType, Traits>::backfill(size_t dataCnt, TimeOf timeOf, DataOf dataOf, unsigned threadCnt)
+{
+	// the open bucket, anything before it and anything past the end go through addData
+	size_t beginInt(0), endInt(dataCnt);
+	for (; beginInt < dataCnt; ++beginInt)
+	{
+		uint64_t currentTime = timeOf(beginInt);
+		if (_previousBucketInt < _bucketCnt && currentTime >= _beginTime && currentTime >= _previousTime && (currentTime > _lastTime || _bucketIntForTime(currentTime) > _previousBucketInt)) break;
+		addData(currentTime, dataOf(beginInt));
+	}
+	while (endInt > beginInt && timeOf(endInt - 1) > _lastTime) --endInt;
+
+	if (beginInt < endInt)
+	{
+		unsigned firstBucketInt = _previousBucketInt, lastBucketInt = _bucketIntForTime(timeOf(endInt - 1));
+		// the open bucket's time, as addTime would close it
+		_addDuration(_bucketEndTime(firstBucketInt));
+
+		// shards start at the first data of a bucket
+		if (!threadCnt) threadCnt = std::thread::hardware_concurrency();
+		if (!threadCnt) threadCnt = 1;
+		std::vector<size_t> shards(1, beginInt);
+		for (unsigned shardInt = 1; shardInt < threadCnt; ++shardInt)
+		{
+			size_t dataInt = beginInt + (endInt - beginInt) * shardInt / threadCnt;
+			if (dataInt <= shards.back()) dataInt = shards.back() + 1;
+			for (; dataInt < endInt && _bucketIntForTime(timeOf(dataInt)) == _bucketIntForTime(timeOf(dataInt - 1)); ++dataInt);
+			if (dataInt >= endInt) break;
+			shards.push_back(dataInt);
+		}
+		shards.push_back(endInt);
+
+		std::vector<std::thread> threads;
+		for (size_t shardInt = 1; shardInt + 1 < shards.size(); ++shardInt)
+		{
+			threads.push_back(std::thread([this, &timeOf, &dataOf, &shards, shardInt]()
+			{
+				size_t previousInt = shards[shardInt] - 1;
+				_fill(shards[shardInt], shards[shardInt + 1], timeOf, dataOf, _bucketIntForTime(timeOf(previousInt)), timeOf(previousInt), dataOf(previousInt), false, shardInt + 2 < shards.size());
+			}));
+		}
+		_fill(shards[0], shards[1], timeOf, dataOf, firstBucketInt, _previousTime, _previousData, false, shards.size() > 2);
+		for (std::thread &thread : threads) thread.join();
+
+		// partial sums and the close hook in bucket order
+		for (unsigned bucketInt = firstBucketInt; bucketInt < lastBucketInt; ++bucketInt)
+		{
+			_previousBucketInt = bucketInt;
+			_previousBucket = _bucketForOffset(bucketInt);
+			_closeBucket();
+		}
+		_previousBucketInt = lastBucketInt;
+		_previousBucket = _bucketForOffset(lastBucketInt);
+		_previousTime = timeOf(endInt - 1);
+		_previousData = dataOf(endInt - 1);
+	}
+
+	for (; endInt < dataCnt; ++endInt) addData(timeOf(endInt), dataOf(endInt));
+}
+
+template <typename BucketType, typename Traits>
+int BasicBucketHistory<BucketType, Traits>::addData(uint64_t currentTime, const void *data)
+{
+	int result(0);
+
+	if (currentTime < _previousTime)
+	{
+		if (currentTime < _beginTime) _previousData = data;
+		else result = -1;
+	}
+	else
+	{
+		if (currentTime > _previousTime) addTime(currentTime);
+		if (_previousBucketInt < _bucketCnt) _addData(data);
+		_previousData = data;
+	}
+	return result;
+}
+
+template <typename BucketType, typename Traits>
+unsigned BasicBucketHistory<BucketType, Traits>::bucketOffsetForTime(uint64_t timeUnit) const
+{
+	unsigned offset(0);
+	if (timeUnit > _beginTime)
+	{
+		if (timeUnit > _lastTime) offset = _bucketCnt - 1;
+		else offset = static_cast<unsigned>((timeUnit = _beginTime) / _bucketDuration);
+	}
+	return offset;
+}
+
+template <typename BucketType, typename Traits>
+BucketType& BasicBucketHistory<BucketType, Traits>::bucketForOffset(unsigned offset)
+{
+	if (offset > _bucketCnt - 1) offset = _bucketCnt - 1;
+	return *_bucketForOffset(offset);
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::reset()
+{
+	for (unsigned bucketInt(0); bucketInt < _bucketCnt; ++bucketInt)
+	{
+		Traits::reset(bucketForOffset(bucketInt));
+	}
+	_resetState();
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::_resetState()
+{
+	for (Intrusive::LinkedListObject *obj = _realTimeAggregators.begin(); obj != _realTimeAggregators.end(); obj = obj->next())
+	{
+		static_cast<AggregatorType*>(obj)->reset();
+	}
+
+	for (Intrusive::LinkedListObject *obj = _aggregators.begin(); obj != _aggregators.end(); obj = obj->next())
+	{
+		static_cast<AggregatorType*>(obj)->reset();
+	}
+	_traits.clear();
+
+	_previousTime = _beginTime;
+	_previousBucketInt = 0;
+	_previousBucket = _dataBuckets;
+	_previousData = 0;
+	_buildSums();
+}
+
+template <typename BucketType, typename Traits>
+void BasicBucketHistory<BucketType, Traits>::stop(uint64_t currentTime)
+{
+	if (_previousData && currentTime > _previousTime) addTime(currentTime);
+	_previousData = 0;
+}
+
+/*
+** ColumnarBuckets
+** - closed buckets transposed into one 64 byte aligned int64_t column per field
+** - a range sum is a contiguous SSE2 (AVX2 when enabled) add down each column instead of strided loads over the buckets
+*/
+template <unsigned FieldCnt>
+class ColumnarBuckets
+{
+protected:
+	int64_t *_memory;
+	int64_t *_columns[FieldCnt];
+public:
+	ColumnarBuckets() : _memory(0) {}
+
+	void allocate(size_t bucketCnt)
+	{
+		free();
+		// whole cache lines per column, the first one aligned by hand
+		size_t stride = (bucketCnt + 7) & ~size_t(7);
+		_memory = new int64_t[FieldCnt * stride + 7];
+		int64_t *column = reinterpret_cast<int64_t*>((reinterpret_cast<uintptr_t>(_memory) + 63) & ~uintptr_t(63));
+		for (unsigned field = 0; field < FieldCnt; ++field, column += stride) _columns[field] = column;
+	}
+	void free() { delete[] _memory; _memory = 0; }
+
+	void store(unsigned offset, const int64_t *values)
+	{
+		for (unsigned field = 0; field < FieldCnt; ++field) _columns[field][offset] = values[field];
+	}
+	const int64_t *column(unsigned field) const { return _columns[field]; }
+	// sums of buckets [beginOffset, endOffset) per field
+	void sum(unsigned beginOffset, unsigned endOffset, int64_t *sums) const
+	{
+		for (unsigned field = 0; field < FieldCnt; ++field) sums[field] = columnSum(_columns[field], beginOffset, endOffset);
+	}
+	static int64_t columnSum(const int64_t *column, unsigned beginOffset, unsigned endOffset);
+
+	~ColumnarBuckets() { free(); }
+private:
+	ColumnarBuckets(const ColumnarBuckets&) = delete;
+	ColumnarBuckets& operator = (const ColumnarBuckets&) = delete;
+};
+
+template <unsigned FieldCnt>
+int64_t ColumnarBuckets<FieldCnt>::columnSum(const int64_t *column, unsigned beginOffset, unsigned endOffset)
+{
+	int64_t sum(0);
+	// up to a 32 byte boundary, the columns start on one
+	for (; beginOffset < endOffset && (beginOffset & 3); ++beginOffset) sum += column[beginOffset];
+	alignas(32) int64_t lanes[4];
+#ifdef __AVX2__
+	__m256i sums0 = _mm256_setzero_si256(), sums1 = _mm256_setzero_si256();
+	for (; beginOffset + 8 <= endOffset; beginOffset += 8)
+	{
+		sums0 = _mm256_add_epi64(sums0, _mm256_load_si256(reinterpret_cast<const __m256i*>(column + beginOffset)));
+		sums1 = _mm256_add_epi64(sums1, _mm256_load_si256(reinterpret_cast<const __m256i*>(column + beginOffset + 4)));
+	}
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(sums0, sums1));
+	sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+	__m128i sums0 = _mm_setzero_si128(), sums1 = _mm_setzero_si128();
+	for (; beginOffset + 4 <= endOffset; beginOffset += 4)
+	{
+		sums0 = _mm_add_epi64(sums0, _mm_load_si128(reinterpret_cast<const __m128i*>(column + beginOffset)));
+		sums1 = _mm_add_epi64(sums1, _mm_load_si128(reinterpret_cast<const __m128i*>(column + beginOffset + 2)));
+	}
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(sums0, sums1));
+	sum += lanes[0] + lanes[1];
+#endif
+	for (; beginOffset < endOffset; ++beginOffset) sum += column[beginOffset];
+	return sum;
+}
+
+/*
+** ColumnarBucketHistory
+** - a typed history that also keeps its closed buckets in ColumnarBuckets for range queries
+** - the array of buckets stays the write side, it holds the open bucket and what the aggregators add and subtract
+** - BucketType lists its integer fields: enum FIELD_CNT, fields(int64_t *values) const and setFields(const int64_t *values)
+*/
+template <typename BucketType>
+struct ColumnarBucketTraits : public StaticBucketTraits<BucketType>
+{
+	ColumnarBuckets<BucketType::FIELD_CNT> _columns;
+
+	BucketType *allocate(size_t bucketCnt) { _columns.allocate(bucketCnt); return StaticBucketTraits<BucketType>::allocate(bucketCnt); }
+	void free(BucketType *dataBuckets) { _columns.free(); StaticBucketTraits<BucketType>::free(dataBuckets); }
+	void close(const BucketType &bucket, unsigned offset)
+	{
+		int64_t values[BucketType::FIELD_CNT];
+		bucket.BucketType::fields(values);
+		_columns.store(offset, values);
+	}
+};
+
+template <typename BucketType>
+class ColumnarBucketHistory : public BasicBucketHistory<BucketType, ColumnarBucketTraits<BucketType>>
+{
+public:
+	// sum of buckets [beginOffset, endOffset), the open bucket included
+	void rangeSum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const;
+	BucketType rangeSum(unsigned beginOffset, unsigned endOffset) const { BucketType sum; rangeSum(beginOffset, endOffset, sum); return sum; }
+	const ColumnarBuckets<BucketType::FIELD_CNT> &columns() const { return this->_traits._columns; }
+};
+
+template <typename BucketType>
+void ColumnarBucketHistory<BucketType>::rangeSum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const
+{
+	if (endOffset > this->_bucketCnt) endOffset = this->_bucketCnt;
+	unsigned closedOffset = this->_previousBucketInt < endOffset ? this->_previousBucketInt : endOffset;
+	int64_t sums[BucketType::FIELD_CNT] = {};
+	if (beginOffset < closedOffset) this->_traits._columns.sum(beginOffset, closedOffset, sums);
+	sum.BucketType::setFields(sums);
+	// buckets past the open one are still empty
+	unsigned openOffset = this->_previousBucketInt;
+	if (openOffset >= beginOffset && openOffset < endOffset) StaticBucketTraits<BucketType>::addBucket(sum, this->_dataBuckets[openOffset]);
+}
+
+/*
+** PrefixSumIndex
+** - cumulative buckets, sum i holds buckets [0, i), a range is one subtraction, O(1)
+** - for buckets with an exact inverse, every operator -= undoes the operator += before it
+**
+** SegmentTreeIndex
+** - for buckets that only combine (high / low, first / last), a range is O(log buckets) combines
+** - the combine (operator +=) must be associative, an empty bucket is its identity
+**
+** - both are appended to as buckets close and publish the closed count last, so other threads may query
+**   any range below closedCount() while the session runs, and every range once it is stopped
+*/
+template <typename BucketType, typename Traits = StaticBucketTraits<BucketType>>
+class PrefixSumIndex
+{
+protected:
+	BucketType *_sums;
+	std::atomic<unsigned> _closedCnt;
+public:
+	PrefixSumIndex() : _sums(0), _closedCnt(0) {}
+
+	void allocate(size_t bucketCnt) { free(); _sums = new BucketType[bucketCnt + 1]; }
+	void free() { delete[] _sums; _sums = 0; }
+	void clear() { if (_sums) Traits::reset(_sums[0]); _closedCnt.store(0, std::memory_order_release); }
+	void append(const BucketType &bucket, unsigned offset)
+	{
+		_sums[offset + 1] = _sums[offset];
+		Traits::addBucket(_sums[offset + 1], bucket);
+		_closedCnt.store(offset + 1, std::memory_order_release);
+	}
+
+	unsigned closedCount() const { return _closedCnt.load(std::memory_order_acquire); }
+	// buckets [beginOffset, endOffset), endOffset no more than closedCount()
+	void sum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const
+	{
+		sum = _sums[endOffset];
+		Traits::subBucket(sum, _sums[beginOffset]);
+	}
+
+	~PrefixSumIndex() { free(); }
+private:
+	PrefixSumIndex(const PrefixSumIndex&) = delete;
+	PrefixSumIndex& operator = (const PrefixSumIndex&) = delete;
+};
+
+template <typename BucketType, typename Traits = StaticBucketTraits<BucketType>>
+class SegmentTreeIndex
+{
+protected:
+	// node 1 is the root, leaves start at _leafCnt
+	BucketType *_nodes;
+	unsigned _leafCnt;
+	std::atomic<unsigned> _closedCnt;
+public:
+	SegmentTreeIndex() : _nodes(0), _leafCnt(0), _closedCnt(0) {}
+
+	void allocate(size_t bucketCnt)
+	{
+		free();
+		for (_leafCnt = 1; _leafCnt < bucketCnt; _leafCnt <<= 1);
+		_nodes = new BucketType[2 * _leafCnt];
+	}
+	void free() { delete[] _nodes; _nodes = 0; }
+	void clear()
+	{
+		for (unsigned node = 1; node < 2 * _leafCnt; ++node) Traits::reset(_nodes[node]);
+		_closedCnt.store(0, std::memory_order_release);
+	}
+	void append(const BucketType &bucket, unsigned offset)
+	{
+		// only the new leaf's ancestors change, none of them lies inside a range below it
+		unsigned node = offset + _leafCnt;
+		_nodes[node] = bucket;
+		for (node >>= 1; node; node >>= 1)
+		{
+			_nodes[node] = _nodes[2 * node];
+			Traits::addBucket(_nodes[node], _nodes[2 * node + 1]);
+		}
+		_closedCnt.store(offset + 1, std::memory_order_release);
+	}
+
+	unsigned closedCount() const { return _closedCnt.load(std::memory_order_acquire); }
+	void sum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const
+	{
+		Traits::reset(sum);
+		BucketType right;
+		for (unsigned begin = beginOffset + _leafCnt, end = endOffset + _leafCnt; begin < end; begin >>= 1, end >>= 1)
+		{
+			if (begin & 1) Traits::addBucket(sum, _nodes[begin++]);
+			if (end & 1)
+			{
+				// combined in time order
+				BucketType node(_nodes[--end]);
+				Traits::addBucket(node, right);
+				right = node;
+			}
+		}
+		Traits::addBucket(sum, right);
+	}
+
+	~SegmentTreeIndex() { free(); }
+private:
+	SegmentTreeIndex(const SegmentTreeIndex&) = delete;
+	SegmentTreeIndex& operator = (const SegmentTreeIndex&) = delete;
+};
+
+/*
+** IndexedBucketHistory
+** - a typed history that appends each closed bucket to a range index, no aggregator needed for ad hoc ranges
+*/
+template <typename BucketType, typename Index>
+struct IndexedBucketTraits : public StaticBucketTraits<BucketType>
+{
+	Index _index;
+
+	BucketType *allocate(size_t bucketCnt) { _index.allocate(bucketCnt); return StaticBucketTraits<BucketType>::allocate(bucketCnt); }
+	void free(BucketType *dataBuckets) { _index.free(); StaticBucketTraits<BucketType>::free(dataBuckets); }
+	void close(const BucketType &bucket, unsigned offset) { _index.append(bucket, offset); }
+	void clear() { _index.clear(); }
+};
+
+template <typename BucketType, typename Index = PrefixSumIndex<BucketType>>
+class IndexedBucketHistory : public BasicBucketHistory<BucketType, IndexedBucketTraits<BucketType, Index>>
+{
+public:
+	// sum of buckets [beginOffset, endOffset), the open bucket included, from the history's thread
+	void rangeSum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const;
+	BucketType rangeSum(unsigned beginOffset, unsigned endOffset) const { BucketType sum; rangeSum(beginOffset, endOffset, sum); return sum; }
+	// closed buckets only, safe from any thread
+	const Index &index() const { return this->_traits._index; }
+};
+
+template <typename BucketType, typename Index>
+void IndexedBucketHistory<BucketType, Index>::rangeSum(unsigned beginOffset, unsigned endOffset, BucketType &sum) const
+{
+	if (endOffset > this->_bucketCnt) endOffset = this->_bucketCnt;
+	unsigned closedOffset = this->_previousBucketInt < endOffset ? this->_previousBucketInt : endOffset;
+	if (beginOffset < closedOffset) index().sum(beginOffset, closedOffset, sum);
+	else StaticBucketTraits<BucketType>::reset(sum);
+	unsigned openOffset = this->_previousBucketInt;
+	if (openOffset >= beginOffset && openOffset < endOffset) StaticBucketTraits<BucketType>::addBucket(sum, this->_dataBuckets[openOffset]);
+}
+
+/*
+** RingBucketHistory
+** - a history without an end, for markets that never close
+** - bucketCnt buckets are recycled in place, the bucket opening takes the slot of the one bucketCnt behind it,
+**   so memory stays constant and nothing is allocated while running
+** - aggregators already work on lags behind the open bucket, their windows only need to fit in the ring
+** - bucket numbers run up to twice the capacity and are then rebased by the capacity, which maps to the same slots
+*/
+template <typename BucketType>
+struct RingBucketTraits : public StaticBucketTraits<BucketType>
+{
+	BucketType *_end;
+	unsigned _capacity;
+
+	RingBucketTraits() : _end(0), _capacity(0) {}
+	BucketType *allocate(size_t bucketCnt)
+	{
+		BucketType *dataBuckets = StaticBucketTraits<BucketType>::allocate(bucketCnt);
+		_capacity = static_cast<unsigned>(bucketCnt);
+		_end = dataBuckets + bucketCnt;
+		return dataBuckets;
+	}
+	// wraps and empties the slot for the bucket opening
+	BucketType *next(BucketType *dataBucket)
+	{
+		if (++dataBucket == _end) dataBucket -= _capacity;
+		StaticBucketTraits<BucketType>::reset(*dataBucket);
+		return dataBucket;
+	}
+	BucketType *at(BucketType *dataBuckets, unsigned offset) const { return dataBuckets + (offset < _capacity ? offset : offset - _capacity); }
+};
+
+template <typename BucketType>
+class RingBucketHistory : public BasicBucketHistory<BucketType, RingBucketTraits<BucketType>>
+{
+	typedef BasicBucketHistory<BucketType, RingBucketTraits<BucketType>> History;
+protected:
+	uint64_t _originTime;
+public:
+	typedef typename History::AggregatorType AggregatorType;
+
+	RingBucketHistory() : _originTime(0) {}
+
+	// bucketCnt less than 2^31
+	int initialize(unsigned bucketDuration, uint64_t beginTime, unsigned bucketCnt);
+	// returns -1 if the aggregator's window is bucketCount() buckets or longer
+	int addAggregator(AggregatorType *aggregator);
+
+	// lag 0 is the open bucket, bucketCount() - 1 the oldest still held
+	BucketType& bucketForLag(unsigned lag);
+
+	int addData(uint64_t currentTime, const void *data);
+	int addTime(uint64_t currentTime);
+	void stop(uint64_t currentTime);
+	// shards far enough apart land on the same slots
+	template <typename TimeOf, typename DataOf>
+	void backfill(size_t dataCnt, TimeOf timeOf, DataOf dataOf, unsigned threadCnt = 0) = delete;
+
+	void reset();
+};
+
+template <typename BucketType>
+int RingBucketHistory<BucketType>::initialize(unsigned bucketDuration, uint64_t beginTime, unsigned bucketCnt)
+{
+	if (!bucketCnt || bucketCnt >= 1U << 31 || History::initialize(bucketDuration, beginTime, beginTime + uint64_t(bucketCnt) * bucketDuration)) return -1;
+	this->_lastTime = ~uint64_t(0) - 1;
+	_originTime = beginTime;
+	return 0;
+}
+
+template <typename BucketType>
+int RingBucketHistory<BucketType>::addAggregator(AggregatorType *aggregator)
+{
+	if (aggregator->endOffset() / this->_bucketDuration >= this->_bucketCnt) return -1;
+	History::addAggregator(aggregator);
+	return 0;
+}
+
+template <typename BucketType>
+BucketType& RingBucketHistory<BucketType>::bucketForLag(unsigned lag)
+{
+	if (lag > this->_bucketCnt - 1) lag = this->_bucketCnt - 1;
+	return this->_dataBuckets[(this->_previousBucketInt + this->_bucketCnt - lag) % this->_bucketCnt];
+}
+
+template <typename BucketType>
+int RingBucketHistory<BucketType>::addTime(uint64_t currentTime)
+{
+	if (currentTime > this->_previousTime)
+	{
+		uint64_t currentBucketInt = (currentTime - this->_beginTime) / this->_bucketDuration;
+
+		// close out prior buckets
+		while (currentBucketInt > this->_previousBucketInt)
+		{
+			this->_addDuration(this->_beginTime + uint64_t(this->_previousBucketInt + 1) * this->_bucketDuration);
+			this->_closeBucket();
+			this->_previousBucket = this->_traits.next(this->_previousBucket);
+			if (++this->_previousBucketInt == 2 * this->_bucketCnt)
+			{
+				this->_previousBucketInt -= this->_bucketCnt;
+				this->_beginTime += uint64_t(this->_bucketCnt) * this->_bucketDuration;
+				currentBucketInt -= this->_bucketCnt;
+			}
+		}
+
+		// update current bucket
+		this->_addDuration(currentTime);
+	}
+	return 0;
+}
+
+template <typename BucketType>
+int RingBucketHistory<BucketType>::addData(uint64_t currentTime, const void *data)
+{
+	if (currentTime < this->_previousTime)
+	{
+		if (currentTime >= _originTime) return -1;
+		this->_previousData = data;
+		return 0;
+	}
+	if (currentTime > this->_previousTime) addTime(currentTime);
+	this->_addData(data);
+	this->_previousData = data;
+	return 0;
+}
+
+template <typename BucketType>
+void RingBucketHistory<BucketType>::stop(uint64_t currentTime)
+{
+	if (this->_previousData && currentTime > this->_previousTime) addTime(currentTime);
+	this->_previousData = 0;
+}
+
+template <typename BucketType>
+void RingBucketHistory<BucketType>::reset()
+{
+	this->_beginTime = _originTime;
+	History::reset();
+}
+
+/*
+** BucketHistoryArena
+** - the bucket arrays of many histories of one bucket type and schedule, typically one per symbol, in a single
+**   allocation backed by huge pages where the system gives them
+** - interleaved, bucket i of every history is adjacent, so the open buckets a market wide tick stream writes to
+**   share a few pages instead of one page per symbol, otherwise each history's buckets are contiguous
+** - buckets are constructed and reset by threadCnt threads over contiguous slices of the arena, the session roll is one
+**   parallel reset rather than a pass per history
+*/
+struct HugePages
+{
+	// returns 0 on failure, size is rounded up to whole huge pages
+	static void *allocate(size_t &size);
+	static void free(void *memory, size_t size);
+};
+
+template <typename BucketType>
+struct ArenaBucketTraits : public StaticBucketTraits<BucketType>
+{
+	BucketType *_dataBuckets;
+	size_t _stride;
+
+	ArenaBucketTraits() : _dataBuckets(0), _stride(1) {}
+	// the arena owns the buckets
+	BucketType *allocate(size_t bucketCnt) { return _dataBuckets; }
+	void free(BucketType *dataBuckets) {}
+	BucketType *next(BucketType *dataBucket) const { return dataBucket + _stride; }
+	BucketType *at(BucketType *dataBuckets, unsigned offset) const { return dataBuckets + offset * _stride; }
+};
+
+template <typename BucketType>
+class BucketHistoryArena;
+
+template <typename BucketType>
+class ArenaBucketHistory : public BasicBucketHistory<BucketType, ArenaBucketTraits<BucketType>>
+{
+	friend class BucketHistoryArena<BucketType>;
+	void _attach(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, BucketType *dataBuckets, size_t stride)
+	{
+		this->_bucketDuration = bucketDuration;
+		this->_bucketCnt = static_cast<unsigned>((endTime - beginTime - 1) / bucketDuration + 1);
+		this->_beginTime = beginTime;
+		this->_lastTime = endTime - 1;
+		this->_traits._stride = stride;
+		this->_dataBuckets = this->_traits._dataBuckets = dataBuckets;
+		this->_resetState();
+	}
+public:
+	// the arena lays out the buckets, a history of its own would write past its slice
+	int initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime) = delete;
+};
+
+template <typename BucketType>
+class BucketHistoryArena
+{
+protected:
+	void *_memory;
+	size_t _size;
+	BucketType *_dataBuckets;
+	size_t _dataBucketCnt;
+	ArenaBucketHistory<BucketType> *_histories;
+	size_t _historyCnt;
+
+	template <typename F>
+	void _parallel(unsigned threadCnt, F f);
+	void _free();
+public:
+	BucketHistoryArena() : _memory(0), _size(0), _dataBuckets(0), _dataBucketCnt(0), _histories(0), _historyCnt(0) {}
+
+	// threadCnt 0 for every core, returns -1 if the schedule is empty or the arena can not be allocated
+	int initialize(size_t historyCnt, unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, bool interleave = true, unsigned threadCnt = 0);
+	size_t historyCount() const { return _historyCnt; }
+	ArenaBucketHistory<BucketType> &history(size_t historyInt) { return _histories[historyInt]; }
+	// every bucket and history, aggregators stay registered
+	void reset(unsigned threadCnt = 0);
+
+	~BucketHistoryArena() { _free(); }
+private:
+	BucketHistoryArena(const BucketHistoryArena&) = delete;
+	BucketHistoryArena& operator = (const BucketHistoryArena&) = delete;
+};
+
+template <typename BucketType>
+template <typename F>
+void BucketHistoryArena<BucketType>::_parallel(unsigned threadCnt, F f)
+{
+	if (!threadCnt) threadCnt = std::thread::hardware_concurrency();
+	if (!threadCnt) threadCnt = 1;
+	std::vector<std::thread> threads;
+	size_t sliceCnt = (_dataBucketCnt + threadCnt - 1) / threadCnt;
+	for (size_t begin = 0; begin < _dataBucketCnt; begin += sliceCnt)
+	{
+		size_t end = begin + sliceCnt < _dataBucketCnt ? begin + sliceCnt : _dataBucketCnt;
+		threads.push_back(std::thread([this, f, begin, end]() { for (size_t i = begin; i < end; ++i) f(_dataBuckets[i]); }));
+	}
+	for (std::thread &thread : threads) thread.join();
+}
+
+template <typename BucketType>
+void BucketHistoryArena<BucketType>::_free()
+{
+	delete[] _histories;
+	_histories = 0;
+	_historyCnt = 0;
+	if (!_memory) return;
+	for (size_t i = 0; i < _dataBucketCnt; ++i) _dataBuckets[i].~BucketType();
+	HugePages::free(_memory, _size);
+	_memory = 0;
+	_dataBuckets = 0;
+	_dataBucketCnt = 0;
+}
+
+template <typename BucketType>
+int BucketHistoryArena<BucketType>::initialize(size_t historyCnt, unsigned bucketDuration, uint64_t beginTime, uint64_t endTime, bool interleave, unsigned threadCnt)
+{
+	if (!historyCnt || !bucketDuration || endTime < beginTime + bucketDuration) return -1;
+	_free();
+	size_t bucketCnt = (endTime - beginTime - 1) / bucketDuration + 1;
+	_dataBucketCnt = historyCnt * bucketCnt;
+	_size = _dataBucketCnt * sizeof(BucketType);
+	if (!(_memory = HugePages::allocate(_size)))
+	{
+		_dataBucketCnt = 0;
+		return -1;
+	}
+	_dataBuckets = static_cast<BucketType*>(_memory);
+	// first touch spread over the threads as well
+	_parallel(threadCnt, [](BucketType &dataBucket) { new (&dataBucket) BucketType; });
+
+	_histories = new ArenaBucketHistory<BucketType>[historyCnt];
+	_historyCnt = historyCnt;
+	for (size_t historyInt = 0; historyInt < historyCnt; ++historyInt)
+	{
+		if (interleave) _histories[historyInt]._attach(bucketDuration, beginTime, endTime, _dataBuckets + historyInt, historyCnt);
+		else _histories[historyInt]._attach(bucketDuration, beginTime, endTime, _dataBuckets + historyInt * bucketCnt, 1);
+	}
+	return 0;
+}
+
+template <typename BucketType>
+void BucketHistoryArena<BucketType>::reset(unsigned threadCnt)
+{
+	_parallel(threadCnt, [](BucketType &dataBucket) { StaticBucketTraits<BucketType>::reset(dataBucket); });
+	for (size_t historyInt = 0; historyInt < _historyCnt; ++historyInt) _histories[historyInt]._resetState();
+}
+
+/*
+** BucketFile
+** - a bucket history in a file: a BucketFileHeader, then the bucket records at a fixed stride from byte 64
+** - a writer maps it shared read write and keeps the header's progress current, a restarted writer reattaches
+**   in O(1) and carries on from lastUpdateTime(), any number of readers map it shared read only
+** - buckets are raw records, BucketType must be trivially copyable and the same build on both sides,
+**   bucketType is the caller's id for it and is checked along with the record size
+** - the header's progress is stored after the buckets it covers, a reader trusts buckets below previousBucketInt
+*/
+struct BucketFileHeader
+{
+	enum : uint32_t { MAGIC = 0x4B435542, VERSION = 1 };
+	uint32_t _magic;
+	uint32_t _version;
+	uint32_t _bucketType;
+	uint32_t _bucketSize;
+	uint32_t _bucketCnt;
+	uint32_t _bucketDuration;
+	uint64_t _beginTime;
+	uint64_t _endTime;
+	// progress, the open bucket and the last update time
+	uint64_t _previousTime;
+	uint32_t _previousBucketInt;
+	uint32_t _reserved[3];
+};
+
+static_assert(sizeof(BucketFileHeader) == 64, "BucketFileHeader must be 64 bytes");
+
+class BucketFile
+{
+protected:
+	BucketFileHeader *_header;
+	size_t _size;
+	bool _created;
+#ifdef _MSC_VER
+	void *_file;
+	void *_mapping;
+#else
+	int _fd;
+#endif
+	int _map(bool readOnly);
+public:
+	BucketFile();
+	// creates the file or reattaches to one written with the same schedule, returns -1 if it does not match
+	int create(const char *fileName, const BucketFileHeader &header);
+	// maps an existing file read only
+	int open(const char *fileName);
+	void close();
+	// flushes the mapping to disk
+	void sync();
+
+	BucketFileHeader *header() const { return _header; }
+	// create() made a new file, its buckets are zero bytes
+	bool created() const { return _created; }
+	void *dataBuckets() const { return _header + 1; }
+
+	~BucketFile() { close(); }
+private:
+	BucketFile(const BucketFile&) = delete;
+	BucketFile& operator = (const BucketFile&) = delete;
+};
+
+template <typename BucketType>
+struct MappedBucketTraits : public StaticBucketTraits<BucketType>
+{
+	BucketFile _file;
+
+	// the file owns the buckets
+	BucketType *allocate(size_t bucketCnt) { return static_cast<BucketType*>(_file.dataBuckets()); }
+	void free(BucketType *dataBuckets) {}
+};
+
+/*
+** MappedBucketHistory
+** - a typed history whose buckets live in a BucketFile
+** - aggregators are not persisted, their partial sums are summed again from the buckets when it attaches
+** - the previous data is the caller's, after a restart time accumulates again from resume() or the next addData
+** - the buckets are the file's, nothing is recorded before open() or after close()
+*/
+template <typename BucketType>
+class MappedBucketHistory : public BasicBucketHistory<BucketType, MappedBucketTraits<BucketType>>
+{
+	typedef BasicBucketHistory<BucketType, MappedBucketTraits<BucketType>> History;
+	static_assert(std::is_trivially_copyable<BucketType>::value, "mapped buckets must be trivially copyable");
+
+	void _save()
+	{
+		BucketFileHeader *header = this->_traits._file.header();
+		if (!header) return;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->_previousTime = this->_previousTime;
+		header->_previousBucketInt = this->_previousBucketInt;
+	}
+public:
+	typedef typename History::AggregatorType AggregatorType;
+
+	// creates fileName or reattaches to it, returns -1 if it holds another schedule or bucket type
+	int open(const char *fileName, uint32_t bucketType, unsigned bucketDuration, uint64_t beginTime, uint64_t endTime);
+	// the buckets come from the file, open() takes the schedule instead
+	int initialize(unsigned bucketDuration, uint64_t beginTime, uint64_t endTime) = delete;
+	void close();
+	void sync() { this->_traits._file.sync(); }
+	// the caller's last data before the restart, so the time since it accumulates again
+	void resume(const void *previousData) { this->_previousData = previousData; }
+
+	int addData(uint64_t currentTime, const void *data) { int result = History::addData(currentTime, data); _save(); return result; }
+	int addTime(uint64_t currentTime) { int result = History::addTime(currentTime); _save(); return result; }
+	void stop(uint64_t currentTime) { History::stop(currentTime); _save(); }
+	template <typename TimeOf, typename DataOf>
+	void backfill(size_t dataCnt, TimeOf timeOf, DataOf dataOf, unsigned threadCnt = 0) { History::backfill(dataCnt, timeOf, dataOf, threadCnt); _save(); }
+	void reset() { History::reset(); _save(); }
+
+	// the aggregators may be gone already, only the file is closed
+	~MappedBucketHistory() { this->_traits._file.close(); }
+};
+
+template <typename BucketType>
+int MappedBucketHistory<BucketType>::open(const char *fileName, uint32_t bucketType, unsigned bucketDuration, uint64_t beginTime, uint64_t endTime)
+{
+	close();
+	if (! bucketDuration || endTime < beginTime + bucketDuration) return -1;
+	unsigned bucketCnt = static_cast<unsigned>((endTime - beginTime - 1) / bucketDuration + 1);
+	BucketFileHeader header = { BucketFileHeader::MAGIC, BucketFileHeader::VERSION, bucketType, sizeof(BucketType), bucketCnt, bucketDuration, beginTime, endTime, beginTime, 0, {} };
+	BucketFile &file = this->_traits._file;
+	if (file.create(fileName, header)) return -1;
+
+	this->_bucketDuration = bucketDuration;
+	this->_bucketCnt = bucketCnt;
+	this->_beginTime = beginTime;
+	this->_lastTime = endTime - 1;
+	this->_dataBuckets = this->_traits.allocate(bucketCnt);
+	this->_resetState();
+	// a new file is all zero bytes, the buckets get their reset state before the first update
+	if (file.created()) History::reset();
+	this->_previousTime = file.header()->_previousTime;
+	this->_previousBucketInt = file.header()->_previousBucketInt;
+	this->_previousBucket = this->_previousBucketInt < bucketCnt ? this->_bucketForOffset(this->_previousBucketInt) : 0;
+	this->_buildSums();
+	return 0;
+}
+
+template <typename BucketType>
+void MappedBucketHistory<BucketType>::close()
+{
+	this->_traits._file.close();
+	this->_dataBuckets = 0;
+	this->_bucketCnt = 0;
+	this->_bucketDuration = 0;
+	this->_beginTime = this->_lastTime = 0;
+	// no partial sums and no progress, so updates stop at the end of a session that has no buckets
+	this->_resetState();
+}
+
+/*
+** BucketFileView
+** - zero copy read only access to a BucketFile another process may be writing
+*/
+template <typename BucketType>
+class BucketFileView
+{
+protected:
+	BucketFile _file;
+public:
+	// returns -1 if the file is not a BucketFile of this bucket type
+	int open(const char *fileName, uint32_t bucketType)
+	{
+		if (_file.open(fileName)) return -1;
+		if (_file.header()->_bucketType != bucketType || _file.header()->_bucketSize != sizeof(BucketType)) { _file.close(); return -1; }
+		return 0;
+	}
+	void close() { _file.close(); }
+
+	unsigned bucketCount() const { return _file.header()->_bucketCnt; }
+	unsigned bucketDuration() const { return _file.header()->_bucketDuration; }
+	uint64_t beginTime() const { return _file.header()->_beginTime; }
+	uint64_t endTime() const { return _file.header()->_endTime; }
+	uint64_t lastUpdateTime() const { return _file.header()->_previousTime; }
+	// buckets below this are closed and final
+	unsigned closedCount() const
+	{
+		unsigned closedCnt = *const_cast<volatile uint32_t*>(&_file.header()->_previousBucketInt);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return closedCnt;
+	}
+	const BucketType &bucketForOffset(unsigned offset) const { return static_cast<const BucketType*>(_file.dataBuckets())[offset]; }
+};
+
 /*
 ** TimedDataHistory
 ** - a queue of timed data
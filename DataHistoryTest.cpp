@@ -0,0 +1,630 @@
+#include "DataHistory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#define TICK_CNT 4000000
+#define TRIAL_CNT 6
+#define BUCKET_DURATION 100000
+#define SESSION_DURATION 23400000000ULL
+#define MEAN_TICK_INTERVAL 5000
+#define RANGE_QUERY_CNT 2000
+#define ARENA_HISTORY_CNT 64
+#define ARENA_BUCKET_DURATION (BUCKET_DURATION * 10)
+// longest aggregator window and the open bucket
+#define RING_BUCKET_CNT (7200000000ULL / BUCKET_DURATION + 1)
+#define BACKFILL_MAX_THREAD_CNT 8
+// historical windows on a one minute grid, 16 begins by 16 lengths
+#define WINDOW_GRID 60000000ULL
+#define WINDOW_BEGIN_CNT 16
+#define WINDOW_CNT 256
+
+struct PriceData
+{
+	int64_t price;
+	int64_t volume;
+};
+
+// time weighted price and volume, the typed history calls these directly and inlines them
+struct PriceBucket : public DataBucket
+{
+	enum { FIELD_CNT = 5 };
+	int64_t _priceTime;
+	int64_t _volume;
+	int64_t _sumPrice;
+
+	PriceBucket() : _priceTime(0), _volume(0), _sumPrice(0) {}
+
+	void addData(const void *data) { DataBucket::addData(data); _volume += static_cast<const PriceData*>(data)->volume; _sumPrice += static_cast<const PriceData*>(data)->price; }
+	void subData(const void *data) { DataBucket::subData(data); _volume -= static_cast<const PriceData*>(data)->volume; _sumPrice -= static_cast<const PriceData*>(data)->price; }
+	void addTime(int64_t duration, const void *data) { DataBucket::addTime(duration, data); _priceTime += duration * static_cast<const PriceData*>(data)->price; }
+	void subTime(int64_t duration, const void *data) { DataBucket::subTime(duration, data); _priceTime -= duration * static_cast<const PriceData*>(data)->price; }
+	DataBucket& operator += (const DataBucket &dataBucket)
+	{
+		const PriceBucket &bucket = static_cast<const PriceBucket&>(dataBucket);
+		DataBucket::operator += (dataBucket);
+		_priceTime += bucket._priceTime;
+		_volume += bucket._volume;
+		_sumPrice += bucket._sumPrice;
+		return *this;
+	}
+	DataBucket& operator -= (const DataBucket &dataBucket)
+	{
+		const PriceBucket &bucket = static_cast<const PriceBucket&>(dataBucket);
+		DataBucket::operator -= (dataBucket);
+		_priceTime -= bucket._priceTime;
+		_volume -= bucket._volume;
+		_sumPrice -= bucket._sumPrice;
+		return *this;
+	}
+	void reset() { DataBucket::reset(); _priceTime = _volume = _sumPrice = 0; }
+
+	void fields(int64_t *values) const
+	{
+		values[0] = _duration;
+		values[1] = _count;
+		values[2] = _priceTime;
+		values[3] = _volume;
+		values[4] = _sumPrice;
+	}
+	void setFields(const int64_t *values)
+	{
+		_duration = values[0];
+		_count = values[1];
+		_priceTime = values[2];
+		_volume = values[3];
+		_sumPrice = values[4];
+	}
+
+	bool operator == (const PriceBucket &bucket) const
+	{
+		return _duration == bucket._duration && _count == bucket._count && _priceTime == bucket._priceTime && _volume == bucket._volume && _sumPrice == bucket._sumPrice;
+	}
+};
+
+// the same without a vtable, so it can live in a file
+struct FlatPriceBucket
+{
+	int64_t _duration;
+	int64_t _count;
+	int64_t _priceTime;
+	int64_t _volume;
+	int64_t _sumPrice;
+
+	FlatPriceBucket() { reset(); }
+
+	void addData(const void *data) { ++_count; _volume += static_cast<const PriceData*>(data)->volume; _sumPrice += static_cast<const PriceData*>(data)->price; }
+	void subData(const void *data) { --_count; _volume -= static_cast<const PriceData*>(data)->volume; _sumPrice -= static_cast<const PriceData*>(data)->price; }
+	void addTime(int64_t duration, const void *data) { _duration += duration; _priceTime += duration * static_cast<const PriceData*>(data)->price; }
+	void subTime(int64_t duration, const void *data) { _duration -= duration; _priceTime -= duration * static_cast<const PriceData*>(data)->price; }
+	FlatPriceBucket& operator += (const FlatPriceBucket &bucket)
+	{
+		_duration += bucket._duration;
+		_count += bucket._count;
+		_priceTime += bucket._priceTime;
+		_volume += bucket._volume;
+		_sumPrice += bucket._sumPrice;
+		return *this;
+	}
+	FlatPriceBucket& operator -= (const FlatPriceBucket &bucket)
+	{
+		_duration -= bucket._duration;
+		_count -= bucket._count;
+		_priceTime -= bucket._priceTime;
+		_volume -= bucket._volume;
+		_sumPrice -= bucket._sumPrice;
+		return *this;
+	}
+	void reset() { _duration = _count = _priceTime = _volume = _sumPrice = 0; }
+
+	bool operator == (const FlatPriceBucket &bucket) const
+	{
+		return _duration == bucket._duration && _count == bucket._count && _priceTime == bucket._priceTime && _volume == bucket._volume && _sumPrice == bucket._sumPrice;
+	}
+};
+
+// the time weighted price in floating point, sums taken in another order round differently
+struct RealPriceBucket
+{
+	int64_t _duration;
+	int64_t _count;
+	double _priceTime;
+	double _sumPrice;
+
+	RealPriceBucket() { reset(); }
+
+	static double price(const void *data) { return static_cast<const PriceData*>(data)->price * 0.0001; }
+	void addData(const void *data) { ++_count; _sumPrice += price(data); }
+	void subData(const void *data) { --_count; _sumPrice -= price(data); }
+	void addTime(int64_t duration, const void *data) { _duration += duration; _priceTime += duration * price(data); }
+	void subTime(int64_t duration, const void *data) { _duration -= duration; _priceTime -= duration * price(data); }
+	RealPriceBucket& operator += (const RealPriceBucket &bucket)
+	{
+		_duration += bucket._duration;
+		_count += bucket._count;
+		_priceTime += bucket._priceTime;
+		_sumPrice += bucket._sumPrice;
+		return *this;
+	}
+	RealPriceBucket& operator -= (const RealPriceBucket &bucket)
+	{
+		_duration -= bucket._duration;
+		_count -= bucket._count;
+		_priceTime -= bucket._priceTime;
+		_sumPrice -= bucket._sumPrice;
+		return *this;
+	}
+	void reset() { _duration = _count = 0; _priceTime = _sumPrice = 0.0; }
+
+	bool operator == (const RealPriceBucket &bucket) const
+	{
+		return _duration == bucket._duration && _count == bucket._count && _priceTime == bucket._priceTime && _sumPrice == bucket._sumPrice;
+	}
+};
+
+// trailing windows ending now and historical windows ending in the past, in time units
+static const uint64_t realTimeWindows[] = { 60000000, 300000000, 900000000, 3600000000ULL };
+static const uint64_t historicalWindows[][2] = { { 300000000, 600000000 }, { 600000000, 1800000000 }, { 1800000000, 7200000000ULL } };
+#define REAL_TIME_CNT (sizeof(realTimeWindows) / sizeof(realTimeWindows[0]))
+#define HISTORICAL_CNT (sizeof(historicalWindows) / sizeof(historicalWindows[0]))
+#define AGGREGATOR_CNT (REAL_TIME_CNT + HISTORICAL_CNT)
+
+struct Tick
+{
+	uint64_t time;
+	PriceData data;
+};
+
+template <typename History, typename AggregatorType, typename BucketType = PriceBucket>
+struct HistoryRun
+{
+	History history;
+	AggregatorType aggregators[AGGREGATOR_CNT];
+	BucketType buckets[AGGREGATOR_CNT];
+
+	void addAggregators()
+	{
+		for (size_t i = 0; i < REAL_TIME_CNT; ++i)
+		{
+			aggregators[i].initialize(0, realTimeWindows[i], buckets + i);
+			history.addAggregator(aggregators + i);
+		}
+		for (size_t i = 0; i < HISTORICAL_CNT; ++i)
+		{
+			aggregators[REAL_TIME_CNT + i].initialize(historicalWindows[i][0], historicalWindows[i][1], buckets + REAL_TIME_CNT + i);
+			history.addAggregator(aggregators + REAL_TIME_CNT + i);
+		}
+	}
+
+	// each aggregator sums its window into its bucket
+	void read()
+	{
+		for (size_t i = 0; i < AGGREGATOR_CNT; ++i) aggregators[i].dataBucket();
+	}
+
+	double run(const std::vector<Tick> &ticks)
+	{
+		history.reset();
+		auto start = std::chrono::steady_clock::now();
+		for (const Tick &tick : ticks) history.addData(tick.time, &tick.data);
+		history.stop(SESSION_DURATION);
+		read();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+// one history per symbol, the tick stream dealt round robin over the symbols
+static void checkArena(const std::vector<Tick> &ticks)
+{
+	auto start = std::chrono::steady_clock::now();
+	TypedBucketHistory<PriceBucket> *histories = new TypedBucketHistory<PriceBucket>[ARENA_HISTORY_CNT];
+	for (size_t i = 0; i < ARENA_HISTORY_CNT; ++i) histories[i].initialize(ARENA_BUCKET_DURATION, 0, SESSION_DURATION);
+	double separateInitialize = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	BucketHistoryArena<PriceBucket> arena;
+	if (arena.initialize(ARENA_HISTORY_CNT, ARENA_BUCKET_DURATION, 0, SESSION_DURATION))
+	{
+		printf("ERROR: arena initialize failed\n");
+		return;
+	}
+	double arenaInitialize = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "Arena,Histories," << ARENA_HISTORY_CNT << ",Buckets," << histories[0].bucketCount() << std::endl;
+	std::cout << "Trial,Separate s,Arena s,Separate reset s,Arena reset s" << std::endl;
+	for (int trial = 0; trial < TRIAL_CNT; ++trial)
+	{
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < ticks.size(); ++i) histories[i % ARENA_HISTORY_CNT].addData(ticks[i].time, &ticks[i].data);
+		for (size_t i = 0; i < ARENA_HISTORY_CNT; ++i) histories[i].stop(SESSION_DURATION);
+		double separateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < ticks.size(); ++i) arena.history(i % ARENA_HISTORY_CNT).addData(ticks[i].time, &ticks[i].data);
+		for (size_t i = 0; i < ARENA_HISTORY_CNT; ++i) arena.history(i).stop(SESSION_DURATION);
+		double arenaTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (size_t i = 0; i < ARENA_HISTORY_CNT; ++i)
+		{
+			for (unsigned offset = 0; offset < histories[i].bucketCount(); ++offset)
+			{
+				if (!(histories[i].bucketForOffset(offset) == arena.history(i).bucketForOffset(offset)))
+				{
+					printf("ERROR: arena history %u bucket %u differs\n", static_cast<unsigned>(i), offset);
+					break;
+				}
+			}
+		}
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < ARENA_HISTORY_CNT; ++i) histories[i].reset();
+		double separateReset = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		arena.reset();
+		double arenaReset = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << trial << ',' << separateTime << ',' << arenaTime << ',' << separateReset << ',' << arenaReset << std::endl;
+	}
+	std::cout << "Initialize,Separate s," << separateInitialize << ",Arena s," << arenaInitialize << std::endl;
+	delete[] histories;
+}
+
+// half the session into a bucket file, a restart and the rest, against a history in memory
+static void checkMapped(const std::vector<Tick> &ticks, const char *fileName)
+{
+	remove(fileName);
+	HistoryRun<TypedBucketHistory<FlatPriceBucket>, TypedAggregator<FlatPriceBucket>, FlatPriceBucket> reference;
+	reference.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	reference.addAggregators();
+	size_t restartInt = ticks.size() / 2;
+	for (size_t i = 0; i < restartInt; ++i) reference.history.addData(ticks[i].time, &ticks[i].data);
+
+	{
+		MappedBucketHistory<FlatPriceBucket> history;
+		if (history.open(fileName, 1, BUCKET_DURATION, 0, SESSION_DURATION))
+		{
+			printf("ERROR: can not create %s\n", fileName);
+			return;
+		}
+		for (size_t i = 0; i < restartInt; ++i) history.addData(ticks[i].time, &ticks[i].data);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	HistoryRun<MappedBucketHistory<FlatPriceBucket>, TypedAggregator<FlatPriceBucket>, FlatPriceBucket> restarted;
+	if (restarted.history.open(fileName, 1, BUCKET_DURATION, 0, SESSION_DURATION))
+	{
+		printf("ERROR: can not reattach %s\n", fileName);
+		return;
+	}
+	double reattachTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (restarted.history.lastUpdateTime() != reference.history.lastUpdateTime()) printf("ERROR: reattached at %llu\n", static_cast<unsigned long long>(restarted.history.lastUpdateTime()));
+	MappedBucketHistory<FlatPriceBucket> mismatched;
+	if (!mismatched.open(fileName, 2, BUCKET_DURATION, 0, SESSION_DURATION)) printf("ERROR: reattached with another bucket type\n");
+	// without a file updates record nothing
+	mismatched.addData(ticks[0].time, &ticks[0].data);
+	mismatched.stop(SESSION_DURATION);
+	if (mismatched.lastUpdateTime()) printf("ERROR: recorded without a file\n");
+	restarted.addAggregators();
+	restarted.history.resume(&ticks[restartInt - 1].data);
+
+	BucketFileView<FlatPriceBucket> view;
+	if (view.open(fileName, 1))
+	{
+		printf("ERROR: can not view %s\n", fileName);
+		return;
+	}
+	for (size_t i = restartInt; i < ticks.size(); ++i)
+	{
+		reference.history.addData(ticks[i].time, &ticks[i].data);
+		restarted.history.addData(ticks[i].time, &ticks[i].data);
+	}
+	reference.history.stop(SESSION_DURATION);
+	restarted.history.stop(SESSION_DURATION);
+	reference.read();
+	restarted.read();
+
+	for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+	{
+		if (!(restarted.buckets[i] == reference.buckets[i])) printf("ERROR: restarted aggregator %u differs\n", static_cast<unsigned>(i));
+	}
+	if (view.closedCount() != reference.history.bucketCount()) printf("ERROR: view has %u closed buckets\n", view.closedCount());
+	for (unsigned offset = 0; offset < view.bucketCount(); ++offset)
+	{
+		if (!(view.bucketForOffset(offset) == reference.history.bucketForOffset(offset)))
+		{
+			printf("ERROR: mapped bucket %u differs\n", offset);
+			break;
+		}
+	}
+	std::cout << "Mapped,Buckets," << view.bucketCount() << ",Reattach s," << reattachTime << std::endl;
+	restarted.history.close();
+	// after close updates inside the old session record nothing either
+	restarted.history.addData(ticks[restartInt].time, &ticks[restartInt].data);
+	restarted.history.addData(ticks[restartInt + 1].time, &ticks[restartInt + 1].data);
+	restarted.history.stop(SESSION_DURATION);
+	if (restarted.history.lastUpdateTime()) printf("ERROR: recorded after close\n");
+
+	// aggregators registered before open are summed as it attaches
+	HistoryRun<MappedBucketHistory<FlatPriceBucket>, TypedAggregator<FlatPriceBucket>, FlatPriceBucket> registered;
+	registered.addAggregators();
+	if (registered.history.open(fileName, 1, BUCKET_DURATION, 0, SESSION_DURATION)) printf("ERROR: can not reattach %s with aggregators\n", fileName);
+	registered.read();
+	for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+	{
+		if (!(registered.buckets[i] == reference.buckets[i])) printf("ERROR: aggregator %u registered before open differs\n", static_cast<unsigned>(i));
+	}
+	registered.history.close();
+	view.close();
+	remove(fileName);
+}
+
+// the per aggregator walk the schedule replaced, every close divides each aggregator's offsets and finds its buckets
+static void walkAggregators(TypedBucketHistory<PriceBucket> &history, std::vector<TypedAggregator<PriceBucket>> &aggregators, unsigned closedInt)
+{
+	for (TypedAggregator<PriceBucket> &aggregator : aggregators)
+	{
+		unsigned beginLag = static_cast<unsigned>(aggregator.beginOffset() / history.bucketDuration()), endLag = static_cast<unsigned>(aggregator.endOffset() / history.bucketDuration());
+		if (closedInt >= beginLag) aggregator.addBucket(history.bucketForOffset(closedInt - beginLag));
+		if (closedInt >= endLag) aggregator.subBucket(history.bucketForOffset(closedInt - endLag));
+	}
+}
+
+// hundreds of windows sharing a few boundaries, through the schedule and through the per aggregator walk
+static void checkManyWindows(const std::vector<Tick> &ticks)
+{
+	TypedBucketHistory<PriceBucket> scheduled, walked;
+	std::vector<TypedAggregator<PriceBucket>> scheduledAggregators(WINDOW_CNT), walkedAggregators(WINDOW_CNT);
+	std::vector<PriceBucket> scheduledBuckets(WINDOW_CNT), walkedBuckets(WINDOW_CNT);
+	scheduled.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	walked.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	std::vector<uint64_t> lags;
+	for (size_t i = 0; i < WINDOW_CNT; ++i)
+	{
+		uint64_t beginOffset = (1 + i % WINDOW_BEGIN_CNT) * WINDOW_GRID, endOffset = beginOffset + (1 + i / WINDOW_BEGIN_CNT) * WINDOW_GRID;
+		scheduledAggregators[i].initialize(beginOffset, endOffset, &scheduledBuckets[i]);
+		walkedAggregators[i].initialize(beginOffset, endOffset, &walkedBuckets[i]);
+		scheduled.addAggregator(&scheduledAggregators[i]);
+		lags.push_back(beginOffset);
+		lags.push_back(endOffset);
+	}
+	std::sort(lags.begin(), lags.end());
+	size_t lagCnt = std::unique(lags.begin(), lags.end()) - lags.begin();
+
+	auto start = std::chrono::steady_clock::now();
+	for (const Tick &tick : ticks) scheduled.addData(tick.time, &tick.data);
+	scheduled.stop(SESSION_DURATION);
+	for (const TypedAggregator<PriceBucket> &aggregator : scheduledAggregators) aggregator.dataBucket();
+	double scheduleTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// closes each bucket with addTime at its end, then walks
+	start = std::chrono::steady_clock::now();
+	unsigned openInt(0), bucketCnt = walked.bucketCount();
+	for (const Tick &tick : ticks)
+	{
+		for (unsigned bucketInt = static_cast<unsigned>(tick.time / BUCKET_DURATION); openInt < bucketInt && openInt < bucketCnt; ++openInt)
+		{
+			walked.addTime(uint64_t(openInt + 1) * BUCKET_DURATION);
+			walkAggregators(walked, walkedAggregators, openInt);
+		}
+		walked.addData(tick.time, &tick.data);
+	}
+	for (; openInt < bucketCnt; ++openInt)
+	{
+		walked.addTime(uint64_t(openInt + 1) * BUCKET_DURATION);
+		walkAggregators(walked, walkedAggregators, openInt);
+	}
+	walked.stop(SESSION_DURATION);
+	double walkTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (size_t i = 0; i < WINDOW_CNT; ++i)
+	{
+		if (!(scheduledBuckets[i] == walkedBuckets[i])) printf("ERROR: window %u differs from the walk\n", static_cast<unsigned>(i));
+	}
+	std::cout << "Windows,Aggregators," << WINDOW_CNT << ",Lags," << lagCnt << ",Schedule s," << scheduleTime << ",Walk s," << walkTime << std::endl;
+}
+
+// a history that joins late, the first ticks live and the rest backfilled, against the serial run
+static void checkBackfill(const std::vector<Tick> &ticks)
+{
+	HistoryRun<TypedBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> serial;
+	serial.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	serial.addAggregators();
+	double serialTime = serial.run(ticks);
+	size_t liveCnt = ticks.size() / 100;
+
+	std::cout << "Backfill,Threads,Serial s,Backfill s" << std::endl;
+	for (unsigned threadCnt = 1; threadCnt <= BACKFILL_MAX_THREAD_CNT; threadCnt *= 2)
+	{
+		HistoryRun<TypedBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> backfilled;
+		backfilled.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+		backfilled.addAggregators();
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < liveCnt; ++i) backfilled.history.addData(ticks[i].time, &ticks[i].data);
+		backfilled.history.backfill(ticks.size() - liveCnt, [&](size_t i) { return ticks[liveCnt + i].time; }, [&](size_t i) { return &ticks[liveCnt + i].data; }, threadCnt);
+		backfilled.history.stop(SESSION_DURATION);
+		backfilled.read();
+		double backfillTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+		{
+			if (!(backfilled.buckets[i] == serial.buckets[i])) printf("ERROR: backfilled aggregator %u differs with %u threads\n", static_cast<unsigned>(i), threadCnt);
+		}
+		for (unsigned offset = 0; offset < serial.history.bucketCount(); ++offset)
+		{
+			if (!(backfilled.history.bucketForOffset(offset) == serial.history.bucketForOffset(offset)))
+			{
+				printf("ERROR: backfilled bucket %u differs with %u threads\n", offset, threadCnt);
+				break;
+			}
+		}
+		std::cout << "Backfill," << threadCnt << ',' << serialTime << ',' << backfillTime << std::endl;
+	}
+
+	// floating point buckets and every aggregator bit identical, the partial sums take the same buckets in the same order
+	HistoryRun<TypedBucketHistory<RealPriceBucket>, TypedAggregator<RealPriceBucket>, RealPriceBucket> serialReal, backfilledReal;
+	serialReal.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	serialReal.addAggregators();
+	serialReal.run(ticks);
+	backfilledReal.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION);
+	backfilledReal.addAggregators();
+	for (size_t i = 0; i < liveCnt; ++i) backfilledReal.history.addData(ticks[i].time, &ticks[i].data);
+	backfilledReal.history.backfill(ticks.size() - liveCnt, [&](size_t i) { return ticks[liveCnt + i].time; }, [&](size_t i) { return &ticks[liveCnt + i].data; }, BACKFILL_MAX_THREAD_CNT);
+	backfilledReal.history.stop(SESSION_DURATION);
+	backfilledReal.read();
+	for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+	{
+		if (!(backfilledReal.buckets[i] == serialReal.buckets[i])) printf("ERROR: backfilled floating point aggregator %u differs\n", static_cast<unsigned>(i));
+	}
+	for (unsigned offset = 0; offset < serialReal.history.bucketCount(); ++offset)
+	{
+		if (!(backfilledReal.history.bucketForOffset(offset) == serialReal.history.bucketForOffset(offset)))
+		{
+			printf("ERROR: backfilled floating point bucket %u differs\n", offset);
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::mt19937_64 random(17);
+	std::exponential_distribution<double> interval(1.0 / MEAN_TICK_INTERVAL);
+	std::uniform_int_distribution<int> step(-2, 2);
+	std::uniform_int_distribution<int64_t> volume(1, 10);
+
+	std::vector<Tick> ticks;
+	ticks.reserve(TICK_CNT);
+	uint64_t time(0);
+	int64_t price(100000);
+	for (size_t i = 0; i < TICK_CNT && time < SESSION_DURATION; ++i)
+	{
+		time += static_cast<uint64_t>(interval(random));
+		price += step(random);
+		ticks.push_back(Tick{ time, { price, volume(random) } });
+	}
+
+	BucketGenerator<PriceBucket> bucketGenerator;
+	HistoryRun<BucketHistory, Aggregator> polymorphic;
+	HistoryRun<TypedBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> typed;
+	// one aggregator type for every typed history
+	HistoryRun<ColumnarBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> columnar;
+	HistoryRun<RingBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> ring;
+	HistoryRun<IndexedBucketHistory<PriceBucket>, TypedAggregator<PriceBucket>> prefixSum;
+	HistoryRun<IndexedBucketHistory<PriceBucket, SegmentTreeIndex<PriceBucket>>, TypedAggregator<PriceBucket>> segmentTree;
+	static_assert(std::is_same<ArenaBucketHistory<PriceBucket>::AggregatorType, TypedAggregator<PriceBucket>>::value, "arena histories take typed aggregators");
+	if (polymorphic.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION, bucketGenerator) || typed.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION) ||
+		columnar.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION) || prefixSum.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION) ||
+		segmentTree.history.initialize(BUCKET_DURATION, 0, SESSION_DURATION) || ring.history.initialize(BUCKET_DURATION, 0, RING_BUCKET_CNT))
+	{
+		printf("ERROR: initialize failed\n");
+		return 1;
+	}
+	polymorphic.addAggregators();
+	typed.addAggregators();
+	columnar.addAggregators();
+	prefixSum.addAggregators();
+	segmentTree.addAggregators();
+	ring.addAggregators();
+
+	std::cout << "Ticks," << ticks.size() << ",Buckets," << typed.history.bucketCount() << std::endl;
+	std::cout << "Trial,Polymorphic s,Typed s,Columnar s,Ring s" << std::endl;
+	for (int trial = 0; trial < TRIAL_CNT; ++trial)
+	{
+		double polymorphicTime = polymorphic.run(ticks);
+		double typedTime = typed.run(ticks);
+		double columnarTime = columnar.run(ticks);
+		double ringTime = ring.run(ticks);
+		std::cout << trial << ',' << polymorphicTime << ',' << typedTime << ',' << columnarTime << ',' << ringTime << std::endl;
+
+		for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+		{
+			if (!(polymorphic.buckets[i] == typed.buckets[i]) || !(columnar.buckets[i] == typed.buckets[i]) || !(ring.buckets[i] == typed.buckets[i])) printf("ERROR: aggregator %u differs\n", static_cast<unsigned>(i));
+		}
+		for (unsigned offset = 0; offset < typed.history.bucketCount(); ++offset)
+		{
+			if (!(static_cast<PriceBucket&>(polymorphic.history.bucketForOffset(offset)) == typed.history.bucketForOffset(offset)))
+			{
+				printf("ERROR: bucket %u differs\n", offset);
+				break;
+			}
+		}
+		// stopping opened the bucket after the session, the ring holds the ones before it
+		for (unsigned lag = 1; lag < RING_BUCKET_CNT; ++lag)
+		{
+			if (!(ring.history.bucketForLag(lag) == typed.history.bucketForOffset(typed.history.bucketCount() - lag)))
+			{
+				printf("ERROR: ring bucket %u differs\n", lag);
+				break;
+			}
+		}
+	}
+
+	// arbitrary ranges, summed over the buckets and down the columns
+	std::vector<std::pair<unsigned, unsigned>> ranges;
+	std::uniform_int_distribution<unsigned> offset(0, typed.history.bucketCount());
+	for (size_t i = 0; i < RANGE_QUERY_CNT; ++i)
+	{
+		unsigned beginOffset(offset(random)), endOffset(offset(random));
+		ranges.push_back(beginOffset < endOffset ? std::make_pair(beginOffset, endOffset) : std::make_pair(endOffset, beginOffset));
+	}
+	columnar.run(ticks);
+	std::vector<PriceBucket> scanSums(ranges.size()), columnSums(ranges.size()), prefixSums(ranges.size()), treeSums(ranges.size());
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		for (unsigned offset = ranges[i].first; offset < ranges[i].second; ++offset) scanSums[i] += typed.history.bucketForOffset(offset);
+	}
+	double scanTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ranges.size(); ++i) columnar.history.rangeSum(ranges[i].first, ranges[i].second, columnSums[i]);
+	double columnTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// the session is closed, the indexes answer without the history
+	double prefixSumTime = prefixSum.run(ticks), segmentTreeTime = segmentTree.run(ticks);
+	std::cout << "Indexed,Prefix sum s," << prefixSumTime << ",Segment tree s," << segmentTreeTime << std::endl;
+	const PrefixSumIndex<PriceBucket> &prefixSumIndex = prefixSum.history.index();
+	const SegmentTreeIndex<PriceBucket> &segmentTreeIndex = segmentTree.history.index();
+	if (prefixSumIndex.closedCount() != typed.history.bucketCount() || segmentTreeIndex.closedCount() != typed.history.bucketCount()) printf("ERROR: buckets not closed\n");
+
+	// every aggregator against its window summed from the index
+	unsigned bucketCnt = typed.history.bucketCount();
+	PriceBucket session;
+	prefixSumIndex.sum(0, bucketCnt, session);
+	if (session.duration() != static_cast<int64_t>(SESSION_DURATION - ticks.front().time) || session.count() != static_cast<int64_t>(ticks.size())) printf("ERROR: session duration %lld\n", static_cast<long long>(session.duration()));
+	for (size_t i = 0; i < AGGREGATOR_CNT; ++i)
+	{
+		unsigned beginLag = i < REAL_TIME_CNT ? 0 : static_cast<unsigned>(historicalWindows[i - REAL_TIME_CNT][0] / BUCKET_DURATION);
+		unsigned endLag = static_cast<unsigned>((i < REAL_TIME_CNT ? realTimeWindows[i] : historicalWindows[i - REAL_TIME_CNT][1]) / BUCKET_DURATION);
+		PriceBucket window;
+		prefixSumIndex.sum(bucketCnt - endLag, bucketCnt - beginLag, window);
+		if (!(window == typed.buckets[i])) printf("ERROR: aggregator %u window differs\n", static_cast<unsigned>(i));
+	}
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ranges.size(); ++i) prefixSumIndex.sum(ranges[i].first, ranges[i].second, prefixSums[i]);
+	double prefixTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ranges.size(); ++i) segmentTreeIndex.sum(ranges[i].first, ranges[i].second, treeSums[i]);
+	double treeTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		if (!(scanSums[i] == columnSums[i]) || !(scanSums[i] == prefixSums[i]) || !(scanSums[i] == treeSums[i])) printf("ERROR: range %u %u differs\n", ranges[i].first, ranges[i].second);
+	}
+	std::cout << "Range queries," << ranges.size() << ",Scan s," << scanTime << ",Columnar s," << columnTime << ",Prefix sum s," << prefixTime << ",Segment tree s," << treeTime << std::endl;
+
+	// data older than the last update is refused inside the session, before it only becomes the previous data
+	TypedBucketHistory<PriceBucket> ordered;
+	ordered.initialize(BUCKET_DURATION, BUCKET_DURATION, SESSION_DURATION);
+	if (ordered.addData(0, &ticks[0].data) || ordered.addData(2 * BUCKET_DURATION, &ticks[1].data) || ordered.addData(2 * BUCKET_DURATION - 1, &ticks[2].data) != -1)
+		printf("ERROR: out of order data not refused\n");
+
+	checkArena(ticks);
+	checkMapped(ticks, argc > 1 ? argv[1] : "DataHistoryTest.bin");
+	checkBackfill(ticks);
+	checkManyWindows(ticks);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <emmintrin.h>
+
+class PriceLevel;
+
+/*
+** DepthSnapshot
+** - top levels of each side as parallel arrays, best price first
+*/
+struct DepthSnapshot
+{
+	enum { MAX_LEVELS = 16 };
+	unsigned _levelCnt[2];
+	alignas(16) unsigned _prices[2][MAX_LEVELS];
+	alignas(16) unsigned _shares[2][MAX_LEVELS];
+	alignas(16) unsigned _orderCnts[2][MAX_LEVELS];
+};
+
+/*
+** DepthCache
+** - DepthSnapshot of up to MAX_LEVELS levels kept current as levels are added, emptied or resized
+** - the owning book reads it in place, other threads copy it out under a seqlock
+** - prices are located and ranked with SSE2 compares over the whole array
+*/
+class DepthCache
+{
+protected:
+	alignas(64) std::atomic<uint32_t> _sequence;
+	unsigned _depth;
+	DepthSnapshot _snapshot;
+	// cached levels, used to find the next level when one leaves the cache
+	PriceLevel *_levels[2][DepthSnapshot::MAX_LEVELS];
+
+	// bit i set for each cached price where compare(price, _prices[i])
+	inline unsigned _equalMask(int side, unsigned price) const;
+	inline unsigned _betterMask(int side, unsigned price) const;
+	void _move(int side, unsigned to, unsigned from, unsigned cnt)
+	{
+		memmove(_snapshot._prices[side] + to, _snapshot._prices[side] + from, cnt * sizeof(unsigned));
+		memmove(_snapshot._shares[side] + to, _snapshot._shares[side] + from, cnt * sizeof(unsigned));
+		memmove(_snapshot._orderCnts[side] + to, _snapshot._orderCnts[side] + from, cnt * sizeof(unsigned));
+		memmove(_levels[side] + to, _levels[side] + from, cnt * sizeof(PriceLevel*));
+	}
+	void _set(int side, unsigned index, unsigned price, unsigned shares, unsigned orderCnt, PriceLevel *priceLevel)
+	{
+		_snapshot._prices[side][index] = price;
+		_snapshot._shares[side][index] = shares;
+		_snapshot._orderCnts[side][index] = orderCnt;
+		_levels[side][index] = priceLevel;
+	}
+public:
+	enum { NOT_CACHED = -1 };
+
+	DepthCache(unsigned depth) : _sequence(0), _depth(depth) { memset(&_snapshot, 0, sizeof(_snapshot)); memset(_levels, 0, sizeof(_levels)); }
+	unsigned depth() const { return _depth; }
+	const DepthSnapshot &snapshot() const { return _snapshot; }
+
+	// writer, every change is bracketed so readers can detect a torn copy
+	void beginWrite() { _sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); std::atomic_thread_fence(std::memory_order_release); }
+	void endWrite() { _sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	inline int find(int side, unsigned price) const;
+	void update(int side, int index, unsigned shares, unsigned orderCnt) { _snapshot._shares[side][index] = shares; _snapshot._orderCnts[side][index] = orderCnt; }
+	// a level better than the last cached one, or any level while the cache is not full
+	inline void insert(int side, unsigned price, unsigned shares, unsigned orderCnt, PriceLevel *priceLevel);
+	// removes the level, returns the last cached level if the cache was full, as more levels may follow it
+	inline PriceLevel *erase(int side, int index, bool &wasFull);
+	void append(int side, unsigned price, unsigned shares, unsigned orderCnt, PriceLevel *priceLevel) { _set(side, _snapshot._levelCnt[side]++, price, shares, orderCnt, priceLevel); }
+
+	// reader on any thread, spins while a write is in progress
+	inline void copy(DepthSnapshot &snapshot) const;
+};
+
+inline
+unsigned DepthCache::_equalMask(int side, unsigned price) const
+{
+	__m128i key = _mm_set1_epi32(static_cast<int>(price));
+	const __m128i *prices = reinterpret_cast<const __m128i*>(_snapshot._prices[side]);
+	unsigned mask(0);
+	for (unsigned i = 0; i < DepthSnapshot::MAX_LEVELS / 4; ++i)
+		mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128(prices + i), key))) << (i * 4);
+	return mask & ((1u << _snapshot._levelCnt[side]) - 1);
+}
+
+inline
+unsigned DepthCache::_betterMask(int side, unsigned price) const
+{
+	// unsigned compare by biasing to signed, bids rank higher prices first and asks lower
+	__m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+	__m128i key = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(price)), bias);
+	const __m128i *prices = reinterpret_cast<const __m128i*>(_snapshot._prices[side]);
+	unsigned mask(0);
+	for (unsigned i = 0; i < DepthSnapshot::MAX_LEVELS / 4; ++i)
+	{
+		__m128i cached = _mm_xor_si128(_mm_load_si128(prices + i), bias);
+		__m128i better = side ? _mm_cmplt_epi32(cached, key) : _mm_cmpgt_epi32(cached, key);
+		mask |= _mm_movemask_ps(_mm_castsi128_ps(better)) << (i * 4);
+	}
+	return mask & ((1u << _snapshot._levelCnt[side]) - 1);
+}
+
+inline
+int DepthCache::find(int side, unsigned price) const
+{
+	unsigned mask = _equalMask(side, price);
+	if (!mask) return NOT_CACHED;
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+inline
+void DepthCache::insert(int side, unsigned price, unsigned shares, unsigned orderCnt, PriceLevel *priceLevel)
+{
+	unsigned levelCnt = _snapshot._levelCnt[side];
+	// cached prices are sorted, so the better ones are a prefix
+	unsigned mask = _betterMask(side, price), index(0);
+	for (; mask; mask &= mask - 1) ++index;
+	if (index >= _depth) return;
+	if (levelCnt == _depth) --levelCnt;
+	_move(side, index + 1, index, levelCnt - index);
+	_set(side, index, price, shares, orderCnt, priceLevel);
+	_snapshot._levelCnt[side] = levelCnt + 1;
+}
+
+inline
+PriceLevel *DepthCache::erase(int side, int index, bool &wasFull)
+{
+	unsigned levelCnt = _snapshot._levelCnt[side];
+	wasFull = levelCnt == _depth;
+	_move(side, index, index + 1, levelCnt - index - 1);
+	_snapshot._levelCnt[side] = --levelCnt;
+	return levelCnt ? _levels[side][levelCnt - 1] : 0;
+}
+
+inline
+void DepthCache::copy(DepthSnapshot &snapshot) const
+{
+	for (;;)
+	{
+		uint32_t sequence = _sequence.load(std::memory_order_acquire);
+		if (sequence & 1) { _mm_pause(); continue; }
+		memcpy(&snapshot, &_snapshot, sizeof(snapshot));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_sequence.load(std::memory_order_relaxed) == sequence) return;
+	}
+}
@@ -0,0 +1,69 @@
+#include "Exchange.h"
+
+void Exchange::initializeOrderIndex(size_t size)
+{
+	if (_orderTable) delete _orderTable;
+	_orderTable = new OrderTable(size);
+}
+
+int Exchange::addOrder(OrderBook *orderBook, int side, unsigned price, BookOrder *order)
+{
+	if (order->_orderId && !_orderTable->insert(order->_orderId, order)) return -1;
+	bool filled = orderBook->newOrder(side, price, order);
+	if (!order->_priceLevel) order->removeFromHash();
+	return filled;
+}
+
+BookOrder *Exchange::_reduce(BookOrder *order, unsigned shares)
+{
+	OrderBook *orderBook = order->_priceLevel->orderBook();
+	if (shares < order->_shares)
+	{
+		orderBook->reduceRequest(order->_side, order, shares);
+		return 0;
+	}
+	order->removeFromHash();
+	orderBook->cancelRequest(order->_side, order);
+	return order;
+}
+
+BookOrder *Exchange::cancelById(uint64_t orderId)
+{
+	BookOrder *order = _orderTable->remove(orderId);
+	if (order) order->_priceLevel->orderBook()->cancelRequest(order->_side, order);
+	return order;
+}
+
+BookOrder *Exchange::reduceById(uint64_t orderId, unsigned shares)
+{
+	BookOrder *order = _orderTable->find(orderId);
+	return order ? _reduce(order, shares) : 0;
+}
+
+BookOrder *Exchange::executeById(uint64_t orderId, unsigned shares)
+{
+	BookOrder *order = _orderTable->find(orderId);
+	if (!order) return 0;
+	execute(order->_side, order->_priceLevel->price(), shares < order->_shares ? shares : order->_shares, order);
+	return _reduce(order, shares);
+}
+
+BookOrder *Exchange::replaceById(uint64_t orderId, unsigned price, BookOrder *order)
+{
+	BookOrder *referenceOrder = _orderTable->remove(orderId);
+	if (!referenceOrder) return 0;
+	// indexed before it rests, a duplicate would otherwise rest where no id reaches it
+	if (order->_orderId && !_orderTable->insert(order->_orderId, order))
+	{
+		_orderTable->insert(orderId, referenceOrder);
+		return 0;
+	}
+	referenceOrder->_priceLevel->orderBook()->replaceRequest(referenceOrder->_side, price, order, referenceOrder);
+	if (!order->_priceLevel) order->removeFromHash();
+	return referenceOrder;
+}
+
+Exchange::~Exchange()
+{
+	if (_orderTable) delete _orderTable;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "IntrusiveHashTable.h"
+#include "IntrusiveQueue.h"
+#include "OrderBook.h"
+#include "SpscQueue.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+** ExchangeObjectPool
+** - QueuedObjectPool that owns its blocks and counts them
+** - reserve() grows the pool up front so the book never allocates while trading
+** - in steady state a block allocation is counted and asserts in debug builds
+*/
+template<typename TYPE>
+class ExchangeObjectPool : public Intrusive::QueuedObjectPool<TYPE>
+{
+protected:
+	std::vector<TYPE*> _blocks;
+	size_t _objectCnt;
+	size_t _steadyStateAllocations;
+	bool _steadyStateFlag;
+
+	Intrusive::QueuedObject *allocateBlock()
+	{
+		if (_steadyStateFlag)
+		{
+			++_steadyStateAllocations;
+			assert(!"ExchangeObjectPool allocation in steady state");
+		}
+		Intrusive::QueuedObject *object = Intrusive::QueuedObjectPool<TYPE>::allocateBlock();
+		_blocks.push_back(static_cast<TYPE*>(object));
+		_objectCnt += this->_blockSize;
+		return object;
+	}
+public:
+	ExchangeObjectPool(unsigned blockSize = 256) : _objectCnt(0), _steadyStateAllocations(0), _steadyStateFlag(false) { this->setBlockSize(blockSize); }
+
+	// grow the pool to at least objectCnt objects
+	void reserve(size_t objectCnt)
+	{
+		Intrusive::LiFoQueue objects;
+		while (_objectCnt < objectCnt) objects.push_front(Intrusive::BaseQueuedObjectPool::allocate());
+		while (!objects.empty()) this->free(objects.pop_front());
+	}
+	void setSteadyState(bool steadyStateFlag) { _steadyStateFlag = steadyStateFlag; }
+	size_t steadyStateAllocations() const { return _steadyStateAllocations; }
+	size_t size() const { return _objectCnt; }
+
+	~ExchangeObjectPool() { for (TYPE *block : _blocks) delete[] block; }
+private:
+	ExchangeObjectPool(const ExchangeObjectPool&) = delete;
+	ExchangeObjectPool& operator = (const ExchangeObjectPool&) = delete;
+};
+
+/*
+** Exchange
+** - allocates price levels and orders for its OrderBooks and receives their executions
+** - levels and orders come from pools, reserve() and setSteadyState() make trading allocation free
+** - optional order id index for feeds that add, cancel, execute and replace by order id
+*/
+struct ExecutionReport
+{
+	uint64_t _orderId;
+	unsigned _price;
+	unsigned _shares;
+	int _side;
+};
+
+typedef SpscQueue<ExecutionReport> ExecutionQueue;
+
+struct OrderIdEqual
+{
+	bool operator() (const uint64_t &orderId, const BookOrder &order) const { return orderId == order._orderId; }
+};
+
+class Exchange
+{
+protected:
+	typedef Intrusive::HashTable<uint64_t, BookOrder, OrderIdEqual> OrderTable;
+	OrderTable *_orderTable;
+	ExchangeObjectPool<PriceLevel> _priceLevelPool;
+	ExchangeObjectPool<BookOrder> _bookOrderPool;
+	// optional, executions are also reported to another thread
+	ExecutionQueue *_executionQueue;
+	// books whose top of book changed since the last publish, each queued once
+	Intrusive::FiFoQueue _topOfBookQueue;
+	// resting orders that left the book by trading, waiting for releaseOrders
+	Intrusive::FiFoQueue _releasedOrders;
+
+	BookOrder *_reduce(BookOrder *order, unsigned shares);
+public:
+	Exchange(unsigned blockSize = 256) : _orderTable(0), _priceLevelPool(blockSize), _bookOrderPool(blockSize), _executionQueue(0) {}
+	// size is the expected number of resting orders
+	void initializeOrderIndex(size_t size);
+
+	inline void execute(int side, unsigned price, unsigned shares, BookOrder *order);
+	// the queue's consumer must keep draining it, execute spins while it is full
+	void setExecutionQueue(ExecutionQueue *executionQueue) { _executionQueue = executionQueue; }
+
+	// conflated top of book
+	// - books mark themselves on their first change, publishTopOfBook at the end of a batch hands each one to onTopOfBook once
+	void markTopOfBook(OrderBook *orderBook) { _topOfBookQueue.push_back(orderBook); }
+	template<typename F>
+	size_t publishTopOfBook(F &onTopOfBook);
+
+	// resting orders that leave the book by trading, filled or cancelled by self trade prevention
+	// - books release them as they leave, releaseOrders hands each one to onOrder once, to free or reuse
+	void releaseOrder(BookOrder *order) { order->removeFromHash(); _releasedOrders.push_back(order); }
+	template<typename F>
+	size_t releaseOrders(F &onOrder);
+	PriceLevel *allocatePriceLevel() { return _priceLevelPool.allocate(); }
+	void freePriceLevel(PriceLevel *priceLevel) { _priceLevelPool.free(priceLevel); }
+	BookOrder *allocateBookOrder() { return _bookOrderPool.allocate(); }
+	void freeBookOrder(BookOrder *order) { _bookOrderPool.free(order); }
+
+	// preallocate pooled levels and orders
+	void reserve(size_t priceLevelCnt, size_t bookOrderCnt) { _priceLevelPool.reserve(priceLevelCnt); _bookOrderPool.reserve(bookOrderCnt); }
+	// once reserved, any further pool growth is counted and asserts in debug builds
+	void setSteadyState(bool steadyStateFlag) { _priceLevelPool.setSteadyState(steadyStateFlag); _bookOrderPool.setSteadyState(steadyStateFlag); }
+	size_t steadyStateAllocations() const { return _priceLevelPool.steadyStateAllocations() + _bookOrderPool.steadyStateAllocations(); }
+
+	// order id index
+	// - orders that leave the book are returned for the caller to free, unknown ids return 0
+	// - orders an add or replace fills out of the book are released, see releaseOrders
+	// - addOrder returns -1 for a duplicate order id, otherwise whether the order filled on entry
+	int addOrder(OrderBook *orderBook, int side, unsigned price, BookOrder *order);
+	BookOrder *findOrder(uint64_t orderId) { return _orderTable->find(orderId); }
+	BookOrder *cancelById(uint64_t orderId);
+	BookOrder *reduceById(uint64_t orderId, unsigned shares);
+	// reports the execution at the order's price, then reduces it
+	BookOrder *executeById(uint64_t orderId, unsigned shares);
+	// order carries the new order id and shares, the replaced order is returned
+	// - 0 for an unknown id or a duplicate new id, either leaves the book unchanged
+	BookOrder *replaceById(uint64_t orderId, unsigned price, BookOrder *order);
+
+	~Exchange();
+private:
+	Exchange(const Exchange&) = delete;
+	Exchange& operator = (const Exchange&) = delete;
+};
+
+template<typename F>
+size_t Exchange::publishTopOfBook(F &onTopOfBook)
+{
+	size_t cnt(0);
+	while (!_topOfBookQueue.empty())
+	{
+		OrderBook *orderBook = static_cast<OrderBook*>(_topOfBookQueue.pop_front());
+		orderBook->_topOfBookFlag = false;
+		onTopOfBook(*orderBook);
+		++cnt;
+	}
+	return cnt;
+}
+
+template<typename F>
+size_t Exchange::releaseOrders(F &onOrder)
+{
+	size_t cnt(0);
+	while (!_releasedOrders.empty())
+	{
+		onOrder(static_cast<BookOrder*>(_releasedOrders.pop_front()));
+		++cnt;
+	}
+	return cnt;
+}
+
+inline
+void Exchange::execute(int side, unsigned price, unsigned shares, BookOrder *order)
+{
+	// orders filled out of the book leave the index, unindexed orders are unlinked already
+	if (!order->_priceLevel) order->removeFromHash();
+	if (_executionQueue)
+	{
+		ExecutionReport report = {order->_orderId, price, shares, side};
+		for (unsigned spinCnt(0); !_executionQueue->push(report);) ExecutionQueue::backoff(spinCnt);
+	}
+}
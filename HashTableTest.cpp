@@ -0,0 +1,148 @@
+#include "IntrusiveHashTable.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+class TestOrder : public Intrusive::HashTableObject
+{
+public:
+	uint64_t _orderId;
+	unsigned _shares;
+	unsigned _price;
+	TestOrder() : _orderId(0), _shares(0), _price(0) {}
+};
+
+struct OrderIdEqual
+{
+	bool operator() (const uint64_t &orderId, const TestOrder &order) const { return orderId == order._orderId; }
+};
+
+// the table and its objects are sized well beyond the last level cache
+#define ITEM_CNT (1 << 22)
+#define LOOKUP_CNT (1 << 20)
+#define PACKET_CNT 32
+
+int main(int argc, const char *argv[])
+{
+	typedef Intrusive::HashTable<uint64_t, TestOrder, OrderIdEqual> OrderTable;
+	OrderTable orderTable(ITEM_CNT);
+
+	TestOrder *orders = new TestOrder[ITEM_CNT];
+	uint64_t *orderIds = new uint64_t[ITEM_CNT];
+	std::mt19937_64 generator(1);
+	for (size_t i = 0; i < ITEM_CNT; ++i)
+	{
+		orders[i]._orderId = orderIds[i] = generator();
+	}
+
+	TestOrder **items = new TestOrder*[ITEM_CNT];
+	for (size_t i = 0; i < ITEM_CNT; ++i) items[i] = orders + i;
+	if (orderTable.insertBatch(orderIds, items, ITEM_CNT) != ITEM_CNT) printf("ERROR: insertBatch\n");
+
+	// random lookups, PACKET_CNT keys at a time
+	uint64_t *lookupIds = new uint64_t[LOOKUP_CNT];
+	for (size_t i = 0; i < LOOKUP_CNT; ++i) lookupIds[i] = orderIds[generator() % ITEM_CNT];
+
+	std::cout << "Operation,Loop,Batch" << std::endl;
+
+	std::chrono::hours hour(1);
+	std::chrono::duration<long long, std::nano> minFindDuration(hour), minFindBatchDuration(hour);
+	TestOrder *found[PACKET_CNT];
+	for (size_t t(0); t < 5; ++t)
+	{
+		size_t loopCnt(0), batchCnt(0);
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < LOOKUP_CNT; i += PACKET_CNT)
+		{
+			for (size_t j = 0; j < PACKET_CNT; ++j)
+			{
+				if ((found[j] = orderTable.find(lookupIds[i + j]))) ++loopCnt;
+			}
+		}
+		std::chrono::duration<long long, std::nano> duration = std::chrono::steady_clock::now() - start;
+		if (minFindDuration > duration) minFindDuration = duration;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < LOOKUP_CNT; i += PACKET_CNT)
+		{
+			batchCnt += orderTable.findBatch(lookupIds + i, PACKET_CNT, found);
+		}
+		duration = std::chrono::steady_clock::now() - start;
+		if (minFindBatchDuration > duration) minFindBatchDuration = duration;
+
+		if (loopCnt != LOOKUP_CNT || batchCnt != LOOKUP_CNT) printf("ERROR: find %zu %zu\n", loopCnt, batchCnt);
+	}
+	std::cout << "find ns," << (double)minFindDuration.count() / LOOKUP_CNT << ',' << (double)minFindBatchDuration.count() / LOOKUP_CNT << std::endl;
+
+	// the batch finds the very objects the loop does
+	TestOrder *loopFound[PACKET_CNT];
+	for (size_t i = 0; i < LOOKUP_CNT; i += PACKET_CNT)
+	{
+		orderTable.findBatch(lookupIds + i, PACKET_CNT, found);
+		for (size_t j = 0; j < PACKET_CNT; ++j)
+		{
+			loopFound[j] = orderTable.find(lookupIds[i + j]);
+			if (found[j] != loopFound[j] || !found[j] || found[j]->_orderId != lookupIds[i + j])
+			{
+				printf("ERROR: findBatch %zu\n", i + j);
+				break;
+			}
+		}
+	}
+
+	// remove then reinsert every lookup key
+	std::chrono::duration<long long, std::nano> minRemoveDuration(hour), minRemoveBatchDuration(hour);
+	for (size_t t(0); t < 5; ++t)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < ITEM_CNT / 4; ++i)
+		{
+			orderTable.remove(orderIds[i]);
+		}
+		std::chrono::duration<long long, std::nano> duration = std::chrono::steady_clock::now() - start;
+		if (minRemoveDuration > duration) minRemoveDuration = duration;
+		orderTable.insertBatch(orderIds, items, ITEM_CNT / 4);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < ITEM_CNT / 4; i += PACKET_CNT)
+		{
+			orderTable.removeBatch(orderIds + i, PACKET_CNT, found);
+		}
+		duration = std::chrono::steady_clock::now() - start;
+		if (minRemoveBatchDuration > duration) minRemoveBatchDuration = duration;
+		orderTable.insertBatch(orderIds, items, ITEM_CNT / 4);
+	}
+	std::cout << "remove ns," << (double)minRemoveDuration.count() / (ITEM_CNT / 4) << ',' << (double)minRemoveBatchDuration.count() / (ITEM_CNT / 4) << std::endl;
+
+	// every key removed hands back its own object and is gone afterwards
+	size_t removedCnt(0);
+	for (size_t i = 0; i < ITEM_CNT / 4; i += PACKET_CNT)
+	{
+		removedCnt += orderTable.removeBatch(orderIds + i, PACKET_CNT, found);
+		for (size_t j = 0; j < PACKET_CNT; ++j)
+		{
+			if (found[j] != items[i + j]) printf("ERROR: removeBatch returned %zu\n", i + j);
+		}
+	}
+	if (removedCnt != ITEM_CNT / 4) printf("ERROR: removeBatch %zu\n", removedCnt);
+	for (size_t i = 0; i < ITEM_CNT / 4; ++i)
+	{
+		if (orderTable.find(orderIds[i])) printf("ERROR: found %zu after removeBatch\n", i);
+	}
+	for (size_t i = ITEM_CNT / 4; i < ITEM_CNT; ++i)
+	{
+		if (orderTable.find(orderIds[i]) != items[i]) printf("ERROR: lost %zu to removeBatch\n", i);
+	}
+
+	delete[] lookupIds;
+	delete[] items;
+	delete[] orderIds;
+	delete[] orders;
+
+	return 0;
+}
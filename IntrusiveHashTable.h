@@ -2,6 +2,8 @@
 #define _INTRUSIVE_HASH_TABLE_
 
 #include <math.h>
+#include <xmmintrin.h>
+#include <algorithm>
 #include <vector>
 
 namespace Intrusive
@@ -90,55 +92,140 @@ protected:
 
 	Equal _equal;
 	Hash _hash;
+
+	inline bool _insert(HashList &list, const Key &key, Type *item);
+	inline Type *_find(HashList &list, const Key &key);
+	inline Type *_remove(HashList &list, const Key &key);
+	inline void _prefetch(const Key *keys, size_t n, HashList **lists);
 public:
 	HashTable(size_t size, Equal &equal = Equal(), Hash &hash = Hash()):
 		_size((size_t)log2(size-1)+1), _buckets(1LL << _size), _mask(_buckets - 1), _listArray(new HashList[_buckets]), _equal(equal), _hash(hash)
 	{}
 
-	bool insert(const Key &key, Type *item)
+	bool insert(const Key &key, Type *item) { return _insert(_listArray[(_hash(key) & _mask)], key, item); }
+	Type *find(const Key &key) { return _find(_listArray[(_hash(key) & _mask)], key); }
+	Type *remove(const Key &key) { return _remove(_listArray[(_hash(key) & _mask)], key); }
+
+	// batched operations
+	// - hash every key and prefetch its bucket, then prefetch the first node of each chain
+	// - keys are compared only once the loads for the whole batch are in flight
+	// - results match calling insert/find/remove for each key in order
+	enum { BATCH_SIZE = 16 };
+	size_t findBatch(const Key *keys, size_t n, Type **out);
+	size_t insertBatch(const Key *keys, Type **items, size_t n, bool *inserted = 0);
+	size_t removeBatch(const Key *keys, size_t n, Type **out);
+
+	size_t collisions(std::vector<size_t> &collisions);
+
+	~HashTable()
+	{
+		if (_listArray) delete[] _listArray;
+	}
+};
+
+template<typename Key, typename Type, typename Equal, typename Hash>
+bool HashTable<Key, Type, Equal, Hash>::_insert(HashList &list, const Key &key, Type *item)
+{
+	for (HashTableObject *o = list._next; o != &list; o = o->_next)
 	{
-		HashList &list = _listArray[(_hash(key) & _mask)];
-		for (HashTableObject *o = list._next; o != &list; o = o->_next)
+		if (_equal(key, *static_cast<Type*>(o))) return false;
+	}
+	list.push_front(item);
+	return true;
+}
+
+template<typename Key, typename Type, typename Equal, typename Hash>
+Type *HashTable<Key, Type, Equal, Hash>::_find(HashList &list, const Key &key)
+{
+	for (HashTableObject *o = list._next; o != &list; o = o->_next)
+	{
+		Type *item = static_cast<Type*>(o);
+		if (_equal(key, *item)) return item;
+	}
+	return 0;
+}
+
+template<typename Key, typename Type, typename Equal, typename Hash>
+Type *HashTable<Key, Type, Equal, Hash>::_remove(HashList &list, const Key &key)
+{
+	for (HashTableObject *o = list._next; o != &list; o = o->_next)
+	{
+		Type *item = static_cast<Type*>(o);
+		if (_equal(key, *item))
 		{
-			if (_equal(key, *static_cast<Type*>(o))) return false;
+			o->removeFromHash();
+			return item;
 		}
-		list.push_front(item);
-		return true;
 	}
+	return 0;
+}
 
-	Type *find(const Key &key)
+template<typename Key, typename Type, typename Equal, typename Hash>
+void HashTable<Key, Type, Equal, Hash>::_prefetch(const Key *keys, size_t n, HashList **lists)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		lists[i] = _listArray + (_hash(keys[i]) & _mask);
+		_mm_prefetch(reinterpret_cast<const char*>(lists[i]), _MM_HINT_T0);
+	}
+	for (size_t i = 0; i < n; ++i)
 	{
-		HashList &list = _listArray[(_hash(key) & _mask)];
-		for (HashTableObject *o = list._next; o != &list; o = o->_next)
+		_mm_prefetch(reinterpret_cast<const char*>(lists[i]->_next), _MM_HINT_T0);
+	}
+}
+
+template<typename Key, typename Type, typename Equal, typename Hash>
+size_t HashTable<Key, Type, Equal, Hash>::findBatch(const Key *keys, size_t n, Type **out)
+{
+	size_t cnt(0);
+	HashList *lists[BATCH_SIZE];
+	for (size_t begin = 0; begin < n; begin += BATCH_SIZE)
+	{
+		size_t batchSize = std::min<size_t>(n - begin, BATCH_SIZE);
+		_prefetch(keys + begin, batchSize, lists);
+		for (size_t i = 0; i < batchSize; ++i)
 		{
-			Type *item = static_cast<Type*>(o);
-			if (_equal(key, *item)) return item;
+			if ((out[begin + i] = _find(*lists[i], keys[begin + i]))) ++cnt;
 		}
-		return 0;
 	}
+	return cnt;
+}
 
-	Type *remove(const Key &key)
+template<typename Key, typename Type, typename Equal, typename Hash>
+size_t HashTable<Key, Type, Equal, Hash>::insertBatch(const Key *keys, Type **items, size_t n, bool *inserted)
+{
+	size_t cnt(0);
+	HashList *lists[BATCH_SIZE];
+	for (size_t begin = 0; begin < n; begin += BATCH_SIZE)
 	{
-		HashList &list = _listArray[(_hash(key) & _mask)];
-		for (HashTableObject *o = list._next; o != &list; o = o->_next)
+		size_t batchSize = std::min<size_t>(n - begin, BATCH_SIZE);
+		_prefetch(keys + begin, batchSize, lists);
+		for (size_t i = 0; i < batchSize; ++i)
 		{
-			Type *item = static_cast<Type*>(o);
-			if (_equal(key, *item))
-			{
-				o->removeFromHash();
-				return item;
-			}
+			bool result = _insert(*lists[i], keys[begin + i], items[begin + i]);
+			if (inserted) inserted[begin + i] = result;
+			if (result) ++cnt;
 		}
-		return 0;
 	}
+	return cnt;
+}
 
-	size_t collisions(std::vector<size_t> &collisions);
-
-	~HashTable()
+template<typename Key, typename Type, typename Equal, typename Hash>
+size_t HashTable<Key, Type, Equal, Hash>::removeBatch(const Key *keys, size_t n, Type **out)
+{
+	size_t cnt(0);
+	HashList *lists[BATCH_SIZE];
+	for (size_t begin = 0; begin < n; begin += BATCH_SIZE)
 	{
-		if (_listArray) delete[] _listArray;
+		size_t batchSize = std::min<size_t>(n - begin, BATCH_SIZE);
+		_prefetch(keys + begin, batchSize, lists);
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			if ((out[begin + i] = _remove(*lists[i], keys[begin + i]))) ++cnt;
+		}
 	}
-};
+	return cnt;
+}
 
 template<typename Key, typename Type, typename Equal, typename Hash>
 size_t HashTable<Key, Type, Equal, Hash>::collisions(std::vector<size_t> &collisions)
@@ -0,0 +1,233 @@
+#include "Journal.h"
+
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+
+static size_t journalSize(uint64_t capacity)
+{
+	return static_cast<size_t>(sizeof(JournalHeader) + capacity * sizeof(ReplayMessage));
+}
+
+Journal::Journal() : _header(0), _records(0)
+#ifdef _MSC_VER
+	, _file(INVALID_HANDLE_VALUE), _mapping(0)
+#else
+	, _fd(-1)
+#endif
+{
+}
+
+int Journal::_map(uint64_t capacity)
+{
+	size_t size = journalSize(capacity);
+#ifdef _MSC_VER
+	// mapping past the end of the file extends it
+	if (!(_mapping = CreateFileMappingA(_file, 0, PAGE_READWRITE, static_cast<DWORD>(uint64_t(size) >> 32), static_cast<DWORD>(size), 0))) return -1;
+	void *data = MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, size);
+	if (!data)
+	{
+		CloseHandle(_mapping);
+		_mapping = 0;
+		return -1;
+	}
+#else
+	struct stat st;
+	if (fstat(_fd, &st) || (static_cast<size_t>(st.st_size) < size && ftruncate(_fd, static_cast<off_t>(size)))) return -1;
+	void *data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (data == MAP_FAILED) return -1;
+#endif
+	_header = static_cast<JournalHeader*>(data);
+	_records = reinterpret_cast<ReplayMessage*>(_header + 1);
+	return 0;
+}
+
+void Journal::_unmap()
+{
+	if (!_header) return;
+#ifdef _MSC_VER
+	UnmapViewOfFile(_header);
+	CloseHandle(_mapping);
+	_mapping = 0;
+#else
+	munmap(_header, journalSize(_header->_capacity));
+#endif
+	_header = 0;
+	_records = 0;
+}
+
+int Journal::_grow()
+{
+	uint64_t capacity = _header->_capacity;
+	_unmap();
+	if (_map(capacity * 2) == 0)
+	{
+		_header->_capacity = capacity * 2;
+		return 0;
+	}
+	_map(capacity);
+	return -1;
+}
+
+int Journal::open(const char *fileName, uint64_t capacity)
+{
+	close();
+	if (!capacity) capacity = 1;
+	JournalHeader existing = {};
+	uint64_t fileSize;
+#ifdef _MSC_VER
+	_file = CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (_file == INVALID_HANDLE_VALUE) return -1;
+	LARGE_INTEGER size;
+	DWORD readSize(0);
+	if (!GetFileSizeEx(_file, &size)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(size.QuadPart);
+	if (fileSize >= sizeof(existing) && (!ReadFile(_file, &existing, sizeof(existing), &readSize, 0) || readSize != sizeof(existing))) { close(); return -1; }
+#else
+	if ((_fd = ::open(fileName, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+	struct stat st;
+	if (fstat(_fd, &st)) { close(); return -1; }
+	fileSize = static_cast<uint64_t>(st.st_size);
+	if (fileSize >= sizeof(existing) && pread(_fd, &existing, sizeof(existing), 0) != sizeof(existing)) { close(); return -1; }
+#endif
+	if (fileSize)
+	{
+		// reopened, keep appending after the last complete record
+		if (fileSize < journalSize(0) || existing._magic != JournalHeader::MAGIC || existing._version != JournalHeader::VERSION ||
+			fileSize < journalSize(existing._capacity) || existing._recordCnt > existing._capacity || _map(existing._capacity))
+		{
+			close();
+			return -1;
+		}
+		return 0;
+	}
+	if (_map(capacity)) { close(); return -1; }
+	_header->_magic = JournalHeader::MAGIC;
+	_header->_version = JournalHeader::VERSION;
+	_header->_recordCnt = 0;
+	_header->_capacity = capacity;
+	_header->_baseSequence = 0;
+	return 0;
+}
+
+void Journal::close()
+{
+	_unmap();
+#ifdef _MSC_VER
+	if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+	_file = INVALID_HANDLE_VALUE;
+#else
+	if (_fd >= 0) ::close(_fd);
+	_fd = -1;
+#endif
+}
+
+void Journal::sync()
+{
+	if (!_header) return;
+#ifdef _MSC_VER
+	FlushViewOfFile(_header, 0);
+	FlushFileBuffers(_file);
+#else
+	msync(_header, journalSize(_header->_capacity), MS_SYNC);
+#endif
+}
+
+void Journal::truncate()
+{
+	// the count is cleared first, a crash in between leaves a gap recovery refuses rather than records at the wrong sequence
+	uint64_t recordCnt = _header->_recordCnt;
+	_header->_recordCnt = 0;
+	std::atomic_signal_fence(std::memory_order_release);
+	_header->_baseSequence += recordCnt;
+}
+
+int Snapshot::write(ReplayEngine &engine, uint64_t journalSequence, const char *fileName)
+{
+	std::string tempFileName(fileName);
+	tempFileName += ".tmp";
+	FILE *file = fopen(tempFileName.c_str(), "wb");
+	if (!file) return -1;
+
+	SnapshotHeader header = {SnapshotHeader::MAGIC, SnapshotHeader::VERSION, journalSequence, 0, static_cast<uint32_t>(engine.bookCnt()), 0};
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ReplayMessage record = {};
+	record._type = REPLAY_ADD;
+	auto writeOrder = [&](int side, unsigned price, const BookOrder *order)
+	{
+		record._side = static_cast<uint8_t>(side);
+		record._price = price;
+		record._shares = order->_shares;
+		record._orderId = order->_orderId;
+		if (ok) ok = fwrite(&record, sizeof(record), 1, file) == 1;
+		++header._recordCnt;
+	};
+	for (size_t book = 0; book < engine.bookCnt(); ++book)
+	{
+		record._book = static_cast<uint16_t>(book);
+		engine.orderBook(book)->forEachOrder(writeOrder);
+	}
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 && fflush(file) == 0;
+	// on disk before it replaces the previous snapshot
+#ifdef _MSC_VER
+	ok = ok && _commit(_fileno(file)) == 0;
+#else
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	ok = fclose(file) == 0 && ok;
+#ifdef _MSC_VER
+	ok = ok && MoveFileExA(tempFileName.c_str(), fileName, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && rename(tempFileName.c_str(), fileName) == 0;
+#endif
+	if (!ok) remove(tempFileName.c_str());
+	return ok ? 0 : -1;
+}
+
+int Snapshot::recover(ReplayEngine &engine, const char *snapshotFileName, const char *journalFileName, uint64_t *appliedCnt)
+{
+	uint64_t journalSequence(0), cnt(0);
+	if (snapshotFileName)
+	{
+		MappedFile file;
+		if (file.open(snapshotFileName)) return -1;
+		const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(file.data());
+		if (file.size() < sizeof(SnapshotHeader) || header->_magic != SnapshotHeader::MAGIC || header->_version != SnapshotHeader::VERSION ||
+			header->_bookCnt != engine.bookCnt() || (file.size() - sizeof(SnapshotHeader)) / sizeof(ReplayMessage) < header->_recordCnt) return -1;
+		const ReplayMessage *records = reinterpret_cast<const ReplayMessage*>(header + 1);
+		for (uint64_t i = 0; i < header->_recordCnt; ++i, ++cnt)
+		{
+			if (records[i]._type != REPLAY_ADD || records[i]._side > 1 || records[i]._book >= engine.bookCnt()) return -1;
+			engine.apply(records[i]);
+		}
+		journalSequence = header->_journalSequence;
+	}
+	if (journalFileName)
+	{
+		MappedFile file;
+		if (file.open(journalFileName)) return -1;
+		const JournalHeader *header = reinterpret_cast<const JournalHeader*>(file.data());
+		if (file.size() < sizeof(JournalHeader) || header->_magic != JournalHeader::MAGIC || header->_version != JournalHeader::VERSION ||
+			header->_recordCnt > header->_capacity || file.size() < journalSize(header->_capacity)) return -1;
+		// a journal truncated past the snapshot, or one that ends before it, has lost records
+		if (journalSequence < header->_baseSequence || journalSequence > header->_baseSequence + header->_recordCnt) return -1;
+		const ReplayMessage *records = reinterpret_cast<const ReplayMessage*>(header + 1);
+		for (uint64_t i = journalSequence - header->_baseSequence; i < header->_recordCnt; ++i, ++cnt)
+		{
+			if (records[i]._type > REPLAY_REPLACE || records[i]._side > 1 || records[i]._book >= engine.bookCnt()) return -1;
+			engine.apply(records[i]);
+		}
+	}
+	if (appliedCnt) *appliedCnt = cnt;
+	return 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Replay.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+** Journal
+** - append only log of the messages applied to a ReplayEngine, one ReplayMessage per record
+** - records are written straight into a shared file mapping that is preallocated and doubled when full
+** - the record count lives in the mapped header and is bumped after the record, so a crashed process
+**   leaves every completed record readable, sync() is only needed to survive the machine going down
+**
+** Snapshot
+** - every resting order of every book written as REPLAY_ADD records, levels best first and orders in queue order,
+**   so replaying it rebuilds the books with their time priority
+** - records the journal sequence it was taken at, recovery replays the snapshot and only the journal after it
+*/
+
+struct JournalHeader
+{
+	enum : uint32_t { MAGIC = 0x4C4E524A, VERSION = 1 };
+	uint32_t _magic;
+	uint32_t _version;
+	// records in the file, the first has sequence baseSequence
+	uint64_t _recordCnt;
+	uint64_t _capacity;
+	uint64_t _baseSequence;
+};
+
+struct SnapshotHeader
+{
+	enum : uint32_t { MAGIC = 0x50414E53, VERSION = 1 };
+	uint32_t _magic;
+	uint32_t _version;
+	// journal records already reflected in the snapshot
+	uint64_t _journalSequence;
+	uint64_t _recordCnt;
+	uint32_t _bookCnt;
+	uint32_t _reserved;
+};
+
+static_assert(sizeof(JournalHeader) == 32, "JournalHeader must be 32 bytes");
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader must be 32 bytes");
+
+class Journal
+{
+protected:
+	JournalHeader *_header;
+	ReplayMessage *_records;
+#ifdef _MSC_VER
+	void *_file;
+	void *_mapping;
+#else
+	int _fd;
+#endif
+
+	int _map(uint64_t capacity);
+	void _unmap();
+	int _grow();
+public:
+	Journal();
+	// opens the journal for appending, creating it if needed, an existing journal keeps its records
+	// - returns -1 if the file can not be mapped or is not a journal
+	int open(const char *fileName, uint64_t capacity = 1 << 20);
+	void close();
+	// returns -1 if the journal could not grow
+	inline int append(const ReplayMessage &message);
+	// flushes the mapping to disk
+	void sync();
+	// drops every record once a snapshot taken at sequence() is safely written, sequences carry on from there
+	void truncate();
+
+	// sequence of the next record
+	uint64_t sequence() const { return _header ? _header->_baseSequence + _header->_recordCnt : 0; }
+	uint64_t capacity() const { return _header ? _header->_capacity : 0; }
+
+	~Journal() { close(); }
+private:
+	Journal(const Journal&) = delete;
+	Journal& operator = (const Journal&) = delete;
+};
+
+class Snapshot
+{
+public:
+	// writes the engine's books as of journalSequence, to a temporary file renamed over fileName once complete
+	static int write(ReplayEngine &engine, uint64_t journalSequence, const char *fileName);
+	// rebuilds a freshly initialized engine from the snapshot, if there is one, and the journal records after it
+	// - either file name may be 0, returns -1 if a file is unreadable or the snapshot does not fit the engine
+	static int recover(ReplayEngine &engine, const char *snapshotFileName, const char *journalFileName, uint64_t *appliedCnt = 0);
+};
+
+inline
+int Journal::append(const ReplayMessage &message)
+{
+	if (_header->_recordCnt == _header->_capacity && _grow()) return -1;
+	_records[_header->_recordCnt] = message;
+	// the record must land before the count that publishes it
+	std::atomic_signal_fence(std::memory_order_release);
+	++_header->_recordCnt;
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include "Latency.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	std::mutex recorderMutex;
+	std::vector<LatencyRecorder*> recorders;
+
+	const char *operationNames[LATENCY_OPERATION_CNT] = {"NewOrder", "Cancel", "Reduce", "Replace", "LevelExecute", "Match"};
+	const char *counterNames[LATENCY_COUNTER_CNT] = {"LevelsWalked", "LevelsAllocated", "LevelsFreed"};
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &histogram)
+{
+	for (unsigned i = 0; i < BUCKET_CNT; ++i) _counts[i] += histogram._counts[i];
+	_count += histogram._count;
+	_sum += histogram._sum;
+	if (histogram._max > _max) _max = histogram._max;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+	if (!_count) return 0;
+	uint64_t rank = static_cast<uint64_t>(fraction * _count + 0.5), cnt(0);
+	if (!rank) rank = 1;
+	for (unsigned i = 0; i < BUCKET_CNT; ++i)
+	{
+		if ((cnt += _counts[i]) >= rank) return _highest(i) < _max ? _highest(i) : _max;
+	}
+	return _max;
+}
+
+void LatencyReport::clear()
+{
+	for (LatencyHistogram &histogram : _histograms) histogram.clear();
+	memset(_counters, 0, sizeof(_counters));
+}
+
+void LatencyReport::merge(const LatencyReport &report)
+{
+	for (unsigned i = 0; i < LATENCY_OPERATION_CNT; ++i) _histograms[i].merge(report._histograms[i]);
+	for (unsigned i = 0; i < LATENCY_COUNTER_CNT; ++i) _counters[i] += report._counters[i];
+}
+
+void LatencyReport::print(std::ostream &os) const
+{
+	double ns = LatencyRecorder::nanosecondsPerTick();
+	os << "Operation,Count,Mean ns,p50 ns,p99 ns,p99.9 ns,max ns" << std::endl;
+	for (unsigned i = 0; i < LATENCY_OPERATION_CNT; ++i)
+	{
+		const LatencyHistogram &histogram = _histograms[i];
+		if (!histogram.count()) continue;
+		os << operationNames[i] << ',' << histogram.count() << ',' << histogram.mean() * ns << ',' << histogram.percentile(0.5) * ns << ','
+			<< histogram.percentile(0.99) * ns << ',' << histogram.percentile(0.999) * ns << ',' << histogram.max() * ns << std::endl;
+	}
+	for (unsigned i = 0; i < LATENCY_COUNTER_CNT; ++i) os << counterNames[i] << ',' << _counters[i] << std::endl;
+}
+
+LatencyRecorder *LatencyRecorder::_register()
+{
+	LatencyRecorder *recorder = new LatencyRecorder;
+	std::lock_guard<std::mutex> lock(recorderMutex);
+	recorders.push_back(recorder);
+	return recorder;
+}
+
+void LatencyRecorder::mergeAll(LatencyReport &report)
+{
+	std::lock_guard<std::mutex> lock(recorderMutex);
+	for (LatencyRecorder *recorder : recorders) report.merge(recorder->_report);
+}
+
+void LatencyRecorder::clearAll()
+{
+	std::lock_guard<std::mutex> lock(recorderMutex);
+	for (LatencyRecorder *recorder : recorders) recorder->clear();
+}
+
+double LatencyRecorder::nanosecondsPerTick()
+{
+	// one 10ms calibration, the tsc is invariant on anything recent enough to run this
+	static double nanoseconds = []()
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t startTicks = ticks();
+		std::chrono::steady_clock::time_point end;
+		while ((end = std::chrono::steady_clock::now()) - start < std::chrono::milliseconds(10));
+		uint64_t endTicks = ticks();
+		return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(endTicks - startTicks);
+	}();
+	return nanoseconds;
+}
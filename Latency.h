@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ostream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/*
+** Latency instrumentation
+** - compiled in by defining ORDER_BOOK_LATENCY, otherwise LATENCY_SCOPE and LATENCY_COUNT expand to nothing
+** - OrderBook entry points are timed with rdtsc, calibrated against the steady clock once per process
+** - each thread records into its own LatencyRecorder, plain stores with no locks or atomics on the hot path
+** - a thread dumps its own report at any time, mergeAll adds up every thread's once they are quiet
+*/
+
+enum LatencyOperation
+{
+	LATENCY_NEW_ORDER,
+	LATENCY_CANCEL,
+	LATENCY_REDUCE,
+	LATENCY_REPLACE,
+	LATENCY_LEVEL_EXECUTE,
+	LATENCY_MATCH,
+	LATENCY_OPERATION_CNT
+};
+
+enum LatencyCounter
+{
+	LATENCY_LEVELS_WALKED,
+	LATENCY_LEVELS_ALLOCATED,
+	LATENCY_LEVELS_FREED,
+	LATENCY_COUNTER_CNT
+};
+
+/*
+** LatencyHistogram
+** - log-linear buckets in ticks, exact below SUB_BUCKET_CNT and within 1 / SUB_BUCKET_CNT of the value above
+*/
+class LatencyHistogram
+{
+public:
+	enum { SUB_BUCKET_BITS = 5, SUB_BUCKET_CNT = 1 << SUB_BUCKET_BITS, BUCKET_CNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_CNT };
+protected:
+	uint64_t _counts[BUCKET_CNT];
+	uint64_t _count;
+	uint64_t _sum;
+	uint64_t _max;
+
+	static unsigned _bucket(uint64_t value)
+	{
+		if (value < SUB_BUCKET_CNT) return static_cast<unsigned>(value);
+#ifdef _MSC_VER
+		unsigned long msb;
+		_BitScanReverse64(&msb, value);
+#else
+		unsigned msb = 63 - __builtin_clzll(value);
+#endif
+		unsigned shift = static_cast<unsigned>(msb) - SUB_BUCKET_BITS;
+		return (shift + 1) * SUB_BUCKET_CNT + static_cast<unsigned>((value >> shift) & (SUB_BUCKET_CNT - 1));
+	}
+	// highest value that lands in bucket
+	static uint64_t _highest(unsigned bucket)
+	{
+		if (bucket < SUB_BUCKET_CNT) return bucket;
+		unsigned shift = bucket / SUB_BUCKET_CNT - 1;
+		return ((uint64_t(SUB_BUCKET_CNT + bucket % SUB_BUCKET_CNT) + 1) << shift) - 1;
+	}
+public:
+	LatencyHistogram() { clear(); }
+	void clear() { memset(this, 0, sizeof(*this)); }
+	void record(uint64_t value)
+	{
+		++_counts[_bucket(value)];
+		++_count;
+		_sum += value;
+		if (value > _max) _max = value;
+	}
+	void merge(const LatencyHistogram &histogram);
+
+	uint64_t count() const { return _count; }
+	uint64_t max() const { return _max; }
+	double mean() const { return _count ? static_cast<double>(_sum) / _count : 0; }
+	// smallest bucket bound with at least fraction of the values at or below it
+	uint64_t percentile(double fraction) const;
+};
+
+struct LatencyReport
+{
+	LatencyHistogram _histograms[LATENCY_OPERATION_CNT];
+	uint64_t _counters[LATENCY_COUNTER_CNT];
+
+	LatencyReport() { memset(_counters, 0, sizeof(_counters)); }
+	void clear();
+	void merge(const LatencyReport &report);
+	// csv in nanoseconds, one line per operation followed by the counters
+	void print(std::ostream &os) const;
+};
+
+class LatencyRecorder
+{
+protected:
+	LatencyReport _report;
+
+	static LatencyRecorder *_register();
+public:
+	// the calling thread's recorder, created and registered on first use and kept after the thread exits
+	static LatencyRecorder &local() { static thread_local LatencyRecorder *recorder = _register(); return *recorder; }
+	// every thread's report added to report, recording threads must be quiet, joined or synchronized with
+	static void mergeAll(LatencyReport &report);
+	static void clearAll();
+
+	static uint64_t ticks() { return __rdtsc(); }
+	static double nanosecondsPerTick();
+
+	void record(LatencyOperation operation, uint64_t ticks) { _report._histograms[operation].record(ticks); }
+	void count(LatencyCounter counter, uint64_t cnt) { _report._counters[counter] += cnt; }
+	void dump(LatencyReport &report) const { report = _report; }
+	void clear() { _report.clear(); }
+};
+
+class LatencyScope
+{
+protected:
+	LatencyOperation _operation;
+	uint64_t _start;
+public:
+	LatencyScope(LatencyOperation operation) : _operation(operation), _start(LatencyRecorder::ticks()) {}
+	~LatencyScope() { LatencyRecorder::local().record(_operation, LatencyRecorder::ticks() - _start); }
+private:
+	LatencyScope(const LatencyScope&) = delete;
+	LatencyScope& operator = (const LatencyScope&) = delete;
+};
+
+#ifdef ORDER_BOOK_LATENCY
+#define LATENCY_SCOPE(operation) LatencyScope latencyScope(operation)
+#define LATENCY_COUNT(counter, cnt) LatencyRecorder::local().count(counter, cnt)
+#else
+#define LATENCY_SCOPE(operation)
+#define LATENCY_COUNT(counter, cnt)
+#endif
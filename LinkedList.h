@@ -45,23 +45,42 @@ private:
 	LinkedList& operator = (const LinkedList &) = delete;
 };
 
+/*
+** SortedList
+** - hinted insert and bounded adjust search outward from a nearby item, O(distance)
+** - finger mode hints every insert with the previous insert
+*/
 template<typename T, typename L = std::less<T>>
 class SortedList
 {
 protected:
 	LinkedList _list;
 	L _less;
+	bool _fingerMode;
+	LinkedListObject *_finger;
+
+	inline void _insertFromFront(T *obj);
+	inline void _insertFromBack(T *obj);
+	inline void _insertNear(T *obj, T *hint);
+	inline T *_releaseFinger(T *obj) { if (obj == _finger) _finger = 0; return obj; }
 public:
-	SortedList(L &less = L()): _less(less) {}
+	SortedList(L &less = L()): _less(less), _fingerMode(false), _finger(0) {}
 	inline void adjust(T *obj);
+	// search at most maxDistance items from obj before searching from the end it is moving toward, 0 searches without a bound like adjust(obj)
+	inline void adjust(T *obj, size_t maxDistance);
 	inline void insert(T *obj);
+	// hint must be in the list, or null
+	inline void insert(T *obj, T *hint);
+	// items leave through remove or pop, an item unlinked directly may still be the finger
+	inline void remove(T *obj) { _releaseFinger(obj)->unlink(); }
+	void setFingerMode(bool fingerMode) { _fingerMode = fingerMode; _finger = 0; }
 	inline bool empty() { return _list.empty(); }
-	inline void clear() { _list.clear(); }
+	inline void clear() { _finger = 0; _list.clear(); }
 	inline T* begin() { return static_cast<T*>(_list.begin()); }
 	inline T* rbegin() { return static_cast<T*>(_list.rbegin()); }
 	inline T* end() { return static_cast<T*>(_list.end()); }
-	inline T* pop_front() { return static_cast<T*>(_list.pop_front()); }
-	inline T* pop_back() { return static_cast<T*>(_list.pop_back()); }
+	inline T* pop_front() { return _releaseFinger(static_cast<T*>(_list.pop_front())); }
+	inline T* pop_back() { return _releaseFinger(static_cast<T*>(_list.pop_back())); }
 	size_t size() { return _list.size(); }
 	bool check();
 };
@@ -77,7 +96,7 @@ void SortedList<T, L>::adjust(T *obj)
 		{
 			if (_less(*static_cast<T*>(prev), *obj)) break;
 		}
-		prev->link(obj);
+		prev->linkAfter(obj);
 	}
 	else if(next != _list.end() && _less(*static_cast<T*>(next), *obj))
 	{
@@ -91,7 +110,35 @@ void SortedList<T, L>::adjust(T *obj)
 }
 
 template<typename T, typename L>
-void SortedList<T, L>::insert(T *obj)
+void SortedList<T, L>::adjust(T *obj, size_t maxDistance)
+{
+	LinkedListObject *prev = obj->prev(), *next = obj->next();
+	if (prev != _list.end() && _less(*obj, *static_cast<T*>(prev)))
+	{
+		obj->unlink();
+		size_t distance(0);
+		for (prev = prev->prev(); prev != _list.end(); prev = prev->prev())
+		{
+			if (_less(*static_cast<T*>(prev), *obj)) break;
+			if (++distance == maxDistance) { _insertFromFront(obj); return; }
+		}
+		prev->linkAfter(obj);
+	}
+	else if (next != _list.end() && _less(*static_cast<T*>(next), *obj))
+	{
+		obj->unlink();
+		size_t distance(0);
+		for (next = next->next(); next != _list.end(); next = next->next())
+		{
+			if (_less(*obj, *static_cast<T*>(next))) break;
+			if (++distance == maxDistance) { _insertFromBack(obj); return; }
+		}
+		next->linkBefore(obj);
+	}
+}
+
+template<typename T, typename L>
+void SortedList<T, L>::_insertFromFront(T *obj)
 {
 	LinkedListObject *next = _list.begin();
 	for (; next != _list.end(); next = next->next())
@@ -101,6 +148,76 @@ void SortedList<T, L>::insert(T *obj)
 	next->linkBefore(obj);
 }
 
+template<typename T, typename L>
+void SortedList<T, L>::_insertFromBack(T *obj)
+{
+	LinkedListObject *prev = _list.rbegin();
+	for (; prev != _list.end(); prev = prev->prev())
+	{
+		if (!_less(*obj, *static_cast<T*>(prev))) break;
+	}
+	prev->linkAfter(obj);
+}
+
+template<typename T, typename L>
+void SortedList<T, L>::_insertNear(T *obj, T *hint)
+{
+	// hint is missing or no longer linked
+	if (!hint || hint->next() == hint)
+	{
+		_insertFromFront(obj);
+		return;
+	}
+
+	if (_less(*obj, *hint))
+	{
+		if (_less(*obj, *begin()))
+		{
+			_list.push_front(obj);
+			return;
+		}
+		LinkedListObject *prev = hint->prev();
+		for (; prev != _list.end(); prev = prev->prev())
+		{
+			if (!_less(*obj, *static_cast<T*>(prev))) break;
+		}
+		prev->linkAfter(obj);
+	}
+	else
+	{
+		if (!_less(*obj, *rbegin()))
+		{
+			_list.push_back(obj);
+			return;
+		}
+		LinkedListObject *next = hint->next();
+		for (; next != _list.end(); next = next->next())
+		{
+			if (_less(*obj, *static_cast<T*>(next))) break;
+		}
+		next->linkBefore(obj);
+	}
+}
+
+template<typename T, typename L>
+void SortedList<T, L>::insert(T *obj)
+{
+	if (_fingerMode)
+	{
+		_insertNear(obj, static_cast<T*>(_finger));
+		_finger = obj;
+	}
+	else
+		_insertFromFront(obj);
+}
+
+template<typename T, typename L>
+void SortedList<T, L>::insert(T *obj, T *hint)
+{
+	_insertNear(obj, hint);
+	if (_fingerMode) _finger = obj;
+}
+
 template<typename T, typename L>
 bool SortedList<T, L>::check()
 {
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Matching
+** - order types and results for OrderBook::match, the price-time matching mode for simulated orders
+** - fills and self trade cancels are written to a MatchRing, which is preallocated so matching never allocates
+*/
+
+enum OrderType
+{
+	ORDER_LIMIT,      // match, then rest the remainder
+	ORDER_IOC,        // match, then cancel the remainder
+	ORDER_FOK,        // match completely or not at all
+	ORDER_MARKET,     // IOC at any price
+	ORDER_POST_ONLY   // rest, rejected if it would match
+};
+
+enum MatchResult
+{
+	MATCH_FILLED,
+	MATCH_RESTING,    // possibly after partial fills
+	MATCH_CANCELLED,  // remainder cancelled, possibly after partial fills
+	MATCH_REJECTED    // FOK that could not fill or post only that would match, nothing happened
+};
+
+enum SelfTradePrevention
+{
+	STP_NONE,
+	STP_CANCEL_RESTING,    // cancel the resting order and keep matching
+	STP_CANCEL_AGGRESSOR   // stop matching and cancel the incoming remainder
+};
+
+struct MatchReport
+{
+	enum : uint8_t { FILL, SELF_TRADE_CANCEL };
+	uint64_t _aggressorId;
+	uint64_t _restingId;
+	unsigned _price;
+	// filled shares, or the resting shares cancelled by self trade prevention
+	unsigned _shares;
+	unsigned _aggressorLeaves;
+	unsigned _restingLeaves;
+	uint8_t _side;
+	uint8_t _type;
+};
+
+/*
+** MatchRing
+** - single threaded ring of MatchReports, capacity rounded up to a power of 2
+** - a writer a full ring ahead of the reader overwrites the oldest reports and counts them in overrunCnt()
+*/
+class MatchRing
+{
+protected:
+	MatchReport *_reports;
+	size_t _mask;
+	uint64_t _head;
+	uint64_t _tail;
+	uint64_t _overrunCnt;
+public:
+	MatchRing(size_t capacity) : _head(0), _tail(0), _overrunCnt(0)
+	{
+		size_t size(2);
+		for (; size < capacity; size <<= 1);
+		_reports = new MatchReport[size];
+		_mask = size - 1;
+	}
+	void push(const MatchReport &report)
+	{
+		if (_tail - _head > _mask) { ++_head; ++_overrunCnt; }
+		_reports[_tail++ & _mask] = report;
+	}
+	bool pop(MatchReport &report)
+	{
+		if (_head == _tail) return false;
+		report = _reports[_head++ & _mask];
+		return true;
+	}
+	bool empty() const { return _head == _tail; }
+	size_t size() const { return static_cast<size_t>(_tail - _head); }
+	void clear() { _head = _tail; }
+	uint64_t overrunCnt() const { return _overrunCnt; }
+
+	~MatchRing() { delete[] _reports; }
+private:
+	MatchRing(const MatchRing&) = delete;
+	MatchRing& operator = (const MatchRing&) = delete;
+};
@@ -0,0 +1,295 @@
+#include "Exchange.h"
+#include "Matching.h"
+#include "OrderBook.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#define ORDER_CNT 200000
+#define TRIAL_CNT 6
+#define MID_PRICE 1000
+#define PRICE_RANGE 20
+#define OWNER_CNT 4
+#define DEPTH_LEVELS 16
+#define BENCHMARK_ORDER_CNT 4000000
+
+// straightforward price-time book to check OrderBook::match against
+struct ReferenceBook
+{
+	struct RestingOrder
+	{
+		uint64_t orderId;
+		unsigned shares;
+		unsigned owner;
+	};
+	typedef std::map<unsigned, std::deque<RestingOrder>> Levels;
+	Levels levels[2];
+	SelfTradePrevention selfTradePrevention;
+
+	ReferenceBook() : selfTradePrevention(STP_NONE) {}
+
+	bool crosses(int side, unsigned levelPrice, unsigned price, OrderType type)
+	{
+		return type == ORDER_MARKET || (side ? levelPrice >= price : levelPrice <= price);
+	}
+	Levels::iterator best(int side)
+	{
+		return side ? levels[side].begin() : --levels[side].end();
+	}
+
+	MatchResult match(int side, unsigned price, uint64_t orderId, unsigned shares, unsigned owner, OrderType type, std::vector<MatchReport> &reports)
+	{
+		int otherSide = (side + 1) & 1;
+		if (type == ORDER_FOK)
+		{
+			// try it on a copy
+			ReferenceBook copy(*this);
+			std::vector<MatchReport> scratch;
+			if (copy.match(side, price, orderId, shares, owner, ORDER_IOC, scratch) != MATCH_FILLED) return MATCH_REJECTED;
+		}
+		bool crossed = !levels[otherSide].empty() && crosses(side, best(otherSide)->first, price, type);
+		if (!crossed)
+		{
+			if (type == ORDER_IOC || type == ORDER_MARKET) return MATCH_CANCELLED;
+			levels[side][price].push_back(RestingOrder{orderId, shares, owner});
+			return MATCH_RESTING;
+		}
+		if (type == ORDER_POST_ONLY) return MATCH_REJECTED;
+
+		bool selfTrade(false);
+		while (shares && !selfTrade && !levels[otherSide].empty())
+		{
+			Levels::iterator level = best(otherSide);
+			if (!crosses(side, level->first, price, type)) break;
+			RestingOrder &resting = level->second.front();
+			MatchReport report = {orderId, resting.orderId, level->first, 0, 0, 0, static_cast<uint8_t>(side), MatchReport::FILL};
+			if (selfTradePrevention != STP_NONE && owner && resting.owner == owner)
+			{
+				if (selfTradePrevention == STP_CANCEL_AGGRESSOR)
+				{
+					selfTrade = true;
+					break;
+				}
+				report._type = MatchReport::SELF_TRADE_CANCEL;
+				report._shares = resting.shares;
+				report._aggressorLeaves = shares;
+				resting.shares = 0;
+			}
+			else
+			{
+				unsigned fill = shares < resting.shares ? shares : resting.shares;
+				shares -= fill;
+				resting.shares -= fill;
+				report._shares = fill;
+				report._aggressorLeaves = shares;
+				report._restingLeaves = resting.shares;
+			}
+			reports.push_back(report);
+			if (!resting.shares)
+			{
+				level->second.pop_front();
+				if (level->second.empty()) levels[otherSide].erase(level);
+			}
+		}
+		if (!shares) return MATCH_FILLED;
+		if (type != ORDER_LIMIT || selfTrade) return MATCH_CANCELLED;
+		levels[side][price].push_back(RestingOrder{orderId, shares, owner});
+		return MATCH_RESTING;
+	}
+
+	void cancel(int side, unsigned price, uint64_t orderId)
+	{
+		std::deque<RestingOrder> &level = levels[side][price];
+		for (std::deque<RestingOrder>::iterator itr = level.begin(); itr != level.end(); ++itr)
+		{
+			if (itr->orderId == orderId)
+			{
+				level.erase(itr);
+				break;
+			}
+		}
+		if (level.empty()) levels[side].erase(price);
+	}
+
+	bool matches(const DepthSnapshot &snapshot)
+	{
+		for (int side = 0; side < 2; ++side)
+		{
+			unsigned cnt(0);
+			for (Levels::iterator level = levels[side].empty() ? levels[side].end() : best(side); cnt < DEPTH_LEVELS && level != levels[side].end(); ++cnt)
+			{
+				unsigned shares(0);
+				for (const RestingOrder &order : level->second) shares += order.shares;
+				if (cnt >= snapshot._levelCnt[side] || snapshot._prices[side][cnt] != level->first ||
+					snapshot._shares[side][cnt] != shares || snapshot._orderCnts[side][cnt] != level->second.size()) return false;
+				if (side) ++level;
+				else if (level == levels[side].begin()) level = levels[side].end();
+				else --level;
+			}
+			if (cnt != snapshot._levelCnt[side]) return false;
+		}
+		return true;
+	}
+};
+
+struct RandomOrder
+{
+	int side;
+	unsigned price;
+	unsigned shares;
+	unsigned owner;
+	OrderType type;
+};
+
+RandomOrder randomOrder(std::mt19937_64 &generator)
+{
+	static const OrderType types[20] = {
+		ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT, ORDER_LIMIT,
+		ORDER_IOC, ORDER_IOC, ORDER_IOC, ORDER_FOK, ORDER_FOK, ORDER_MARKET, ORDER_POST_ONLY, ORDER_POST_ONLY, ORDER_POST_ONLY, ORDER_POST_ONLY};
+	RandomOrder order;
+	order.side = generator() & 1;
+	// each side leans towards its own half so the book crosses often but not always
+	unsigned offset = static_cast<unsigned>(generator() % PRICE_RANGE);
+	order.price = order.side ? MID_PRICE - PRICE_RANGE / 4 + offset : MID_PRICE + PRICE_RANGE / 4 - offset;
+	order.shares = 1 + static_cast<unsigned>(generator() % 10) * (generator() % 4 ? 1 : 10);
+	order.owner = static_cast<unsigned>(generator() % (OWNER_CNT + 1));
+	order.type = types[generator() % 20];
+	return order;
+}
+
+// random orders and cancels through OrderBook::match and the reference, comparing reports, results and depth
+bool differentialTest(SelfTradePrevention selfTradePrevention, uint64_t seed)
+{
+	std::mt19937_64 generator(seed);
+	Exchange exchange;
+	exchange.reserve(4 * PRICE_RANGE, ORDER_CNT);
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "MATCH");
+	orderBook.initializeDepth(DEPTH_LEVELS);
+	orderBook.setSelfTradePrevention(selfTradePrevention);
+	ReferenceBook reference;
+	reference.selfTradePrevention = selfTradePrevention;
+
+	MatchRing matchRing(1 << 12);
+	std::vector<MatchReport> expected;
+	std::vector<BookOrder> orders(ORDER_CNT + 1);
+	std::vector<RandomOrder> randomOrders(ORDER_CNT + 1);
+	std::vector<uint64_t> live;
+	DepthSnapshot snapshot;
+	timespec ts = {0, 0};
+	for (uint64_t orderId = 1; orderId <= ORDER_CNT; ++orderId)
+	{
+		if (live.size() > 8 && generator() % 4 == 0)
+		{
+			size_t index = generator() % live.size();
+			uint64_t cancelId = live[index];
+			live[index] = live.back();
+			live.pop_back();
+			// filled or self trade cancelled since it rested
+			if (orders[cancelId]._priceLevel)
+			{
+				orderBook.cancelRequest(randomOrders[cancelId].side, &orders[cancelId]);
+				reference.cancel(randomOrders[cancelId].side, randomOrders[cancelId].price, cancelId);
+			}
+		}
+
+		RandomOrder &order = randomOrders[orderId] = randomOrder(generator);
+		BookOrder *bookOrder = &orders[orderId];
+		bookOrder->initialize(orderId, order.shares, ts);
+		bookOrder->_owner = order.owner;
+		MatchResult result = orderBook.match(order.side, order.price, bookOrder, order.type, matchRing);
+		bool releasedResting(true);
+		auto onReleased = [&releasedResting](BookOrder *released) { if (released->_priceLevel) releasedResting = false; };
+		exchange.releaseOrders(onReleased);
+		expected.clear();
+		MatchResult expectedResult = reference.match(order.side, order.price, orderId, order.shares, order.owner, order.type, expected);
+		if (result == MATCH_RESTING) live.push_back(orderId);
+
+		bool reportsMatch = matchRing.size() == expected.size();
+		MatchReport report;
+		for (size_t i = 0; matchRing.pop(report); ++i)
+		{
+			if (!reportsMatch) continue;
+			const MatchReport &r = expected[i];
+			reportsMatch = report._aggressorId == r._aggressorId && report._restingId == r._restingId && report._price == r._price && report._shares == r._shares &&
+				report._aggressorLeaves == r._aggressorLeaves && report._restingLeaves == r._restingLeaves && report._side == r._side && report._type == r._type;
+		}
+		orderBook.copyDepth(snapshot);
+		if (result != expectedResult || !reportsMatch || !reference.matches(snapshot) || !releasedResting)
+		{
+			printf("ERROR: stp %d order %llu type %d result %d expected %d reports %s depth %s released %s\n", selfTradePrevention, (unsigned long long)orderId, order.type,
+				result, expectedResult, reportsMatch ? "match" : "differ", reference.matches(snapshot) ? "match" : "differ", releasedResting ? "ok" : "resting");
+			return false;
+		}
+	}
+	return true;
+}
+
+// runs the flow through a fresh book on the exchange, aggressors and the resting orders they take out go back to the pool
+// - peakOrderCnt is the most pooled orders out at once, the resting depth plus the order being matched
+size_t matchFlow(Exchange &exchange, const std::vector<RandomOrder> &flow, MatchRing &matchRing, size_t &peakOrderCnt)
+{
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "BENCH");
+	orderBook.initializeLadder(1, 4 * PRICE_RANGE);
+	orderBook.setSelfTradePrevention(STP_CANCEL_RESTING);
+
+	timespec ts = {0, 0};
+	size_t reportCnt(0), orderCnt(0);
+	peakOrderCnt = 0;
+	MatchReport report;
+	auto freeOrder = [&exchange, &orderCnt](BookOrder *released) { exchange.freeBookOrder(released); --orderCnt; };
+	for (size_t i = 0; i < flow.size(); ++i)
+	{
+		const RandomOrder &order = flow[i];
+		BookOrder *bookOrder = exchange.allocateBookOrder();
+		if (++orderCnt > peakOrderCnt) peakOrderCnt = orderCnt;
+		bookOrder->initialize(i + 1, order.shares, ts);
+		bookOrder->_owner = order.owner;
+		if (orderBook.match(order.side, order.price, bookOrder, order.type, matchRing) != MATCH_RESTING) freeOrder(bookOrder);
+		exchange.releaseOrders(freeOrder);
+		while (matchRing.pop(report)) ++reportCnt;
+	}
+	return reportCnt;
+}
+
+int main(int argc, const char *argv[])
+{
+	for (size_t t(0); t < TRIAL_CNT; ++t)
+	{
+		if (!differentialTest(static_cast<SelfTradePrevention>(t % 3), t + 1)) return 1;
+	}
+	std::cout << "Differential,orders," << TRIAL_CNT * ORDER_CNT << ",ok" << std::endl;
+
+	// throughput with the same flow, the live depth is reserved up front so the run never allocates
+	std::mt19937_64 generator(1);
+	std::vector<RandomOrder> flow(BENCHMARK_ORDER_CNT);
+	for (RandomOrder &order : flow) order = randomOrder(generator);
+
+	// an untimed pass finds the live depth, the timed pass reserves just that
+	MatchRing matchRing(1 << 12);
+	size_t peakOrderCnt;
+	{
+		Exchange exchange;
+		matchFlow(exchange, flow, matchRing, peakOrderCnt);
+	}
+	Exchange exchange;
+	exchange.reserve(4 * PRICE_RANGE, peakOrderCnt);
+	exchange.setSteadyState(true);
+	size_t timedPeakCnt;
+	auto start = std::chrono::steady_clock::now();
+	size_t reportCnt = matchFlow(exchange, flow, matchRing, timedPeakCnt);
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	std::cout << "Matching,orders/sec," << flow.size() / duration.count() << ",reports," << reportCnt << ",live orders," << peakOrderCnt << std::endl;
+	if (exchange.steadyStateAllocations() || matchRing.overrunCnt())
+		printf("ERROR: %zu steady state allocations %llu ring overruns\n", exchange.steadyStateAllocations(), (unsigned long long)matchRing.overrunCnt());
+
+	return 0;
+}
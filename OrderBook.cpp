@@ -1,18 +1,12 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "OrderBook.h"
+#include "Exchange.h"
+#include "Latency.h"
 
 #include <stdio.h>
 #include <string.h>
 
-class Exchange
-{
-public:
-	void execute(int side, unsigned price, unsigned shares, BookOrder *order) {}
-	PriceLevel *allocatePriceLevel() { return new PriceLevel; }
-	void freePriceLevel(PriceLevel *priceLevel) { delete priceLevel; }
-};
-
 namespace
 {
 	bool higher(unsigned l, unsigned r) { return l > r; }
@@ -25,12 +19,23 @@ void OrderBook::execute(int side, unsigned price, unsigned shares, BookOrder *or
 	_exchange->execute(side, price, shares, order);
 }
 
+inline
+void OrderBook::_topOfBookChanged()
+{
+	if (_topOfBookFlag) return;
+	_topOfBookFlag = true;
+	_exchange->markTopOfBook(this);
+}
+
 bool PriceLevel::execute(int side, BookOrder * order)
 {
+	LATENCY_SCOPE(LATENCY_LEVEL_EXECUTE);
 	// execute if the quote crosses a simulated order
 	// if the quote is crossed use newer data
 	bool filled(false);
 	int levelSide = (side + 1) & 1;
+	// only the best level of a side is ever executed against
+	if (_orders.begin() != _orders.end()) _orderBook->_topOfBookChanged();
 	for (Intrusive::LinkedListObject *obj = _orders.begin(); ! filled && obj != _orders.end(); obj = _orders.begin())
 	{
 		BookOrder *levelOrder = static_cast<BookOrder*>(obj);
@@ -41,7 +46,8 @@ bool PriceLevel::execute(int side, BookOrder * order)
 				if (order->_shares < levelOrder->_shares)
 				{
 					filled = true;
-					_shares -= order->_shares;
+					// the quote is consumed from the front of the queue
+					reduceBookOrder(levelOrder, order->_shares);
 					_orderBook->execute(side, _price, order->_shares, order);
 					_orderBook->execute(levelSide, _price, order->_shares, levelOrder);
 					break;
@@ -61,10 +67,55 @@ bool PriceLevel::execute(int side, BookOrder * order)
 		}
 		removeBookOrder(levelOrder);
 		_orderBook->execute(levelSide, _price, levelOrder->_shares, levelOrder);
+		_orderBook->_exchange->releaseOrder(levelOrder);
 	}
 	return filled;
 }
 
+bool PriceLevel::match(int side, BookOrder *order, MatchRing &matchRing, SelfTradePrevention selfTradePrevention)
+{
+	int levelSide = (side + 1) & 1;
+	for (Intrusive::LinkedListObject *obj = _orders.begin(); order->_shares && obj != _orders.end(); obj = _orders.begin())
+	{
+		BookOrder *levelOrder = static_cast<BookOrder*>(obj);
+		if (selfTradePrevention != STP_NONE && order->_owner && levelOrder->_owner == order->_owner)
+		{
+			if (selfTradePrevention == STP_CANCEL_AGGRESSOR) return true;
+			MatchReport report = {order->_orderId, levelOrder->_orderId, _price, levelOrder->_shares, order->_shares, 0, static_cast<uint8_t>(side), MatchReport::SELF_TRADE_CANCEL};
+			matchRing.push(report);
+			removeBookOrder(levelOrder);
+			_orderBook->_exchange->releaseOrder(levelOrder);
+			continue;
+		}
+
+		unsigned shares = order->_shares < levelOrder->_shares ? order->_shares : levelOrder->_shares;
+		reduceBookOrder(levelOrder, shares);
+		order->_shares -= shares;
+		MatchReport report = {order->_orderId, levelOrder->_orderId, _price, shares, order->_shares, levelOrder->_shares, static_cast<uint8_t>(side), MatchReport::FILL};
+		matchRing.push(report);
+		if (!levelOrder->_shares) removeBookOrder(levelOrder);
+		_orderBook->execute(levelSide, _price, shares, levelOrder);
+		_orderBook->execute(side, _price, shares, order);
+		if (!levelOrder->_shares) _orderBook->_exchange->releaseOrder(levelOrder);
+	}
+	return false;
+}
+
+void PriceLevel::trackQueuePosition(BookOrder *order, QueuePosition *queuePosition)
+{
+	if (queuePosition->tracking()) queuePosition->untrack();
+	queuePosition->_order = order;
+	if (static_cast<Intrusive::LinkedListObject*>(order) == _orders.rbegin()) queuePosition->_sharesAhead = _shares - order->_shares;
+	else
+	{
+		queuePosition->_sharesAhead = 0;
+		for (Intrusive::LinkedListObject *obj = _orders.begin(); obj != static_cast<Intrusive::LinkedListObject*>(order); obj = obj->next())
+			queuePosition->_sharesAhead += static_cast<BookOrder*>(obj)->_shares;
+	}
+	_queuePositions.push_back(queuePosition);
+	++_trackedCnt;
+}
+
 void OrderBook::initialize(Exchange * exchange, const char * symbol)
 {
 	_exchange = exchange;
@@ -72,10 +123,231 @@ void OrderBook::initialize(Exchange * exchange, const char * symbol)
 	_tradingMask = 0;
 	_price[0] = 0;
 	_price[1] = -1;
+	_topOfBookFlag = false;
+}
+
+int OrderBook::initializeLadder(unsigned tickSize, unsigned windowSize)
+{
+	if (_ladder.initialize(tickSize, windowSize)) return -1;
+	_reindexLadder(_price[0] ? _price[0] : _price[1] == (unsigned)-1 ? 0 : _price[1]);
+	return 0;
+}
+
+int OrderBook::initializeDepth(unsigned levels)
+{
+	if (!levels || levels > DepthSnapshot::MAX_LEVELS) return -1;
+	if (_depthCache) delete _depthCache;
+	_depthCache = new DepthCache(levels);
+	for (int side = 0; side < 2; ++side)
+	{
+		Intrusive::LinkedList &levelList = _priceLevels[side];
+		unsigned cnt(0);
+		for (Intrusive::LinkedListObject *obj = levelList.begin(); cnt < levels && obj != levelList.end(); obj = obj->next(), ++cnt)
+		{
+			PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+			_depthCache->append(side, priceLevel->_price, priceLevel->_shares, priceLevel->_orderCnt, priceLevel);
+		}
+	}
+	return 0;
+}
+
+inline
+void OrderBook::_depthChanged(int side, PriceLevel *priceLevel)
+{
+	// a level outside the cache only changes it by moving into range, which insert checks
+	_depthCache->beginWrite();
+	int index = _depthCache->find(side, priceLevel->_price);
+	if (index != DepthCache::NOT_CACHED) _depthCache->update(side, index, priceLevel->_shares, priceLevel->_orderCnt);
+	else _depthCache->insert(side, priceLevel->_price, priceLevel->_shares, priceLevel->_orderCnt, priceLevel);
+	_depthCache->endWrite();
+}
+
+void OrderBook::_depthRemoved(int side, PriceLevel *priceLevel)
+{
+	int index = _depthCache->find(side, priceLevel->_price);
+	if (index == DepthCache::NOT_CACHED) return;
+	_depthCache->beginWrite();
+	bool wasFull;
+	PriceLevel *last = _depthCache->erase(side, index, wasFull);
+	if (wasFull)
+	{
+		// the level has been unlinked, so the next level after the cached ones follows the new last
+		Intrusive::LinkedList &levelList = _priceLevels[side];
+		Intrusive::LinkedListObject *obj = last ? static_cast<Intrusive::LinkedListObject*>(last)->next() : levelList.begin();
+		if (obj != levelList.end())
+		{
+			PriceLevel *next = static_cast<PriceLevel*>(obj);
+			_depthCache->append(side, next->_price, next->_shares, next->_orderCnt, next);
+		}
+	}
+	_depthCache->endWrite();
+}
+
+void OrderBook::setLevelCache(bool levelCacheFlag)
+{
+	_levelCacheFlag = levelCacheFlag;
+	if (levelCacheFlag) return;
+	for (int side = 0; side < 2; ++side)
+	{
+		for (PriceLevel **itr = _levelCache[side], **end = itr + LEVEL_CACHE_SIZE; itr < end; ++itr)
+		{
+			if (*itr) _exchange->freePriceLevel(*itr);
+			*itr = 0;
+		}
+	}
+}
+
+inline
+PriceLevel *OrderBook::_newPriceLevel(int side, unsigned price)
+{
+	LATENCY_COUNT(LATENCY_LEVELS_ALLOCATED, 1);
+	if (_levelCacheFlag)
+	{
+		PriceLevel *&cached = _levelCache[side][_levelCacheSlot(price)];
+		if (cached && cached->_price == price)
+		{
+			PriceLevel *priceLevel = cached;
+			cached = 0;
+			return priceLevel;
+		}
+	}
+	PriceLevel *priceLevel = _exchange->allocatePriceLevel();
+	priceLevel->initialize(this, price);
+	return priceLevel;
+}
+
+PriceLevel *OrderBook::_walkPriceLevels(int side, unsigned price, bool fromBack)
+{
+	bool(*inside) (unsigned, unsigned) = side ? lower : higher;
+	Intrusive::LinkedList &levelList = _priceLevels[side];
+	Intrusive::LinkedListObject *obj;
+	if (fromBack)
+	{
+		// stop at the first level that is not worse than price
+		for (obj = levelList.rbegin(); obj != levelList.end(); obj = obj->prev())
+		{
+			LATENCY_COUNT(LATENCY_LEVELS_WALKED, 1);
+			PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+			if (!inside(price, priceLevel->_price))
+			{
+				if (priceLevel->_price == price) return priceLevel;
+				break;
+			}
+		}
+		PriceLevel *priceLevel = _newPriceLevel(side, price);
+		obj->linkAfter(priceLevel);
+		return priceLevel;
+	}
+
+	// stop at the first level that is not better than price
+	for (obj = levelList.begin(); obj != levelList.end(); obj = obj->next())
+	{
+		LATENCY_COUNT(LATENCY_LEVELS_WALKED, 1);
+		PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+		if (!inside(priceLevel->_price, price))
+		{
+			if (priceLevel->_price == price) return priceLevel;
+			break;
+		}
+	}
+	PriceLevel *priceLevel = _newPriceLevel(side, price);
+	obj->linkBefore(priceLevel);
+	return priceLevel;
+}
+
+bool OrderBook::_recentreLadder(unsigned price)
+{
+	// recentre when the mid, or price for a one sided book, leaves the middle half of the window
+	unsigned mid = _price[0] && _price[1] != (unsigned)-1 ? _price[0] + (_price[1] - _price[0]) / 2 : price;
+	unsigned quarterWindow = _ladder.windowSize() / 4 * _ladder.tickSize();
+	if (mid >= _ladder.basePrice() + quarterWindow && mid < _ladder.basePrice() + 3 * quarterWindow) return false;
+	_reindexLadder(mid);
+	return true;
+}
+
+void OrderBook::_reindexLadder(unsigned mid)
+{
+	_ladder.recentre(mid);
+	for (int side = 0; side < 2; ++side)
+	{
+		Intrusive::LinkedList &levelList = _priceLevels[side];
+		for (Intrusive::LinkedListObject *obj = levelList.begin(); obj != levelList.end(); obj = obj->next())
+		{
+			PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+			unsigned slot = _ladder.slot(priceLevel->_price);
+			if (slot != PriceLadder::NO_SLOT) _ladder.add(side, slot, priceLevel);
+		}
+	}
+}
+
+PriceLevel *OrderBook::_findPriceLevel(int side, unsigned price)
+{
+	if (!_ladder.enabled()) return _walkPriceLevels(side, price, false);
+
+	unsigned slot = _ladder.slot(price);
+	if (slot == PriceLadder::NO_SLOT && _recentreLadder(price)) slot = _ladder.slot(price);
+	if (slot == PriceLadder::NO_SLOT)
+	{
+		// outside the window, walk from the end of the list nearest price
+		bool fromBack = side ? price >= _ladder.basePrice() : price < _ladder.basePrice();
+		return _walkPriceLevels(side, price, fromBack);
+	}
+
+	PriceLevel *priceLevel = _ladder.level(side, slot);
+	if (priceLevel) return priceLevel;
+
+	// link next to the nearest level in the window, bids are ordered high to low, asks low to high
+	// - off tick levels are not indexed, so step over any between the neighbour and price
+	bool(*inside) (unsigned, unsigned) = side ? lower : higher;
+	Intrusive::LinkedList &levelList = _priceLevels[side];
+	unsigned above = _ladder.above(side, slot), below = _ladder.below(side, slot);
+	unsigned better = side ? below : above, worse = side ? above : below;
+	if (better != PriceLadder::NO_SLOT)
+	{
+		Intrusive::LinkedListObject *obj = _ladder.level(side, better);
+		for (obj = obj->next(); obj != levelList.end() && inside(static_cast<PriceLevel*>(obj)->_price, price); obj = obj->next()) LATENCY_COUNT(LATENCY_LEVELS_WALKED, 1);
+		priceLevel = _newPriceLevel(side, price);
+		obj->linkBefore(priceLevel);
+	}
+	else if (worse != PriceLadder::NO_SLOT)
+	{
+		Intrusive::LinkedListObject *obj = _ladder.level(side, worse);
+		for (obj = obj->prev(); obj != levelList.end() && inside(price, static_cast<PriceLevel*>(obj)->_price); obj = obj->prev()) LATENCY_COUNT(LATENCY_LEVELS_WALKED, 1);
+		priceLevel = _newPriceLevel(side, price);
+		obj->linkAfter(priceLevel);
+	}
+	else
+	{
+		// no level on this side in the window, any others are beyond it
+		priceLevel = _walkPriceLevels(side, price, false);
+	}
+	_ladder.add(side, slot, priceLevel);
+	return priceLevel;
+}
+
+void OrderBook::_freePriceLevel(int side, PriceLevel *priceLevel)
+{
+	LATENCY_COUNT(LATENCY_LEVELS_FREED, 1);
+	priceLevel->unlink();
+	if (_depthCache) _depthRemoved(side, priceLevel);
+	if (_ladder.enabled())
+	{
+		unsigned slot = _ladder.slot(priceLevel->_price);
+		if (slot != PriceLadder::NO_SLOT) _ladder.remove(side, slot);
+	}
+	if (_levelCacheFlag)
+	{
+		PriceLevel *&cached = _levelCache[side][_levelCacheSlot(priceLevel->_price)];
+		if (cached) _exchange->freePriceLevel(cached);
+		cached = priceLevel;
+		return;
+	}
+	_exchange->freePriceLevel(priceLevel);
 }
 
 bool OrderBook::newOrder(int side, unsigned price, BookOrder *order)
 {
+	LATENCY_SCOPE(LATENCY_NEW_ORDER);
 	bool(*inside) (unsigned, unsigned) = side ? lower : higher;
 
 	if (! _tradingMask)
@@ -91,9 +363,12 @@ bool OrderBook::newOrder(int side, unsigned price, BookOrder *order)
 				PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
 				if (inside(priceLevel->_price, price)) break;
 				filled = priceLevel->execute(side, order);
-				if (priceLevel->_orderCnt) break;
-				priceLevel->unlink();
-				_exchange->freePriceLevel(priceLevel);
+				if (priceLevel->_orderCnt)
+				{
+					if (_depthCache) _depthChanged(otherSide, priceLevel);
+					break;
+				}
+				_freePriceLevel(otherSide, priceLevel);
 			}
 			Intrusive::LinkedListObject *obj = levelList.begin();
 			if (obj != levelList.end()) _price[otherSide] = static_cast<PriceLevel*>(obj)->_price;
@@ -102,67 +377,137 @@ bool OrderBook::newOrder(int side, unsigned price, BookOrder *order)
 		}
 	}
 
+	_restOrder(side, price, order);
+	return false;
+}
+
+void OrderBook::_restOrder(int side, unsigned price, BookOrder *order)
+{
 	// find price level
-	PriceLevel *priceLevel(0);
-	Intrusive::LinkedList &levelList = _priceLevels[side];
-	Intrusive::LinkedListObject *obj = levelList.begin();
-	for (; obj != levelList.end(); obj = obj->next())
+	PriceLevel *priceLevel = _findPriceLevel(side, price);
+	order->_side = side;
+	priceLevel->addBookOrder(order);
+	if (_depthCache) _depthChanged(side, priceLevel);
+
+	if (priceLevel == _priceLevels[side].begin())
 	{
-		priceLevel = static_cast<PriceLevel*>(obj);
-		if (!inside(priceLevel->_price, price))
+		_price[side] = priceLevel->_price;
+		_topOfBookChanged();
+	}
+}
+
+unsigned OrderBook::_available(int side, unsigned price, BookOrder *order)
+{
+	// shares order could fill, stopping once enough are found
+	bool(*inside) (unsigned, unsigned) = side ? lower : higher;
+	Intrusive::LinkedList &levelList = _priceLevels[(side + 1) & 1];
+	bool selfTradeCheck = _selfTradePrevention != STP_NONE && order->_owner;
+	unsigned available(0);
+	for (Intrusive::LinkedListObject *obj = levelList.begin(); available < order->_shares && obj != levelList.end(); obj = obj->next())
+	{
+		PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+		if (inside(priceLevel->_price, price)) break;
+		if (!selfTradeCheck)
 		{
-			if (priceLevel->_price == price)
-			{
-				priceLevel->addBookOrder(order);
-				obj = 0;
-			}
-			break;
+			available += priceLevel->_shares;
+			continue;
+		}
+		for (Intrusive::LinkedListObject *orderObj = priceLevel->_orders.begin(); available < order->_shares && orderObj != priceLevel->_orders.end(); orderObj = orderObj->next())
+		{
+			BookOrder *levelOrder = static_cast<BookOrder*>(orderObj);
+			if (levelOrder->_owner != order->_owner) available += levelOrder->_shares;
+			else if (_selfTradePrevention == STP_CANCEL_AGGRESSOR) return available;
 		}
 	}
-	if (obj)
+	return available;
+}
+
+MatchResult OrderBook::match(int side, unsigned price, BookOrder *order, OrderType type, MatchRing &matchRing)
+{
+	LATENCY_SCOPE(LATENCY_MATCH);
+	bool(*inside) (unsigned, unsigned) = side ? lower : higher;
+	int otherSide = (side + 1) & 1;
+	if (type == ORDER_MARKET) price = side ? 0 : (unsigned)-1;
+	order->_side = side;
+
+	if (_tradingMask || inside(_price[otherSide], price) || _priceLevels[otherSide].empty())
 	{
-		priceLevel = _exchange->allocatePriceLevel();
-		priceLevel->initialize(this, price);
-		priceLevel->addBookOrder(order);
-		obj->linkBefore(priceLevel);
+		if (type == ORDER_FOK) return MATCH_REJECTED;
+		if (type != ORDER_LIMIT && type != ORDER_POST_ONLY) return MATCH_CANCELLED;
+		_restOrder(side, price, order);
+		return MATCH_RESTING;
 	}
+	if (type == ORDER_POST_ONLY) return MATCH_REJECTED;
+	if (type == ORDER_FOK && _available(side, price, order) < order->_shares) return MATCH_REJECTED;
 
-	if (priceLevel == levelList.begin())
+	bool selfTrade(false);
+	Intrusive::LinkedList &levelList = _priceLevels[otherSide];
+	for (Intrusive::LinkedListObject *obj = levelList.begin(); order->_shares && obj != levelList.end(); obj = levelList.begin())
 	{
-		_price[side] = priceLevel->_price;
+		PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+		if (inside(priceLevel->_price, price)) break;
+		selfTrade = priceLevel->match(side, order, matchRing, _selfTradePrevention);
+		if (priceLevel->_orderCnt)
+		{
+			if (_depthCache) _depthChanged(otherSide, priceLevel);
+			break;
+		}
+		_freePriceLevel(otherSide, priceLevel);
 	}
+	_topOfBookChanged();
+	Intrusive::LinkedListObject *obj = levelList.begin();
+	if (obj != levelList.end()) _price[otherSide] = static_cast<PriceLevel*>(obj)->_price;
+	else _price[otherSide] = otherSide ? -1 : 0;
 
-	return false;
+	if (!order->_shares) return MATCH_FILLED;
+	if (type != ORDER_LIMIT || selfTrade) return MATCH_CANCELLED;
+	_restOrder(side, price, order);
+	return MATCH_RESTING;
 }
 
 void OrderBook::cancelRequest(int side, BookOrder *referenceOrder)
 {
+	LATENCY_SCOPE(LATENCY_CANCEL);
 	PriceLevel *priceLevel = referenceOrder->_priceLevel;
 	Intrusive::LinkedList &levelList = _priceLevels[side];
 	bool topOfBook = priceLevel == levelList.begin();
 	priceLevel->removeBookOrder(referenceOrder);
-	if (! priceLevel->_orderCnt)
-	{
-		priceLevel->unlink();
-		_exchange->freePriceLevel(priceLevel);
-	}
+	if (! priceLevel->_orderCnt) _freePriceLevel(side, priceLevel);
+	else if (_depthCache) _depthChanged(side, priceLevel);
 
 	if (topOfBook)
 	{
+		_topOfBookChanged();
 		Intrusive::LinkedListObject *obj = levelList.begin();
 		if (obj != levelList.end()) _price[side] = static_cast<PriceLevel*>(obj)->_price;
 		else _price[side] = side ? -1 : 0;
 	}
 }
 
+void OrderBook::reduceRequest(int side, BookOrder *referenceOrder, unsigned shares)
+{
+	LATENCY_SCOPE(LATENCY_REDUCE);
+	if (shares < referenceOrder->_shares)
+	{
+		if (referenceOrder->_priceLevel == _priceLevels[side].begin()) _topOfBookChanged();
+		referenceOrder->_priceLevel->reduceBookOrder(referenceOrder, shares);
+		if (_depthCache) _depthChanged(side, referenceOrder->_priceLevel);
+	}
+	else cancelRequest(side, referenceOrder);
+}
+
 bool OrderBook::replaceRequest(int side, unsigned price, BookOrder *order, BookOrder *referenceOrder)
 {
+	LATENCY_SCOPE(LATENCY_REPLACE);
 	bool filled;
 	PriceLevel *priceLevel = referenceOrder->_priceLevel;
 	if (priceLevel->_price == price)
 	{
+		if (order->_shares != referenceOrder->_shares && priceLevel == _priceLevels[side].begin()) _topOfBookChanged();
 		priceLevel->removeBookOrder(referenceOrder);
+		order->_side = side;
 		priceLevel->addBookOrder(order);
+		if (_depthCache) _depthChanged(side, priceLevel);
 		filled = false;
 	}
 	else
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "DepthCache.h"
 #include "IntrusiveHashTable.h"
 #include "IntrusiveLinkedList.h"
+#include "IntrusiveQueue.h"
+#include "Matching.h"
+#include "PriceLadder.h"
 
+#include <string.h>
 #include <time.h>
 
 /*
@@ -10,82 +15,230 @@
 ** - works with simulated orders and market data
 */
 
+// ORDER_BOOK_CACHE_ALIGNED starts BookOrder and PriceLevel on cache lines, 128 bytes each rather than the packed 104 and 88
+#ifdef ORDER_BOOK_CACHE_ALIGNED
+#define ORDER_BOOK_ALIGNAS alignas(64)
+#else
+#define ORDER_BOOK_ALIGNAS
+#endif
+
 class Order;
 struct BookOrder;
 class PriceLevel;
 class OrderBook;
 class Exchange;
 
-struct BookOrder : private Intrusive::LinkedListObject, private Intrusive::HashTableObject
+/*
+** BookOrder
+** - the hooks and the fields cancels, fills and queue walks read come first, the first line when cache line aligned
+** - matching, queue position and simulated order fields follow, touched when the order is added
+*/
+struct ORDER_BOOK_ALIGNAS BookOrder : private Intrusive::LinkedListObject, private Intrusive::HashTableObject, private Intrusive::QueuedObject
 {
 	friend class PriceLevel;
+	friend class OrderBook;
+	friend class Exchange;
+	template<typename Key, typename Type, typename Equal, typename Hash>
+	friend class Intrusive::HashTable;
+	template<typename TYPE>
+	friend class Intrusive::QueuedObjectPool;
+	template<typename TYPE>
+	friend class ExchangeObjectPool;
 	PriceLevel *_priceLevel;
 	uint64_t _orderId;
 	unsigned _shares;
+	unsigned _side;
+
+	// matching mode self trade prevention, 0 never matches an owner
+	unsigned _owner;
+	// the level's queued volume when the order joined, orders ahead have lower values
+	uint64_t _queueSequence;
 
 	Order *_order;
 	timespec _receivedTime;
 
-	BookOrder(): _priceLevel(0), _orderId(0), _shares(0), _order(0) {}
+	BookOrder(): _priceLevel(0), _orderId(0), _shares(0), _side(0), _owner(0), _queueSequence(0), _order(0) {}
 	void initialize(uint64_t orderId, unsigned shares, timespec &ts);
 	void initialize(uint16_t orderId, unsigned shares, Order *order, timespec &ts);
 };
 
-class PriceLevel : private Intrusive::LinkedListObject
+/*
+** QueuePosition
+** - shares resting ahead of a tracked order at its price level, read in O(1)
+** - updated as orders ahead cancel, shrink or execute, at a cost of one compare per tracked order at the level
+** - tracking ends when the order leaves its level
+*/
+class QueuePosition : private Intrusive::LinkedListObject
+{
+	friend class PriceLevel;
+	friend class OrderBook;
+	BookOrder *_order;
+	unsigned _sharesAhead;
+public:
+	QueuePosition() : _order(0), _sharesAhead(0) {}
+	BookOrder *order() const { return _order; }
+	unsigned sharesAhead() const { return _sharesAhead; }
+	bool tracking() const { return _order != 0; }
+	inline void untrack();
+};
+
+/*
+** PriceLevel
+** - level walks read the hook and price in the first 32 bytes
+** - the rest of the first 64 bytes is what adding, cancelling and executing orders needs
+** - queue position state follows, only read while an order at the level is tracked
+*/
+class ORDER_BOOK_ALIGNAS PriceLevel : private Intrusive::LinkedListObject, private Intrusive::QueuedObject
 {
 protected:
 	friend class OrderBook;
-	OrderBook *_orderBook;
+	friend class QueuePosition;
+	friend class Exchange;
+	template<typename TYPE>
+	friend class Intrusive::QueuedObjectPool;
+	template<typename TYPE>
+	friend class ExchangeObjectPool;
 	unsigned _price;
 	unsigned _shares;
 	unsigned _orderCnt;
+	// QueuePositions at the level, so untracked levels never touch the queue position state
+	unsigned _trackedCnt;
 	Intrusive::LinkedList _orders;
+	OrderBook *_orderBook;
+
+	// cumulative shares ever queued, orders take the current value as their _queueSequence
+	uint64_t _queuedVolume;
+	Intrusive::LinkedList _queuePositions;
+
+	inline void _volumeRemoved(BookOrder *order, unsigned shares);
 public:
-	PriceLevel(): _orderBook(0), _price(0), _shares(0), _orderCnt(0) {}
+	PriceLevel(): _price(0), _shares(0), _orderCnt(0), _trackedCnt(0), _orderBook(0), _queuedVolume(0) {}
 	void initialize(OrderBook *orderBook, unsigned price);
-	void addBookOrder(BookOrder *order) { _shares += order->_shares; ++_orderCnt; _orders.push_back(order); order->_priceLevel = this; }
-	void removeBookOrder(BookOrder *order) { _shares -= order->_shares; --_orderCnt; order->unlink(); order->_priceLevel = 0; }
+	OrderBook *orderBook() const { return _orderBook; }
+	unsigned price() const { return _price; }
+	void addBookOrder(BookOrder *order) { _shares += order->_shares; ++_orderCnt; _orders.push_back(order); order->_priceLevel = this; order->_queueSequence = _queuedVolume; _queuedVolume += order->_shares; }
+	void removeBookOrder(BookOrder *order) { _volumeRemoved(order, order->_shares); _shares -= order->_shares; --_orderCnt; order->unlink(); order->_priceLevel = 0; }
+	void reduceBookOrder(BookOrder *order, unsigned shares) { _volumeRemoved(order, shares); _shares -= shares; order->_shares -= shares; }
+	// start tracking a resting order, O(1) for the most recently added order, otherwise one walk of the orders ahead
+	void trackQueuePosition(BookOrder *order, QueuePosition *queuePosition);
 	bool execute(int side, BookOrder *order);
+	// matching mode, fills order against this level in time priority, returns true if self trade prevention stops the order
+	bool match(int side, BookOrder *order, MatchRing &matchRing, SelfTradePrevention selfTradePrevention);
 };
 
-class OrderBook : private Intrusive::HashTableObject
+class OrderBook : private Intrusive::HashTableObject, private Intrusive::QueuedObject
 {
 protected:
 	friend class Exchange;
+	friend class PriceLevel;
+	template<typename Key, typename Type, typename Equal, typename Hash>
+	friend class Intrusive::HashTable;
 	Exchange *_exchange;
 	char _symbol[32];
 	unsigned _price[2];
 	unsigned _tradingMask;
 	Intrusive::LinkedList _priceLevels[2];
 
-	// identify that the top of book has changed
+	// optional direct mapped index over _priceLevels
+	PriceLadder _ladder;
+
+	// optional cache of recently freed levels, a level that empties and refills keeps its memory
+	enum { LEVEL_CACHE_BITS = 3, LEVEL_CACHE_SIZE = 1 << LEVEL_CACHE_BITS };
+	bool _levelCacheFlag;
+	PriceLevel *_levelCache[2][LEVEL_CACHE_SIZE];
+	static unsigned _levelCacheSlot(unsigned price) { return (price * 0x9E3779B1u) >> (32 - LEVEL_CACHE_BITS); }
+
+	SelfTradePrevention _selfTradePrevention;
+	unsigned _available(int side, unsigned price, BookOrder *order);
+	void _restOrder(int side, unsigned price, BookOrder *order);
+
+	// optional top levels of both sides, kept current as levels change
+	DepthCache *_depthCache;
+	inline void _depthChanged(int side, PriceLevel *priceLevel);
+	void _depthRemoved(int side, PriceLevel *priceLevel);
+
+	// identify that the top of book price or size has changed
+	// - set by the first change, the book then waits on the exchange's top of book queue until published
 	bool _topOfBookFlag;
+	inline void _topOfBookChanged();
 
 	// quote feed - orderId = 0
 	BookOrder *_quoteOrders[2];
+
+	PriceLevel *_newPriceLevel(int side, unsigned price);
+	PriceLevel *_findPriceLevel(int side, unsigned price);
+	PriceLevel *_walkPriceLevels(int side, unsigned price, bool fromBack);
+	bool _recentreLadder(unsigned price);
+	void _reindexLadder(unsigned mid);
+	void _freePriceLevel(int side, PriceLevel *priceLevel);
+	unsigned _topShares(int side) { Intrusive::LinkedListObject *obj = _priceLevels[side].begin(); return obj != _priceLevels[side].end() ? static_cast<PriceLevel*>(obj)->_shares : 0; }
 public:
-	OrderBook() : _exchange(0), _tradingMask(0), _topOfBookFlag(false) { _price[0] = 0;  _price[1] = -1; _quoteOrders[0] = _quoteOrders[1] = 0; }
+	OrderBook() : _exchange(0), _tradingMask(0), _levelCacheFlag(false), _selfTradePrevention(STP_NONE), _depthCache(0), _topOfBookFlag(false) { _price[0] = 0;  _price[1] = -1; _quoteOrders[0] = _quoteOrders[1] = 0; memset(_levelCache, 0, sizeof(_levelCache)); }
 	void initialize(Exchange *exchange, const char *symbol);
+	// index price levels in a window of windowSize ticks around the mid
+	int initializeLadder(unsigned tickSize, unsigned windowSize);
+	// disabling the cache returns its levels to the exchange
+	void setLevelCache(bool levelCacheFlag);
+	// cache the top levels (at most DepthSnapshot::MAX_LEVELS) of each side
+	int initializeDepth(unsigned levels);
+	// read in place on the book's thread, 0 if not enabled
+	const DepthSnapshot *depth() const { return _depthCache ? &_depthCache->snapshot() : 0; }
+	// consistent copy from any thread, -1 if not enabled
+	int copyDepth(DepthSnapshot &snapshot) const { if (!_depthCache) return -1; _depthCache->copy(snapshot); return 0; }
 	Exchange *exchange() { return _exchange; }
 	const char *symbol() const { return _symbol; }
 	unsigned bid() const { return _price[0]; }
 	unsigned ask() const { return _price[1]; }
+	// shares at the best price, 0 if the side is empty
+	unsigned bidShares() { return _topShares(0); }
+	unsigned askShares() { return _topShares(1); }
+	bool topOfBookChanged() const { return _topOfBookFlag; }
 
 	bool newOrder(int side, unsigned price, BookOrder *order);
 	bool replaceRequest(int side, unsigned price, BookOrder *order, BookOrder *referenceOrder);
 	void cancelRequest(int side, BookOrder *referenceOrder);
+	// reduce a resting order, cancelling it once no shares remain
+	void reduceRequest(int side, BookOrder *referenceOrder, unsigned shares);
 
 	void execute(int side, unsigned price, unsigned shares, BookOrder *order);
 
+	// price-time matching of a simulated order
+	// - walks as many levels as the price allows with exact partial fills on both sides
+	// - fills and self trade cancels are reported to matchRing and the exchange, market orders ignore price
+	// - resting orders filled or self trade cancelled leave through Exchange::releaseOrders
+	MatchResult match(int side, unsigned price, BookOrder *order, OrderType type, MatchRing &matchRing);
+	void setSelfTradePrevention(SelfTradePrevention selfTradePrevention) { _selfTradePrevention = selfTradePrevention; }
+
+	// f(side, price, order) for every resting order, best level first and in queue order within a level
+	template<typename F>
+	void forEachOrder(F &f);
+
 	void display();
+
+	~OrderBook() { if (_depthCache) delete _depthCache; }
 };
 
+template<typename F>
+void OrderBook::forEachOrder(F &f)
+{
+	for (int side = 0; side < 2; ++side)
+	{
+		for (Intrusive::LinkedListObject *obj = _priceLevels[side].begin(); obj != _priceLevels[side].end(); obj = obj->next())
+		{
+			PriceLevel *priceLevel = static_cast<PriceLevel*>(obj);
+			for (Intrusive::LinkedListObject *orderObj = priceLevel->_orders.begin(); orderObj != priceLevel->_orders.end(); orderObj = orderObj->next())
+				f(side, priceLevel->_price, static_cast<const BookOrder*>(orderObj));
+		}
+	}
+}
+
 inline
 void BookOrder::initialize(uint64_t orderId, unsigned shares, timespec &ts)
 {
 	_priceLevel = 0;
 	_orderId = orderId;
 	_shares = shares;
+	_owner = 0;
 	_order = 0;
 	_receivedTime = ts;
 }
@@ -96,10 +249,36 @@ void BookOrder::initialize(uint16_t orderId, unsigned shares, Order *order, time
 	_priceLevel = 0;
 	_orderId = orderId;
 	_shares = shares;
+	_owner = 0;
 	_order = order;
 	_receivedTime = ts;
 }
 
+inline
+void QueuePosition::untrack()
+{
+	if (_order) --_order->_priceLevel->_trackedCnt;
+	unlink();
+	_order = 0;
+}
+
+inline
+void PriceLevel::_volumeRemoved(BookOrder *order, unsigned shares)
+{
+	if (!_trackedCnt) return;
+	for (Intrusive::LinkedListObject *obj = _queuePositions.begin(); obj != _queuePositions.end();)
+	{
+		QueuePosition *queuePosition = static_cast<QueuePosition*>(obj);
+		obj = obj->next();
+		if (queuePosition->_order == order)
+		{
+			// only the tracked order leaving ends tracking, it shrinking does not move it
+			if (shares == order->_shares) queuePosition->untrack();
+		}
+		else if (order->_queueSequence < queuePosition->_order->_queueSequence) queuePosition->_sharesAhead -= shares;
+	}
+}
+
 inline
 void PriceLevel::initialize(OrderBook *orderBook, unsigned price)
 {
@@ -0,0 +1,709 @@
+#include "ConsolidatedBook.h"
+#include "Exchange.h"
+#include "Latency.h"
+#include "OrderBook.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+enum MessageType { ADD, CANCEL, EXECUTE, REPLACE };
+
+struct Message
+{
+	MessageType type;
+	int side;
+	uint64_t orderId;
+	uint64_t newOrderId;
+	unsigned price;
+	unsigned shares;
+};
+
+#define MESSAGE_CNT 1000000
+#define BOOK_DEPTH 200
+#define ORDER_CNT 10000
+#define MID_PRICE 100000
+
+// ITCH style mix: 50% add, 35% cancel, 10% execute, 5% replace
+// - adds drop to 40% once ORDER_CNT orders rest, holding the book near that size
+void generateMessages(std::vector<Message> &messages, size_t messageCnt)
+{
+	std::mt19937_64 generator(1);
+	std::vector<uint64_t> live;
+	std::vector<int> sides(2 * messageCnt + 1);
+	uint64_t nextOrderId(1);
+	messages.reserve(messageCnt);
+	for (size_t i = 0; i < messageCnt; ++i)
+	{
+		Message message = {ADD, 0, 0, 0, 0, 0};
+		unsigned pick = generator() % 100;
+		if (live.size() < BOOK_DEPTH || pick < (live.size() < ORDER_CNT ? 50u : 40u))
+		{
+			message.type = ADD;
+			message.side = generator() & 1;
+			message.orderId = nextOrderId++;
+			unsigned offset = 1 + static_cast<unsigned>(generator() % BOOK_DEPTH);
+			message.price = message.side ? MID_PRICE + offset : MID_PRICE - offset;
+			message.shares = 100 * (1 + generator() % 10);
+			sides[message.orderId] = message.side;
+			live.push_back(message.orderId);
+		}
+		else
+		{
+			size_t index = generator() % live.size();
+			message.orderId = live[index];
+			message.side = sides[message.orderId];
+			if (pick < 85)
+			{
+				message.type = CANCEL;
+				live[index] = live.back();
+				live.pop_back();
+			}
+			else if (pick < 95)
+			{
+				// executions do not remove the order, a later cancel of the remainder does
+				message.type = EXECUTE;
+				message.shares = 1;
+			}
+			else
+			{
+				message.type = REPLACE;
+				message.newOrderId = nextOrderId++;
+				unsigned offset = 1 + static_cast<unsigned>(generator() % BOOK_DEPTH);
+				message.price = message.side ? MID_PRICE + offset : MID_PRICE - offset;
+				message.shares = 100 * (1 + generator() % 10);
+				sides[message.newOrderId] = message.side;
+				live[index] = message.newOrderId;
+			}
+		}
+		messages.push_back(message);
+	}
+}
+
+// order book with an std::unordered_map in front of it
+std::chrono::duration<long long, std::nano> replayMap(const std::vector<Message> &messages, BookOrder *orders, OrderBook &orderBook, Exchange &exchange)
+{
+	timespec ts = {0, 0};
+	std::unordered_map<uint64_t, BookOrder*> orderMap;
+	orderMap.reserve(messages.size());
+	auto start = std::chrono::steady_clock::now();
+	for (const Message &message : messages)
+	{
+		switch (message.type)
+		{
+		case ADD:
+		{
+			BookOrder *order = orders + message.orderId;
+			order->initialize(message.orderId, message.shares, ts);
+			orderMap[message.orderId] = order;
+			orderBook.newOrder(message.side, message.price, order);
+			break;
+		}
+		case CANCEL:
+		{
+			auto itr = orderMap.find(message.orderId);
+			orderBook.cancelRequest(message.side, itr->second);
+			orderMap.erase(itr);
+			break;
+		}
+		case EXECUTE:
+		{
+			auto itr = orderMap.find(message.orderId);
+			exchange.execute(message.side, itr->second->_priceLevel->price(), message.shares, itr->second);
+			orderBook.reduceRequest(message.side, itr->second, message.shares);
+			if (!itr->second->_priceLevel) orderMap.erase(itr);
+			break;
+		}
+		case REPLACE:
+		{
+			auto itr = orderMap.find(message.orderId);
+			BookOrder *order = orders + message.newOrderId;
+			order->initialize(message.newOrderId, message.shares, ts);
+			orderBook.replaceRequest(message.side, message.price, order, itr->second);
+			orderMap.erase(itr);
+			orderMap[message.newOrderId] = order;
+			break;
+		}
+		}
+	}
+	return std::chrono::steady_clock::now() - start;
+}
+
+// order book with the Exchange order id index
+std::chrono::duration<long long, std::nano> replayIndex(const std::vector<Message> &messages, BookOrder *orders, OrderBook &orderBook, Exchange &exchange)
+{
+	timespec ts = {0, 0};
+	auto start = std::chrono::steady_clock::now();
+	for (const Message &message : messages)
+	{
+		switch (message.type)
+		{
+		case ADD:
+		{
+			BookOrder *order = orders + message.orderId;
+			order->initialize(message.orderId, message.shares, ts);
+			exchange.addOrder(&orderBook, message.side, message.price, order);
+			break;
+		}
+		case CANCEL:
+			exchange.cancelById(message.orderId);
+			break;
+		case EXECUTE:
+			exchange.executeById(message.orderId, message.shares);
+			break;
+		case REPLACE:
+		{
+			BookOrder *order = orders + message.newOrderId;
+			order->initialize(message.newOrderId, message.shares, ts);
+			exchange.replaceById(message.orderId, message.price, order);
+			break;
+		}
+		}
+	}
+	return std::chrono::steady_clock::now() - start;
+}
+
+// order id index with pooled orders and levels, no allocation once reserved
+inline void applyPool(const Message &message, OrderBook &orderBook, Exchange &exchange, timespec &ts)
+{
+	BookOrder *order(0);
+	switch (message.type)
+	{
+	case ADD:
+		order = exchange.allocateBookOrder();
+		order->initialize(message.orderId, message.shares, ts);
+		if (exchange.addOrder(&orderBook, message.side, message.price, order) == 0) order = 0;
+		break;
+	case CANCEL:
+		order = exchange.cancelById(message.orderId);
+		break;
+	case EXECUTE:
+		order = exchange.executeById(message.orderId, message.shares);
+		break;
+	case REPLACE:
+	{
+		BookOrder *newOrder = exchange.allocateBookOrder();
+		newOrder->initialize(message.newOrderId, message.shares, ts);
+		order = exchange.replaceById(message.orderId, message.price, newOrder);
+		if (!order) order = newOrder;
+		else if (!newOrder->_priceLevel) exchange.freeBookOrder(newOrder);
+		break;
+	}
+	}
+	if (order) exchange.freeBookOrder(order);
+	auto freeOrder = [&exchange](BookOrder *released) { exchange.freeBookOrder(released); };
+	exchange.releaseOrders(freeOrder);
+}
+
+std::chrono::duration<long long, std::nano> replayPool(const std::vector<Message> &messages, OrderBook &orderBook, Exchange &exchange)
+{
+	timespec ts = {0, 0};
+	auto start = std::chrono::steady_clock::now();
+	for (const Message &message : messages) applyPool(message, orderBook, exchange, ts);
+	return std::chrono::steady_clock::now() - start;
+}
+
+// resting orders a crossing add takes out are handed back, a replace to a duplicate id changes nothing
+void checkOrderIndex()
+{
+	Exchange exchange;
+	exchange.initializeOrderIndex(64);
+	exchange.reserve(16, 16);
+	exchange.setSteadyState(true);
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "INDEX");
+	timespec ts = {0, 0};
+	auto add = [&](uint64_t orderId, int side, unsigned price)
+	{
+		BookOrder *order = exchange.allocateBookOrder();
+		order->initialize(orderId, 100, ts);
+		exchange.addOrder(&orderBook, side, price, order);
+		return order;
+	};
+	std::vector<BookOrder*> released;
+	auto onOrder = [&released](BookOrder *order) { released.push_back(order); };
+
+	BookOrder *sell1 = add(1, 1, MID_PRICE), *sell2 = add(2, 1, MID_PRICE);
+	add(3, 0, MID_PRICE + 1);
+	if (exchange.releaseOrders(onOrder) != 2 || released[0] != sell1 || released[1] != sell2 || exchange.findOrder(1) || exchange.findOrder(2))
+		printf("ERROR: crossed orders not released\n");
+	for (BookOrder *order : released) exchange.freeBookOrder(order);
+
+	BookOrder *buy = add(4, 0, MID_PRICE - 10);
+	BookOrder *duplicate = exchange.allocateBookOrder();
+	duplicate->initialize(3, 100, ts);
+	if (exchange.replaceById(4, MID_PRICE - 5, duplicate) || exchange.findOrder(4) != buy || !buy->_priceLevel || duplicate->_priceLevel)
+		printf("ERROR: replace to a duplicate id\n");
+	exchange.freeBookOrder(duplicate);
+
+	// every order back in the pool, the reserve covers them all again
+	BookOrder *order;
+	uint64_t orderIds[] = { 3, 4 };
+	for (uint64_t orderId : orderIds) if ((order = exchange.cancelById(orderId))) exchange.freeBookOrder(order);
+	if (orderBook.bid() || orderBook.ask() != (unsigned)-1) printf("ERROR: order index book not empty\n");
+	for (uint64_t orderId = 10; orderId < 26; ++orderId) add(orderId, 0, MID_PRICE - static_cast<unsigned>(orderId));
+	if (exchange.steadyStateAllocations()) printf("ERROR: %zu order index allocations\n", exchange.steadyStateAllocations());
+}
+
+// publish conflated top of book every BATCH_SIZE messages and check nothing is missed
+#define BATCH_SIZE 16
+
+struct TopOfBook
+{
+	unsigned bid, bidShares, ask, askShares;
+	bool operator != (const TopOfBook &r) const { return bid != r.bid || bidShares != r.bidShares || ask != r.ask || askShares != r.askShares; }
+};
+
+void checkTopOfBook(const std::vector<Message> &messages)
+{
+	Exchange exchange;
+	exchange.initializeOrderIndex(2 * ORDER_CNT);
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "TOB");
+
+	TopOfBook published = {0, 0, (unsigned)-1, 0};
+	size_t publishCnt(0), changeCnt(0);
+	auto onTopOfBook = [&published, &publishCnt](OrderBook &book)
+	{
+		TopOfBook top = {book.bid(), book.bidShares(), book.ask(), book.askShares()};
+		published = top;
+		++publishCnt;
+	};
+	for (size_t i = 0; i < messages.size(); i += BATCH_SIZE)
+	{
+		TopOfBook before = published;
+		std::vector<Message> batch(messages.begin() + i, messages.begin() + std::min(i + BATCH_SIZE, messages.size()));
+		replayPool(batch, orderBook, exchange);
+		exchange.publishTopOfBook(onTopOfBook);
+		TopOfBook after = {orderBook.bid(), orderBook.bidShares(), orderBook.ask(), orderBook.askShares()};
+		if (after != published)
+		{
+			printf("ERROR: unpublished top of book change at message %zu\n", i);
+			return;
+		}
+		if (after != before) ++changeCnt;
+	}
+	std::cout << "Conflation,messages," << messages.size() << ",batches," << (messages.size() + BATCH_SIZE - 1) / BATCH_SIZE
+		<< ",publishes," << publishCnt << ",changed," << changeCnt << std::endl;
+}
+
+// depth cache against levels rebuilt from the messages, checked every DEPTH_CHECK_INTERVAL messages
+#define DEPTH_LEVELS 10
+#define DEPTH_CHECK_INTERVAL 97
+
+struct ReferenceDepth
+{
+	struct RestingOrder { int side; unsigned price, shares; };
+	std::unordered_map<uint64_t, RestingOrder> orders;
+	std::map<unsigned, std::pair<unsigned, unsigned>> levels[2];
+
+	void add(uint64_t orderId, int side, unsigned price, unsigned shares)
+	{
+		RestingOrder order = {side, price, shares};
+		orders[orderId] = order;
+		std::pair<unsigned, unsigned> &level = levels[side][price];
+		level.first += shares;
+		++level.second;
+	}
+	void reduce(uint64_t orderId, unsigned shares)
+	{
+		auto itr = orders.find(orderId);
+		std::pair<unsigned, unsigned> &level = levels[itr->second.side][itr->second.price];
+		if (shares < itr->second.shares)
+		{
+			itr->second.shares -= shares;
+			level.first -= shares;
+			return;
+		}
+		level.first -= itr->second.shares;
+		if (!--level.second) levels[itr->second.side].erase(itr->second.price);
+		orders.erase(itr);
+	}
+	void apply(const Message &message)
+	{
+		switch (message.type)
+		{
+		case ADD: add(message.orderId, message.side, message.price, message.shares); break;
+		case CANCEL: reduce(message.orderId, (unsigned)-1); break;
+		case EXECUTE: reduce(message.orderId, message.shares); break;
+		case REPLACE: reduce(message.orderId, (unsigned)-1); add(message.newOrderId, message.side, message.price, message.shares); break;
+		}
+	}
+	bool matches(const DepthSnapshot &snapshot)
+	{
+		for (int side = 0; side < 2; ++side)
+		{
+			unsigned cnt(0);
+			auto check = [&](unsigned price, const std::pair<unsigned, unsigned> &level)
+			{
+				bool match = cnt < snapshot._levelCnt[side] && snapshot._prices[side][cnt] == price &&
+					snapshot._shares[side][cnt] == level.first && snapshot._orderCnts[side][cnt] == level.second;
+				++cnt;
+				return match;
+			};
+			if (side)
+			{
+				for (auto itr = levels[side].begin(); cnt < DEPTH_LEVELS && itr != levels[side].end(); ++itr)
+					if (!check(itr->first, itr->second)) return false;
+			}
+			else
+			{
+				for (auto itr = levels[side].rbegin(); cnt < DEPTH_LEVELS && itr != levels[side].rend(); ++itr)
+					if (!check(itr->first, itr->second)) return false;
+			}
+			if (cnt != snapshot._levelCnt[side]) return false;
+		}
+		return true;
+	}
+};
+
+void checkDepth(const std::vector<Message> &messages)
+{
+	for (int ladder = 0; ladder < 2; ++ladder)
+	{
+		Exchange exchange;
+		exchange.initializeOrderIndex(2 * ORDER_CNT);
+		OrderBook orderBook;
+		orderBook.initialize(&exchange, "DEPTH");
+		if (ladder) orderBook.initializeLadder(1, 4 * BOOK_DEPTH);
+		orderBook.initializeDepth(DEPTH_LEVELS);
+		ReferenceDepth reference;
+		DepthSnapshot snapshot;
+		for (size_t i = 0; i < messages.size(); i += DEPTH_CHECK_INTERVAL)
+		{
+			std::vector<Message> batch(messages.begin() + i, messages.begin() + std::min(i + DEPTH_CHECK_INTERVAL, messages.size()));
+			replayPool(batch, orderBook, exchange);
+			for (const Message &message : batch) reference.apply(message);
+			orderBook.copyDepth(snapshot);
+			if (!reference.matches(snapshot) || memcmp(&snapshot, orderBook.depth(), sizeof(snapshot)))
+			{
+				printf("ERROR: depth cache mismatch at message %zu\n", i);
+				return;
+			}
+		}
+	}
+}
+
+// the messages spread over VENUE_CNT venues by order id, consolidated top of book checked against a scan of the venues
+// after every message and consolidated depth against the reference every DEPTH_CHECK_INTERVAL messages
+#define VENUE_CNT 16
+
+struct Venues
+{
+	Exchange exchanges[VENUE_CNT];
+	OrderBook orderBooks[VENUE_CNT];
+	std::vector<uint8_t> venueOf;
+	timespec ts;
+
+	Venues(size_t orderIdCnt) : venueOf(orderIdCnt), ts()
+	{
+		for (unsigned venue = 0; venue < VENUE_CNT; ++venue)
+		{
+			char symbol[16];
+			snprintf(symbol, sizeof(symbol), "V%u", venue);
+			exchanges[venue].initializeOrderIndex(2 * ORDER_CNT / VENUE_CNT);
+			orderBooks[venue].initialize(exchanges + venue, symbol);
+			orderBooks[venue].initializeDepth(DEPTH_LEVELS);
+		}
+	}
+	// replacements stay on the venue of the order they replace
+	unsigned apply(const Message &message)
+	{
+		unsigned venue = message.type == ADD ? venueOf[message.orderId] = static_cast<uint8_t>(message.orderId % VENUE_CNT) : venueOf[message.orderId];
+		if (message.type == REPLACE) venueOf[message.newOrderId] = static_cast<uint8_t>(venue);
+		applyPool(message, orderBooks[venue], exchanges[venue], ts);
+		return venue;
+	}
+};
+
+void checkConsolidated(const std::vector<Message> &messages)
+{
+	Venues venues(2 * messages.size() + 1);
+	ConsolidatedBook consolidated(VENUE_CNT);
+	for (unsigned venue = 0; venue < VENUE_CNT; ++venue) consolidated.addVenue(venues.orderBooks + venue);
+	unsigned venue(0);
+	auto onTopOfBook = [&consolidated, &venue](OrderBook &) { consolidated.update(venue); };
+	ReferenceDepth reference;
+	DepthSnapshot snapshot;
+	for (size_t i = 0; i < messages.size(); ++i)
+	{
+		venue = venues.apply(messages[i]);
+		venues.exchanges[venue].publishTopOfBook(onTopOfBook);
+		reference.apply(messages[i]);
+
+		TopOfBook scan = {0, 0, (unsigned)-1, 0};
+		for (OrderBook &orderBook : venues.orderBooks)
+		{
+			if (orderBook.bid() && orderBook.bid() >= scan.bid) scan.bidShares = (orderBook.bid() == scan.bid ? scan.bidShares : 0) + orderBook.bidShares();
+			if (orderBook.bid() > scan.bid) scan.bid = orderBook.bid();
+			if (orderBook.ask() != (unsigned)-1 && orderBook.ask() <= scan.ask) scan.askShares = (orderBook.ask() == scan.ask ? scan.askShares : 0) + orderBook.askShares();
+			if (orderBook.ask() < scan.ask) scan.ask = orderBook.ask();
+		}
+		TopOfBook top = {consolidated.bid(), consolidated.bidShares(), consolidated.ask(), consolidated.askShares()};
+		if (top != scan)
+		{
+			printf("ERROR: consolidated top of book %u %u %u %u scan %u %u %u %u at message %zu\n", top.bid, top.bidShares, top.ask, top.askShares,
+				scan.bid, scan.bidShares, scan.ask, scan.askShares, i);
+			return;
+		}
+		if (i % DEPTH_CHECK_INTERVAL == 0)
+		{
+			consolidated.copyDepth(snapshot, DEPTH_LEVELS);
+			if (!reference.matches(snapshot))
+			{
+				printf("ERROR: consolidated depth mismatch at message %zu\n", i);
+				return;
+			}
+		}
+	}
+
+	// best bid and offer after every message, by scanning the venues and from the heaps
+	std::chrono::duration<long long, std::nano> duration[2];
+	unsigned long long sum[2] = {0, 0};
+	for (int heap = 0; heap < 2; ++heap)
+	{
+		Venues timedVenues(2 * messages.size() + 1);
+		ConsolidatedBook timedConsolidated(VENUE_CNT);
+		for (unsigned v = 0; v < VENUE_CNT; ++v) timedConsolidated.addVenue(timedVenues.orderBooks + v);
+		auto onTimedTopOfBook = [&timedConsolidated, &venue](OrderBook &) { timedConsolidated.update(venue); };
+		auto start = std::chrono::steady_clock::now();
+		for (const Message &message : messages)
+		{
+			venue = timedVenues.apply(message);
+			if (heap)
+			{
+				timedVenues.exchanges[venue].publishTopOfBook(onTimedTopOfBook);
+				sum[heap] += timedConsolidated.bid() + timedConsolidated.ask();
+			}
+			else
+			{
+				unsigned bid(0), ask((unsigned)-1);
+				for (OrderBook &orderBook : timedVenues.orderBooks)
+				{
+					if (orderBook.bid() > bid) bid = orderBook.bid();
+					if (orderBook.ask() < ask) ask = orderBook.ask();
+				}
+				sum[heap] += bid + ask;
+			}
+		}
+		duration[heap] = std::chrono::steady_clock::now() - start;
+	}
+	if (sum[0] != sum[1]) printf("ERROR: consolidated %llu scanned %llu\n", sum[1], sum[0]);
+	std::cout << "Consolidated ns/msg,venues," << VENUE_CNT << ",scan," << (double)duration[0].count() / messages.size()
+		<< ",heap," << (double)duration[1].count() / messages.size() << std::endl;
+}
+
+// shares ahead of a simulated order on one deep level, walking the queue against QueuePosition
+#define DEEP_ORDER_CNT 5000
+#define DEEP_EVENT_CNT 10000
+
+struct QueueEvent
+{
+	enum { CANCEL, ADD, EXECUTE } type;
+	size_t order;
+	unsigned shares;
+};
+
+// cancels and adds keep the level near DEEP_ORDER_CNT orders, executions consume it from the front
+void generateQueueEvents(std::vector<QueueEvent> &events, size_t tracked)
+{
+	std::mt19937_64 generator(1);
+	std::vector<size_t> queue(DEEP_ORDER_CNT);
+	std::vector<unsigned> shares(DEEP_ORDER_CNT + DEEP_EVENT_CNT, 100);
+	for (size_t i = 0; i < DEEP_ORDER_CNT; ++i) queue[i] = i;
+	size_t nextOrder = DEEP_ORDER_CNT;
+	while (events.size() < DEEP_EVENT_CNT)
+	{
+		if (generator() % 10 == 0 && queue.front() != tracked)
+		{
+			QueueEvent event = {QueueEvent::EXECUTE, queue.front(), 1 + static_cast<unsigned>(generator() % 100)};
+			if (event.shares >= shares[event.order]) queue.erase(queue.begin());
+			else shares[event.order] -= event.shares;
+			events.push_back(event);
+			continue;
+		}
+		size_t index = generator() % queue.size();
+		if (queue[index] == tracked) continue;
+		QueueEvent cancel = {QueueEvent::CANCEL, queue[index], 0};
+		queue.erase(queue.begin() + index);
+		QueueEvent add = {QueueEvent::ADD, nextOrder, 100};
+		queue.push_back(nextOrder++);
+		events.push_back(cancel);
+		events.push_back(add);
+	}
+}
+
+uint64_t replayQueueEvents(const std::vector<QueueEvent> &events, size_t tracked, bool walk, std::chrono::duration<long long, std::nano> &duration)
+{
+	Exchange exchange;
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "DEEP");
+	std::vector<BookOrder> orders(DEEP_ORDER_CNT + DEEP_EVENT_CNT);
+	timespec ts = {0, 0};
+	for (size_t i = 0; i < DEEP_ORDER_CNT; ++i)
+	{
+		orders[i].initialize(i + 1, 100, ts);
+		orderBook.newOrder(0, MID_PRICE, &orders[i]);
+	}
+	QueuePosition queuePosition;
+	BookOrder *trackedOrder = &orders[tracked];
+	if (!walk) trackedOrder->_priceLevel->trackQueuePosition(trackedOrder, &queuePosition);
+
+	// the order's own list hook is private, so the walk goes through a level order list copy kept in step
+	std::vector<BookOrder*> queue;
+	if (walk) for (size_t i = 0; i < DEEP_ORDER_CNT; ++i) queue.push_back(&orders[i]);
+
+	uint64_t sum(0);
+	auto start = std::chrono::steady_clock::now();
+	for (const QueueEvent &event : events)
+	{
+		BookOrder *order = &orders[event.order];
+		switch (event.type)
+		{
+		case QueueEvent::CANCEL:
+			orderBook.cancelRequest(0, order);
+			break;
+		case QueueEvent::ADD:
+			order->initialize(event.order + 1, event.shares, ts);
+			orderBook.newOrder(0, MID_PRICE, order);
+			break;
+		case QueueEvent::EXECUTE:
+			exchange.execute(0, MID_PRICE, event.shares, order);
+			orderBook.reduceRequest(0, order, event.shares);
+			break;
+		}
+		if (walk)
+		{
+			if (event.type == QueueEvent::ADD) queue.push_back(order);
+			unsigned sharesAhead(0);
+			for (std::vector<BookOrder*>::iterator itr = queue.begin(); itr != queue.end();)
+			{
+				// drop orders that have left the level as the walk passes them
+				if (!(*itr)->_priceLevel) { itr = queue.erase(itr); continue; }
+				if (*itr == trackedOrder) break;
+				sharesAhead += (*itr)->_shares;
+				++itr;
+			}
+			sum += sharesAhead;
+		}
+		else sum += queuePosition.sharesAhead();
+	}
+	duration = std::chrono::steady_clock::now() - start;
+	return sum;
+}
+
+// a simulated order partly filling the order ahead, then that order cancelled, leaves nothing ahead
+void checkQueuePosition()
+{
+	Exchange exchange;
+	OrderBook orderBook;
+	orderBook.initialize(&exchange, "QUEUE");
+	timespec ts = {0, 0};
+	BookOrder ahead, tracked, simulated;
+	ahead.initialize(1, 100, ts);
+	tracked.initialize(2, 100, ts);
+	orderBook.newOrder(0, MID_PRICE, &ahead);
+	orderBook.newOrder(0, MID_PRICE, &tracked);
+	QueuePosition queuePosition;
+	tracked._priceLevel->trackQueuePosition(&tracked, &queuePosition);
+	unsigned sharesAhead[3] = { queuePosition.sharesAhead() };
+
+	// only whether a simulated order points at an Order matters to the book
+	simulated.initialize(static_cast<uint16_t>(0), 30, reinterpret_cast<Order*>(&simulated), ts);
+	if (!orderBook.newOrder(1, MID_PRICE, &simulated) || ahead._shares != 70) printf("ERROR: simulated cross left %u shares ahead\n", ahead._shares);
+	sharesAhead[1] = queuePosition.sharesAhead();
+	orderBook.cancelRequest(0, &ahead);
+	sharesAhead[2] = queuePosition.sharesAhead();
+	if (sharesAhead[0] != 100 || sharesAhead[1] != 70 || sharesAhead[2] != 0)
+		printf("ERROR: queue position after a simulated cross %u %u %u\n", sharesAhead[0], sharesAhead[1], sharesAhead[2]);
+	queuePosition.untrack();
+}
+
+void queuePositionBenchmark()
+{
+	std::vector<QueueEvent> events;
+	// the tracked order joins last and works its way forward
+	size_t tracked = DEEP_ORDER_CNT - 1;
+	generateQueueEvents(events, tracked);
+	std::chrono::duration<long long, std::nano> walkDuration, trackedDuration;
+	uint64_t walkSum = replayQueueEvents(events, tracked, true, walkDuration);
+	uint64_t trackedSum = replayQueueEvents(events, tracked, false, trackedDuration);
+	if (walkSum != trackedSum) printf("ERROR: queue position %llu %llu\n", (unsigned long long)walkSum, (unsigned long long)trackedSum);
+	std::cout << "QueuePosition ns/event,level orders," << DEEP_ORDER_CNT << ",walk," << (double)walkDuration.count() / events.size()
+		<< ",tracked," << (double)trackedDuration.count() / events.size() << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+	std::vector<Message> messages;
+	generateMessages(messages, MESSAGE_CNT);
+	checkOrderIndex();
+	checkQueuePosition();
+	checkTopOfBook(messages);
+	checkDepth(messages);
+	checkConsolidated(messages);
+	queuePositionBenchmark();
+
+	std::cout << "Book,UnorderedMap,OrderIndex,Pooled" << std::endl;
+	for (int ladder = 0; ladder < 2; ++ladder)
+	{
+		std::chrono::hours hour(1);
+		std::chrono::duration<long long, std::nano> minMapDuration(hour), minIndexDuration(hour), minPoolDuration(hour);
+		for (size_t t(0); t < 5; ++t)
+		{
+			BookOrder *orders = new BookOrder[2 * MESSAGE_CNT + 1];
+			Exchange mapExchange;
+			OrderBook mapBook;
+			mapBook.initialize(&mapExchange, "MAP");
+			if (ladder) mapBook.initializeLadder(1, 4 * BOOK_DEPTH);
+			std::chrono::duration<long long, std::nano> duration = replayMap(messages, orders, mapBook, mapExchange);
+			if (minMapDuration > duration) minMapDuration = duration;
+			unsigned bid = mapBook.bid(), ask = mapBook.ask();
+			delete[] orders;
+
+			orders = new BookOrder[2 * MESSAGE_CNT + 1];
+			Exchange indexExchange;
+			indexExchange.initializeOrderIndex(2 * ORDER_CNT);
+			OrderBook indexBook;
+			indexBook.initialize(&indexExchange, "INDEX");
+			if (ladder) indexBook.initializeLadder(1, 4 * BOOK_DEPTH);
+			duration = replayIndex(messages, orders, indexBook, indexExchange);
+			if (minIndexDuration > duration) minIndexDuration = duration;
+			if (bid != indexBook.bid() || ask != indexBook.ask())
+				printf("ERROR: top of book %u %u %u %u\n", bid, ask, indexBook.bid(), indexBook.ask());
+			delete[] orders;
+
+			Exchange poolExchange;
+			poolExchange.initializeOrderIndex(2 * ORDER_CNT);
+			poolExchange.reserve(4 * BOOK_DEPTH, 4 * ORDER_CNT);
+			OrderBook poolBook;
+			poolBook.initialize(&poolExchange, "POOL");
+			if (ladder) poolBook.initializeLadder(1, 4 * BOOK_DEPTH);
+			poolBook.setLevelCache(true);
+			poolExchange.setSteadyState(true);
+			duration = replayPool(messages, poolBook, poolExchange);
+			if (minPoolDuration > duration) minPoolDuration = duration;
+			if (bid != poolBook.bid() || ask != poolBook.ask())
+				printf("ERROR: top of book %u %u %u %u\n", bid, ask, poolBook.bid(), poolBook.ask());
+			if (poolExchange.steadyStateAllocations())
+				printf("ERROR: %zu steady state allocations\n", poolExchange.steadyStateAllocations());
+		}
+		std::cout << (ladder ? "Ladder" : "List") << " ns/msg," << (double)minMapDuration.count() / MESSAGE_CNT << ',' << (double)minIndexDuration.count() / MESSAGE_CNT << ',' << (double)minPoolDuration.count() / MESSAGE_CNT << std::endl;
+	}
+
+#ifdef ORDER_BOOK_LATENCY
+	// everything above, on this thread
+	LatencyReport report;
+	LatencyRecorder::mergeAll(report);
+	report.print(std::cout);
+#endif
+	return 0;
+}
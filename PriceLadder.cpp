@@ -0,0 +1,68 @@
+#include "PriceLadder.h"
+
+#include <string.h>
+
+PriceLadder::PriceLadder():
+	_tickSize(1), _windowSize(0), _basePrice(0), _wordCnt(0), _summaryCnt(0)
+{
+	_levels[0] = _levels[1] = 0;
+	_bits[0] = _bits[1] = 0;
+	_summary[0] = _summary[1] = 0;
+}
+
+int PriceLadder::initialize(unsigned tickSize, unsigned windowSize)
+{
+	if (!tickSize || !windowSize) return -1;
+
+	_free();
+	_tickSize = tickSize;
+	_wordCnt = (windowSize + 63) / 64;
+	_windowSize = _wordCnt * 64;
+	_summaryCnt = (_wordCnt + 63) / 64;
+	for (int side = 0; side < 2; ++side)
+	{
+		_levels[side] = new PriceLevel*[_windowSize];
+		_bits[side] = new uint64_t[_wordCnt];
+		_summary[side] = new uint64_t[_summaryCnt];
+	}
+	_basePrice = 0;
+	clear();
+	return 0;
+}
+
+void PriceLadder::recentre(unsigned price)
+{
+	unsigned halfWindow = _windowSize / 2 * _tickSize;
+	// keep the base on the same tick grid as price
+	_basePrice = price < halfWindow ? price % _tickSize : price - halfWindow;
+	clear();
+}
+
+void PriceLadder::clear()
+{
+	if (!enabled()) return;
+	for (int side = 0; side < 2; ++side)
+	{
+		memset(_levels[side], 0, _windowSize * sizeof(PriceLevel*));
+		memset(_bits[side], 0, _wordCnt * sizeof(uint64_t));
+		memset(_summary[side], 0, _summaryCnt * sizeof(uint64_t));
+	}
+}
+
+void PriceLadder::_free()
+{
+	for (int side = 0; side < 2; ++side)
+	{
+		if (_levels[side]) delete[] _levels[side];
+		if (_bits[side]) delete[] _bits[side];
+		if (_summary[side]) delete[] _summary[side];
+		_levels[side] = 0;
+		_bits[side] = 0;
+		_summary[side] = 0;
+	}
+}
+
+PriceLadder::~PriceLadder()
+{
+	_free();
+}
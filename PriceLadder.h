@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class PriceLevel;
+
+/*
+** PriceLadder
+** - direct mapped PriceLevel index for a window of prices around the mid
+** - slot = (price - basePrice) / tickSize
+** - a two level occupancy bitmap per side finds the nearest occupied slot with ctz / clz
+** - prices outside the window, or off the tick grid, are not indexed
+*/
+class PriceLadder
+{
+protected:
+	unsigned _tickSize;
+	unsigned _windowSize;
+	unsigned _basePrice;
+	unsigned _wordCnt;
+	unsigned _summaryCnt;
+	PriceLevel **_levels[2];
+	uint64_t *_bits[2];
+	uint64_t *_summary[2];
+
+	void _free();
+	static unsigned _lowestBit(uint64_t bits);
+	static unsigned _highestBit(uint64_t bits);
+public:
+	enum : unsigned { NO_SLOT = ~0u };
+
+	PriceLadder();
+	// windowSize is rounded up to a multiple of 64 slots
+	int initialize(unsigned tickSize, unsigned windowSize);
+	bool enabled() const { return _levels[0] != 0; }
+	unsigned tickSize() const { return _tickSize; }
+	unsigned windowSize() const { return _windowSize; }
+	unsigned basePrice() const { return _basePrice; }
+	unsigned slotPrice(unsigned slot) const { return _basePrice + slot * _tickSize; }
+	inline unsigned slot(unsigned price) const;
+
+	PriceLevel *level(int side, unsigned slot) const { return _levels[side][slot]; }
+	inline void add(int side, unsigned slot, PriceLevel *priceLevel);
+	inline void remove(int side, unsigned slot);
+	// nearest occupied slot above / below slot, NO_SLOT if none
+	inline unsigned above(int side, unsigned slot) const;
+	inline unsigned below(int side, unsigned slot) const;
+
+	// empty the ladder and centre the window on price, the caller re-adds levels
+	void recentre(unsigned price);
+	void clear();
+
+	~PriceLadder();
+private:
+	PriceLadder(const PriceLadder&) = delete;
+	PriceLadder& operator = (const PriceLadder&) = delete;
+};
+
+inline
+unsigned PriceLadder::_lowestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return index;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+inline
+unsigned PriceLadder::_highestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, bits);
+	return index;
+#else
+	return 63 - __builtin_clzll(bits);
+#endif
+}
+
+inline
+unsigned PriceLadder::slot(unsigned price) const
+{
+	if (price < _basePrice) return NO_SLOT;
+	unsigned offset = price - _basePrice;
+	unsigned slot = offset / _tickSize;
+	if (slot >= _windowSize || slot * _tickSize != offset) return NO_SLOT;
+	return slot;
+}
+
+inline
+void PriceLadder::add(int side, unsigned slot, PriceLevel *priceLevel)
+{
+	_levels[side][slot] = priceLevel;
+	_bits[side][slot >> 6] |= 1ULL << (slot & 63);
+	_summary[side][slot >> 12] |= 1ULL << ((slot >> 6) & 63);
+}
+
+inline
+void PriceLadder::remove(int side, unsigned slot)
+{
+	_levels[side][slot] = 0;
+	if (!(_bits[side][slot >> 6] &= ~(1ULL << (slot & 63))))
+		_summary[side][slot >> 12] &= ~(1ULL << ((slot >> 6) & 63));
+}
+
+inline
+unsigned PriceLadder::above(int side, unsigned slot) const
+{
+	unsigned word = slot >> 6, bit = slot & 63;
+	uint64_t bits = bit == 63 ? 0 : _bits[side][word] & (~0ULL << (bit + 1));
+	if (bits) return (word << 6) + _lowestBit(bits);
+
+	if (++word >= _wordCnt) return NO_SLOT;
+	unsigned summaryWord = word >> 6;
+	uint64_t summaryBits = _summary[side][summaryWord] & (~0ULL << (word & 63));
+	for (;;)
+	{
+		if (summaryBits)
+		{
+			word = (summaryWord << 6) + _lowestBit(summaryBits);
+			return (word << 6) + _lowestBit(_bits[side][word]);
+		}
+		if (++summaryWord >= _summaryCnt) return NO_SLOT;
+		summaryBits = _summary[side][summaryWord];
+	}
+}
+
+inline
+unsigned PriceLadder::below(int side, unsigned slot) const
+{
+	unsigned word = slot >> 6, bit = slot & 63;
+	uint64_t bits = _bits[side][word] & ((1ULL << bit) - 1);
+	if (bits) return (word << 6) + _highestBit(bits);
+
+	if (!word--) return NO_SLOT;
+	unsigned summaryWord = word >> 6;
+	uint64_t summaryBits = _summary[side][summaryWord] & ((word & 63) == 63 ? ~0ULL : (2ULL << (word & 63)) - 1);
+	for (;;)
+	{
+		if (summaryBits)
+		{
+			word = (summaryWord << 6) + _highestBit(summaryBits);
+			return (word << 6) + _highestBit(_bits[side][word]);
+		}
+		if (!summaryWord--) return NO_SLOT;
+		summaryBits = _summary[side][summaryWord];
+	}
+}
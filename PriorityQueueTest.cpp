@@ -1,5 +1,6 @@
 #include "PriorityQueue.h"
 #include "LinkedList.h"
+#include "SkipList.h"
 
 #include<set>
 #include <queue>
@@ -53,6 +54,16 @@ public:
 	}
 };
 
+// a skip list hook shares next/prev/unlink names with LinkedListObject, so it gets its own object
+class SkipTestObject : public Intrusive::SkipListObject
+{
+public:
+	int _id;
+	int _value;
+	SkipTestObject() : _id(0), _value(0) {}
+	inline bool operator () (const SkipTestObject &lhs, const SkipTestObject &rhs) const { return lhs._value < rhs._value; }
+};
+
 struct SetCompare
 {
 	bool operator()(const TestObject *lhs, const TestObject *rhs) const
@@ -111,22 +122,153 @@ public:
 #include <stdlib.h>
 
 #define ITEM_CNT 4096//32768
+// near position inserts and adjusts move a value at most NEAR_DISTANCE from the previous one
+#define NEAR_DISTANCE 4
+#define BOUNDED_DISTANCE 256
+
+void checkSortedList(TestObject *objects, size_t n)
+{
+	Intrusive::SortedList<TestObject, TestObject> sortedList;
+	// hinted insert from a random item already in the list
+	for (size_t i = 0; i < n; ++i)
+	{
+		objects[i]._value = std::rand() % ITEM_CNT;
+		sortedList.insert(&objects[i], i ? &objects[std::rand() % i] : 0);
+	}
+	if (!sortedList.check() || sortedList.size() != n) printf("ERROR: hinted insert\n");
+
+	// bounded adjust, 0 is unbounded
+	size_t maxDistances[] = { 0, 1, 4, 64 };
+	for (size_t maxDistance : maxDistances)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			objects[i]._value = std::rand() % ITEM_CNT;
+			sortedList.adjust(&objects[i], maxDistance);
+		}
+		if (!sortedList.check() || sortedList.size() != n) printf("ERROR: adjust %zu\n", maxDistance);
+	}
+	while (sortedList.pop_front());
+
+	// finger mode, mostly near the previous insert with the odd jump, and the finger leaving the list
+	sortedList.setFingerMode(true);
+	int value(ITEM_CNT / 2);
+	size_t removedCnt(0);
+	for (size_t i = 0; i < n; ++i)
+	{
+		value = i % 16 ? value + std::rand() % (2 * NEAR_DISTANCE + 1) - NEAR_DISTANCE : std::rand() % ITEM_CNT;
+		objects[i]._value = value;
+		sortedList.insert(&objects[i]);
+		if (i % 7 == 0)
+		{
+			sortedList.remove(&objects[i]);
+			++removedCnt;
+		}
+	}
+	if (!sortedList.check() || sortedList.size() != n - removedCnt) printf("ERROR: finger insert\n");
+	// a removed finger can be freed before the next insert
+	TestObject *finger = new TestObject;
+	finger->_value = value;
+	sortedList.insert(finger);
+	sortedList.remove(finger);
+	delete finger;
+	TestObject last;
+	last._value = value;
+	sortedList.insert(&last);
+	if (!sortedList.check() || sortedList.size() != n - removedCnt + 1) printf("ERROR: insert after finger removed\n");
+	while (sortedList.pop_front());
+}
+
+void nearPositionBenchmark(TestObject *objects)
+{
+	int walk[ITEM_CNT], nudge[ITEM_CNT];
+	int value(ITEM_CNT / 2);
+	for (size_t i = 0; i < ITEM_CNT; ++i)
+	{
+		walk[i] = value += std::rand() % (2 * NEAR_DISTANCE + 1) - NEAR_DISTANCE;
+		nudge[i] = std::rand() % (2 * NEAR_DISTANCE + 1) - NEAR_DISTANCE;
+	}
+
+	std::cout << "Near n,Insert,Hinted insert,Finger insert,Adjust,Bounded adjust" << std::endl;
+	std::chrono::hours hour(1);
+	for (size_t n = 64; n <= ITEM_CNT; n *= 4)
+	{
+		std::chrono::duration<long long, std::nano> minInsert(hour), minHintedInsert(hour), minFingerInsert(hour), minAdjust(hour), minBoundedAdjust(hour);
+		for (size_t t(0); t < 40; ++t)
+		{
+			Intrusive::SortedList<TestObject, TestObject> sortedList;
+			for (unsigned i = 0; i < n; ++i) objects[i]._value = walk[i];
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				sortedList.insert(&objects[i]);
+			}
+			std::chrono::duration<long long, std::nano> duration = std::chrono::steady_clock::now() - start;
+			if (minInsert > duration) minInsert = duration;
+			while (sortedList.pop_front());
+
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				sortedList.insert(&objects[i], i ? &objects[i - 1] : 0);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minHintedInsert > duration) minHintedInsert = duration;
+			if (!sortedList.check()) printf("ERROR: near hinted insert\n");
+			while (sortedList.pop_front());
+
+			sortedList.setFingerMode(true);
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				sortedList.insert(&objects[i]);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minFingerInsert > duration) minFingerInsert = duration;
+			if (!sortedList.check()) printf("ERROR: near finger insert\n");
+
+			// every item moves a few places, then back
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				objects[i]._value = walk[i] + nudge[i];
+				sortedList.adjust(&objects[i]);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minAdjust > duration) minAdjust = duration;
+			if (!sortedList.check()) printf("ERROR: near adjust\n");
+
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				objects[i]._value = walk[i];
+				sortedList.adjust(&objects[i], BOUNDED_DISTANCE);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minBoundedAdjust > duration) minBoundedAdjust = duration;
+			if (!sortedList.check()) printf("ERROR: near bounded adjust\n");
+			while (sortedList.pop_front());
+		}
+		std::cout << n << ',' << minInsert.count() << ',' << minHintedInsert.count() << ',' << minFingerInsert.count() << ',' << minAdjust.count() << ',' << minBoundedAdjust.count() << std::endl;
+	}
+}
 
 int main(int argc, const char *argv[])
 {
 	int random[ITEM_CNT];
 	TestObject objects[ITEM_CNT];
+	SkipTestObject skipObjects[ITEM_CNT];
 	for (unsigned i = 0; i < ITEM_CNT; ++i)
 	{
 		TestObject &object = objects[i];
-		object._id = i;
-		random[i] = object._value = std::rand() % ITEM_CNT;
+		object._id = skipObjects[i]._id = i;
+		random[i] = object._value = skipObjects[i]._value = std::rand() % ITEM_CNT;
 	}
 
-	std::cout << ",Loop|Insert,,,|Reprioritize,,,|Pop,,,|Erase\nn,Duration";
+	std::cout << ",Loop|Insert,,,,|Reprioritize,,,,|Pop,,,,|Erase\nn,Duration";
 	for (int i = 0; i < 4; ++i)
 	{
-		std::cout << "|IntrusiveQueue,StdQueue,StdSet,SortedList";
+		std::cout << "|IntrusiveQueue,StdQueue,StdSet,SortedList,SkipList";
 	}
 	std::cout << std::endl;
 
@@ -139,20 +281,25 @@ int main(int argc, const char *argv[])
 		std::chrono::duration<long long, std::nano> minInsertStdQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minStdSetInsertDuration(hour);
 		std::chrono::duration<long long, std::nano> minInsertListDuration(hour);
+		std::chrono::duration<long long, std::nano> minInsertSkipListDuration(hour);
 		std::chrono::duration<long long, std::nano> minReprioritizeIntrusiveQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minStdSetReprioritizeDuration(hour);
 		std::chrono::duration<long long, std::nano> minReprioritizeListDuration(hour);
+		std::chrono::duration<long long, std::nano> minReprioritizeSkipListDuration(hour);
 		std::chrono::duration<long long, std::nano> minPopIntrusiveQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minPopStdQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minStdSetPopDuration(hour);
 		std::chrono::duration<long long, std::nano> minPopListDuration(hour);
+		std::chrono::duration<long long, std::nano> minPopSkipListDuration(hour);
 		std::chrono::duration<long long, std::nano> minEraseIntrusiveQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minEraseStdQueueDuration(hour);
 		std::chrono::duration<long long, std::nano> minStdSetEraseDuration(hour);
 		std::chrono::duration<long long, std::nano> minUnlinkListDuration(hour);
+		std::chrono::duration<long long, std::nano> minUnlinkSkipListDuration(hour);
 		for (size_t t(0); t < 40; ++t) {
 			TestPriorityQueue<TestObject, TestObject> intrusivePriorityQueue(ITEM_CNT, TestObject());
 			Intrusive::SortedList<TestObject, TestObject> sortedList;
+			Intrusive::SkipList<SkipTestObject, SkipTestObject> skipList;
 			std::priority_queue<TestObject*, std::vector<TestObject*>, TestObject> stdPriorityQueue;
 			std::set<TestObject*, SetCompare> stdSet;
 
@@ -210,6 +357,16 @@ int main(int argc, const char *argv[])
 			minListInsert.insert(duration);
 			if (!sortedList.check()) printf("insert: failed\n");
 
+			// insert skip list
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				skipList.insert(&skipObjects[i]);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minInsertSkipListDuration > duration) minInsertSkipListDuration = duration;
+			if (!skipList.check()) printf("skip list insert: failed\n");
+
 			// reprioritize
 			// reprioritize intrusive queue
 			start = std::chrono::steady_clock::now();
@@ -267,6 +424,24 @@ int main(int argc, const char *argv[])
 				sortedList.adjust(&obj);
 			}
 
+			// reprioritize skip list
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				SkipTestObject &obj = skipObjects[i];
+				obj._value = random[n - i];
+				skipList.adjust(&obj);
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minReprioritizeSkipListDuration > duration) minReprioritizeSkipListDuration = duration;
+			if (!skipList.check()) printf("skip list reprioritize: failed\n");
+			for (unsigned i = 0; i < n; ++i)
+			{
+				SkipTestObject &obj = skipObjects[i];
+				obj._value = random[i];
+				skipList.adjust(&obj);
+			}
+
 			// pop
 			// pop intrusive priority queue
 			start = std::chrono::steady_clock::now();
@@ -307,6 +482,16 @@ int main(int argc, const char *argv[])
 			if (minPopListDuration > popListDuration)minPopListDuration = popListDuration;
 			if (!sortedList.check()) printf("Pop: failed\n");
 
+			// pop skip list
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				skipList.pop_back();
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minPopSkipListDuration > duration) minPopSkipListDuration = duration;
+			if (!skipList.check()) printf("skip list pop: failed\n");
+
 			// erase
 			// -- repopulate
 			for (unsigned i = 0; i < n; ++i)
@@ -314,6 +499,7 @@ int main(int argc, const char *argv[])
 				intrusivePriorityQueue.push(&objects[i]);
 				stdSetIterators[i] = stdSet.insert(&objects[i]).first;
 				sortedList.insert(&objects[i]);
+				skipList.insert(&skipObjects[i]);
 			}
 
 			// erase intrusive priority queue
@@ -343,24 +529,35 @@ int main(int argc, const char *argv[])
 			}
 			std::chrono::duration<long long, std::nano> unlinkListDuration = std::chrono::steady_clock::now() - start;
 			if (minUnlinkListDuration > unlinkListDuration)minUnlinkListDuration = unlinkListDuration;
+
+			// erase skip list
+			start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				skipObjects[i].unlink();
+			}
+			duration = std::chrono::steady_clock::now() - start;
+			if (minUnlinkSkipListDuration > duration) minUnlinkSkipListDuration = duration;
 		}
 		std::cout << n << ',' << (minLoop.size() ? minLoop.sum().count() / minLoop.size(): 0)
 			//<< ',' << (minIntrusiveInsert.size() ? minIntrusiveInsert.sum().count() / minIntrusiveInsert.size() : 0)
 			//<< ',' << (minStdInsert.size() ? minStdInsert.sum().count() / minStdInsert.size() : 0)
 			//<< ',' << (minListInsert.size() ? minListInsert.sum().count() / minListInsert.size() : 0)
-			<< '|' << minInsertIntrusiveQueueDuration.count() << ',' << minInsertStdQueueDuration.count() << ',' << minStdSetInsertDuration.count() << ',' << minInsertListDuration.count()
-			<< '|' << minReprioritizeIntrusiveQueueDuration.count() << ",," << minStdSetReprioritizeDuration.count() << ',' << minReprioritizeListDuration.count()
-			<< '|' << minPopIntrusiveQueueDuration.count() << ',' << minPopStdQueueDuration.count() << ',' << minStdSetPopDuration.count() << ',' << minPopListDuration.count()
-			<< '|' << minEraseIntrusiveQueueDuration.count() << ",," << minStdSetEraseDuration.count() << ',' << minUnlinkListDuration.count()
+			<< '|' << minInsertIntrusiveQueueDuration.count() << ',' << minInsertStdQueueDuration.count() << ',' << minStdSetInsertDuration.count() << ',' << minInsertListDuration.count() << ',' << minInsertSkipListDuration.count()
+			<< '|' << minReprioritizeIntrusiveQueueDuration.count() << ",," << minStdSetReprioritizeDuration.count() << ',' << minReprioritizeListDuration.count() << ',' << minReprioritizeSkipListDuration.count()
+			<< '|' << minPopIntrusiveQueueDuration.count() << ',' << minPopStdQueueDuration.count() << ',' << minStdSetPopDuration.count() << ',' << minPopListDuration.count() << ',' << minPopSkipListDuration.count()
+			<< '|' << minEraseIntrusiveQueueDuration.count() << ",," << minStdSetEraseDuration.count() << ',' << minUnlinkListDuration.count() << ',' << minUnlinkSkipListDuration.count()
 			<< std::endl;
 	}
 
 	TestPriorityQueue<TestObject, TestObject> intrusivePriorityQueue(ITEM_CNT, TestObject());
 	Intrusive::SortedList<TestObject, TestObject> sortedList;
+	Intrusive::SkipList<SkipTestObject, SkipTestObject> skipList;
 	std::priority_queue<TestObject*, std::vector<TestObject*>, TestObject> stdPriorityQueue;
 	std::set<TestObject*, SetCompare> stdSet;
 	for (size_t i = 0; i < ITEM_CNT; ++i)
 	{
+		skipList.insert(&skipObjects[i]);
 		intrusivePriorityQueue.push(&objects[i]);
 		stdPriorityQueue.push(&objects[i]);
 		stdSet.insert(&objects[i]);
@@ -375,9 +572,13 @@ int main(int argc, const char *argv[])
 		TestObject *c = *itr;
 		stdSet.erase(itr);
 		TestObject *d = sortedList.pop_back();
-		if (a->_value != b->_value || a->_value != c->_value || a->_value != d->_value)
-			printf("ERROR: %d %d %d %d\n", a->_value, b->_value, c->_value, d->_value);
+		SkipTestObject *e = skipList.pop_back();
+		if (a->_value != b->_value || a->_value != c->_value || a->_value != d->_value || a->_value != e->_value)
+			printf("ERROR: %d %d %d %d %d\n", a->_value, b->_value, c->_value, d->_value, e->_value);
 	}
 
+	checkSortedList(objects, ITEM_CNT);
+	nearPositionBenchmark(objects);
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "Replay.h"
+
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+
+MappedFile::MappedFile() : _data(0), _size(0)
+#ifdef _MSC_VER
+	, _file(INVALID_HANDLE_VALUE), _mapping(0)
+#else
+	, _fd(-1)
+#endif
+{
+}
+
+int MappedFile::open(const char *fileName)
+{
+	close();
+#ifdef _MSC_VER
+	_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (_file == INVALID_HANDLE_VALUE) return -1;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size) || !size.QuadPart) { close(); return -1; }
+	_size = static_cast<size_t>(size.QuadPart);
+	if (!(_mapping = CreateFileMappingA(_file, 0, PAGE_READONLY, 0, 0, 0))) { close(); return -1; }
+	if (!(_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)))) { close(); return -1; }
+#else
+	if ((_fd = ::open(fileName, O_RDONLY)) < 0) return -1;
+	struct stat st;
+	if (fstat(_fd, &st) || !st.st_size) { close(); return -1; }
+	_size = static_cast<size_t>(st.st_size);
+	void *data = mmap(0, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (data == MAP_FAILED) { close(); return -1; }
+	_data = static_cast<const char*>(data);
+	madvise(data, _size, MADV_SEQUENTIAL);
+#endif
+	return 0;
+}
+
+void MappedFile::close()
+{
+#ifdef _MSC_VER
+	if (_data) UnmapViewOfFile(_data);
+	if (_mapping) CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+	_mapping = 0;
+	_file = INVALID_HANDLE_VALUE;
+#else
+	if (_data) munmap(const_cast<char*>(_data), _size);
+	if (_fd >= 0) ::close(_fd);
+	_fd = -1;
+#endif
+	_data = 0;
+	_size = 0;
+}
+
+int ReplayFile::open(const char *fileName)
+{
+	if (_file.open(fileName)) return -1;
+	const ReplayHeader *h = header();
+	if (_file.size() < sizeof(ReplayHeader) || h->_magic != ReplayHeader::MAGIC || h->_version != ReplayHeader::VERSION ||
+		(_file.size() - sizeof(ReplayHeader)) / sizeof(ReplayMessage) < h->_messageCnt)
+	{
+		_file.close();
+		return -1;
+	}
+	// records are applied unchecked, one pass here keeps a bad book or type from indexing past the books
+	for (const ReplayMessage *message = begin(); message < end(); ++message)
+	{
+		if (message->_type > REPLAY_REPLACE || message->_side > 1 || message->_book >= h->_bookCnt)
+		{
+			_file.close();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int ReplayEngine::initialize(const ReplayHeader &header, bool ladderFlag, const std::vector<uint32_t> *books)
+{
+	size_t bookCnt = books ? books->size() : header._bookCnt;
+	if (!bookCnt || !_orderBooks.empty()) return -1;
+
+	_exchange.initializeOrderIndex(2 * size_t(header._maxOrderCnt) + 1);
+	// levels can spread past the depth as the mid moves
+	_exchange.reserve(4 * bookCnt * header._depth, size_t(header._maxOrderCnt) + 2);
+	_orderBooks.reserve(bookCnt);
+	for (size_t i = 0; i < bookCnt; ++i)
+	{
+		char symbol[32];
+		snprintf(symbol, sizeof(symbol), "S%u", books ? (*books)[i] : static_cast<uint32_t>(i));
+		OrderBook *orderBook = new OrderBook;
+		orderBook->initialize(&_exchange, symbol);
+		if (ladderFlag) orderBook->initializeLadder(header._tickSize, 4 * header._depth);
+		orderBook->setLevelCache(true);
+		_orderBooks.push_back(orderBook);
+	}
+	return 0;
+}
+
+double ReplayEngine::_percentile(std::vector<uint32_t> &latencies, double fraction)
+{
+	std::vector<uint32_t>::iterator nth = latencies.begin() + static_cast<size_t>(fraction * (latencies.size() - 1));
+	std::nth_element(latencies.begin(), nth, latencies.end());
+	return *nth;
+}
+
+ReplayStats ReplayEngine::run(const ReplayMessage *begin, const ReplayMessage *end, bool latencyFlag)
+{
+	ReplayStats stats = {};
+	stats._messageCnt = end - begin;
+	if (!stats._messageCnt) return stats;
+
+	auto start = std::chrono::steady_clock::now();
+	if (latencyFlag)
+	{
+		_latencies.resize(stats._messageCnt);
+		uint32_t *latency = _latencies.data();
+		for (const ReplayMessage *message = begin; message < end; ++message)
+		{
+			auto messageStart = std::chrono::steady_clock::now();
+			apply(*message);
+			*latency++ = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - messageStart).count());
+		}
+	}
+	else
+	{
+		for (const ReplayMessage *message = begin; message < end; ++message) apply(*message);
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+	stats._seconds = duration.count();
+	stats._messagesPerSecond = stats._messageCnt / stats._seconds;
+	if (latencyFlag)
+	{
+		// each nth_element partitions around its percentile, so taking them in increasing order stays cheap
+		stats._p50 = _percentile(_latencies, 0.5);
+		stats._p90 = _percentile(_latencies, 0.9);
+		stats._p99 = _percentile(_latencies, 0.99);
+		stats._p999 = _percentile(_latencies, 0.999);
+		stats._max = *std::max_element(_latencies.begin(), _latencies.end());
+	}
+	return stats;
+}
+
+ReplayEngine::~ReplayEngine()
+{
+	for (OrderBook *orderBook : _orderBooks) delete orderBook;
+}
+
+void ReplayGenerator::generate(ReplayHeader &header, std::vector<ReplayMessage> &messages) const
+{
+	struct LiveOrder
+	{
+		uint32_t _book;
+		uint32_t _price;
+		uint32_t _shares;
+		uint32_t _side;
+	};
+	struct Book
+	{
+		uint32_t _mid;
+		std::vector<uint64_t> _live;
+		std::multiset<uint32_t> _prices[2];
+	};
+
+	std::mt19937_64 generator(_seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<LiveOrder> orders(2 * _messageCnt + 1);
+	std::vector<Book> books(_bookCnt);
+	for (Book &book : books) book._mid = 100000 * _tickSize;
+	uint64_t nextOrderId(1);
+	size_t liveCnt(0), maxLiveCnt(0);
+
+	// prices are kept from crossing the other side so every execution is an explicit message, as on an ITCH feed
+	auto pickPrice = [&](Book &book, int side)
+	{
+		uint32_t offset = static_cast<uint32_t>(generator() % _depth) * _tickSize;
+		if (side)
+		{
+			uint32_t price = book._mid + _tickSize + offset;
+			if (!book._prices[0].empty() && price <= *book._prices[0].rbegin()) price = *book._prices[0].rbegin() + _tickSize;
+			return price;
+		}
+		uint32_t price = book._mid - offset;
+		if (!book._prices[1].empty() && price >= *book._prices[1].begin()) price = *book._prices[1].begin() - _tickSize;
+		return price;
+	};
+	auto removeLive = [&](Book &book, size_t index)
+	{
+		LiveOrder &order = orders[book._live[index]];
+		book._prices[order._side].erase(book._prices[order._side].find(order._price));
+		book._live[index] = book._live.back();
+		book._live.pop_back();
+		--liveCnt;
+	};
+
+	messages.clear();
+	messages.reserve(_messageCnt);
+	for (uint64_t i = 0; i < _messageCnt; ++i)
+	{
+		ReplayMessage message = {};
+		message._book = static_cast<uint16_t>(generator() % _bookCnt);
+		Book &book = books[message._book];
+		if (uniform(generator) < _volatility)
+		{
+			if (generator() & 1) book._mid += _tickSize;
+			else if (book._mid > _depth * _tickSize * 2) book._mid -= _tickSize;
+		}
+
+		double pick = uniform(generator);
+		if (book._live.size() < _depth || pick < (book._live.size() < _orderCnt ? 0.5 : 0.4))
+		{
+			message._type = REPLAY_ADD;
+			message._side = generator() & 1;
+			message._orderId = nextOrderId++;
+			message._price = pickPrice(book, message._side);
+			message._shares = 100 * (1 + generator() % 10);
+			LiveOrder order = {message._book, message._price, message._shares, message._side};
+			orders[message._orderId] = order;
+			book._prices[message._side].insert(message._price);
+			book._live.push_back(message._orderId);
+			if (++liveCnt > maxLiveCnt) maxLiveCnt = liveCnt;
+		}
+		else
+		{
+			size_t index = generator() % book._live.size();
+			LiveOrder &order = orders[book._live[index]];
+			message._orderId = book._live[index];
+			message._side = static_cast<uint8_t>(order._side);
+			double kind = uniform(generator);
+			if (kind < _cancelRatio)
+			{
+				message._type = REPLAY_CANCEL;
+				removeLive(book, index);
+			}
+			else if (kind < _cancelRatio + (1.0 - _cancelRatio) * 0.66)
+			{
+				message._type = REPLAY_EXECUTE;
+				message._price = order._price;
+				message._shares = 100 * (1 + static_cast<uint32_t>(generator() % 3));
+				if (message._shares >= order._shares) removeLive(book, index);
+				else order._shares -= message._shares;
+			}
+			else
+			{
+				message._type = REPLAY_REPLACE;
+				uint32_t side = order._side;
+				removeLive(book, index);
+				message._newOrderId = nextOrderId++;
+				message._price = pickPrice(book, side);
+				message._shares = 100 * (1 + generator() % 10);
+				LiveOrder replacement = {message._book, message._price, message._shares, side};
+				orders[message._newOrderId] = replacement;
+				book._prices[side].insert(message._price);
+				book._live.push_back(message._newOrderId);
+				++liveCnt;
+			}
+		}
+		messages.push_back(message);
+	}
+
+	header._magic = ReplayHeader::MAGIC;
+	header._version = ReplayHeader::VERSION;
+	header._bookCnt = _bookCnt;
+	header._maxOrderCnt = static_cast<uint32_t>(maxLiveCnt);
+	header._messageCnt = _messageCnt;
+	header._tickSize = _tickSize;
+	header._depth = _depth;
+}
+
+int ReplayGenerator::write(const char *fileName) const
+{
+	ReplayHeader header;
+	std::vector<ReplayMessage> messages;
+	generate(header, messages);
+
+	FILE *file = fopen(fileName, "wb");
+	if (!file) return -1;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(messages.data(), sizeof(ReplayMessage), messages.size(), file) == messages.size();
+	return fclose(file) == 0 && written ? 0 : -1;
+}
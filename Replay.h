@@ -0,0 +1,188 @@
+#pragma once
+
+#include "Exchange.h"
+#include "OrderBook.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+** Replay
+** - binary market data file of fixed width records, add / cancel / replace / execute by order id
+** - MappedFile maps a file read only, ReplayFile hands out its records in place, nothing is copied or decoded
+** - ReplayEngine applies records to its OrderBooks through an Exchange and measures the rate and latency
+** - ReplayGenerator writes synthetic files with configurable depth, cancel ratio and volatility
+*/
+
+enum ReplayMessageType : uint8_t { REPLAY_ADD, REPLAY_CANCEL, REPLAY_EXECUTE, REPLAY_REPLACE };
+
+struct ReplayHeader
+{
+	enum : uint32_t { MAGIC = 0x59504C52, VERSION = 1 };
+	uint32_t _magic;
+	uint32_t _version;
+	uint32_t _bookCnt;
+	// most orders resting at once, sizes the order index and pools
+	uint32_t _maxOrderCnt;
+	uint64_t _messageCnt;
+	uint32_t _tickSize;
+	uint32_t _depth;
+};
+
+// 32 byte record, newOrderId is only used by replace
+struct ReplayMessage
+{
+	uint8_t _type;
+	uint8_t _side;
+	uint16_t _book;
+	uint32_t _price;
+	uint32_t _shares;
+	uint32_t _reserved;
+	uint64_t _orderId;
+	uint64_t _newOrderId;
+};
+
+static_assert(sizeof(ReplayHeader) == 32, "ReplayHeader must be 32 bytes");
+static_assert(sizeof(ReplayMessage) == 32, "ReplayMessage must be 32 bytes");
+
+class MappedFile
+{
+protected:
+	const char *_data;
+	size_t _size;
+#ifdef _MSC_VER
+	void *_file;
+	void *_mapping;
+#else
+	int _fd;
+#endif
+public:
+	MappedFile();
+	// returns -1 if the file can not be mapped, empty files can not be mapped
+	int open(const char *fileName);
+	void close();
+	const char *data() const { return _data; }
+	size_t size() const { return _size; }
+
+	~MappedFile() { close(); }
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+};
+
+class ReplayFile
+{
+protected:
+	MappedFile _file;
+public:
+	ReplayFile() {}
+	// returns -1 if the file can not be mapped or is not a replay file
+	// - or a record has an unknown type or side, or a book past the header's book count
+	int open(const char *fileName);
+	void close() { _file.close(); }
+
+	const ReplayHeader *header() const { return reinterpret_cast<const ReplayHeader*>(_file.data()); }
+	const ReplayMessage *begin() const { return reinterpret_cast<const ReplayMessage*>(_file.data() + sizeof(ReplayHeader)); }
+	const ReplayMessage *end() const { return begin() + header()->_messageCnt; }
+private:
+	ReplayFile(const ReplayFile&) = delete;
+	ReplayFile& operator = (const ReplayFile&) = delete;
+};
+
+struct ReplayStats
+{
+	uint64_t _messageCnt;
+	double _seconds;
+	double _messagesPerSecond;
+	// per message latency in nanoseconds, zero unless latency was measured
+	double _p50;
+	double _p90;
+	double _p99;
+	double _p999;
+	double _max;
+};
+
+class ReplayEngine
+{
+protected:
+	Exchange _exchange;
+	std::vector<OrderBook*> _orderBooks;
+	std::vector<uint32_t> _latencies;
+	timespec _ts;
+
+	static double _percentile(std::vector<uint32_t> &latencies, double fraction);
+public:
+	ReplayEngine() : _ts() {}
+	// books are named S0, S1, ... and sized from the file header
+	// - given books, only those are created and messages address them by their position in books
+	int initialize(const ReplayHeader &header, bool ladderFlag, const std::vector<uint32_t> *books = 0);
+	inline void apply(const ReplayMessage &message);
+	// latencyFlag times every message, which adds the cost of two clock reads to each
+	ReplayStats run(const ReplayMessage *begin, const ReplayMessage *end, bool latencyFlag);
+
+	Exchange &exchange() { return _exchange; }
+	OrderBook *orderBook(size_t book) { return _orderBooks[book]; }
+	size_t bookCnt() const { return _orderBooks.size(); }
+
+	~ReplayEngine();
+private:
+	ReplayEngine(const ReplayEngine&) = delete;
+	ReplayEngine& operator = (const ReplayEngine&) = delete;
+};
+
+struct ReplayGenerator
+{
+	uint32_t _bookCnt;
+	uint64_t _messageCnt;
+	// resting orders per book the mix settles around
+	uint32_t _orderCnt;
+	// price levels either side of the mid that new orders are spread over
+	uint32_t _depth;
+	uint32_t _tickSize;
+	// share of non add messages that are cancels, the rest split between executes and replaces
+	double _cancelRatio;
+	// chance per message that the book's mid moves a tick
+	double _volatility;
+	uint64_t _seed;
+
+	ReplayGenerator() : _bookCnt(1), _messageCnt(1000000), _orderCnt(10000), _depth(200), _tickSize(1), _cancelRatio(0.7), _volatility(0.01), _seed(1) {}
+	// returns -1 if the file can not be written
+	int write(const char *fileName) const;
+	void generate(ReplayHeader &header, std::vector<ReplayMessage> &messages) const;
+};
+
+inline
+void ReplayEngine::apply(const ReplayMessage &message)
+{
+	BookOrder *order(0);
+	switch (message._type)
+	{
+	case REPLAY_ADD:
+		order = _exchange.allocateBookOrder();
+		order->initialize(message._orderId, message._shares, _ts);
+		if (_exchange.addOrder(_orderBooks[message._book], message._side, message._price, order) == 0) order = 0;
+		break;
+	case REPLAY_CANCEL:
+		order = _exchange.cancelById(message._orderId);
+		break;
+	case REPLAY_EXECUTE:
+		order = _exchange.executeById(message._orderId, message._shares);
+		break;
+	case REPLAY_REPLACE:
+	{
+		BookOrder *newOrder = _exchange.allocateBookOrder();
+		newOrder->initialize(message._newOrderId, message._shares, _ts);
+		order = _exchange.replaceById(message._orderId, message._price, newOrder);
+		// an unknown id or a replacement that filled on entry leaves newOrder out of the book
+		if (!order) order = newOrder;
+		else if (!newOrder->_priceLevel) _exchange.freeBookOrder(newOrder);
+		break;
+	}
+	}
+	if (order) _exchange.freeBookOrder(order);
+	// resting orders an add or replace crossed
+	auto freeOrder = [this](BookOrder *released) { _exchange.freeBookOrder(released); };
+	_exchange.releaseOrders(freeOrder);
+}
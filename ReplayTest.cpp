@@ -0,0 +1,375 @@
+#include "Journal.h"
+#include "Replay.h"
+#include "ShardedExchange.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// ReplayTest generate <file> [books] [messages] [depth] [cancelRatio] [volatility]
+// ReplayTest [file]
+// - with no file a synthetic file is generated, then replayed with list and ladder books
+
+#define BOOK_CNT 64
+#define MESSAGE_CNT 4000000
+#define ORDER_CNT 2000
+#define BOOK_DEPTH 200
+#define TRIAL_CNT 3
+#define MAX_SHARD_CNT 16
+#define SNAPSHOT_INTERVAL 1000000
+
+int generate(const char *fileName, int argc, const char *argv[])
+{
+	ReplayGenerator generator;
+	generator._bookCnt = argc > 0 ? atoi(argv[0]) : BOOK_CNT;
+	generator._messageCnt = argc > 1 ? strtoull(argv[1], 0, 10) : MESSAGE_CNT;
+	generator._orderCnt = ORDER_CNT;
+	generator._depth = argc > 2 ? atoi(argv[2]) : BOOK_DEPTH;
+	if (argc > 3) generator._cancelRatio = atof(argv[3]);
+	if (argc > 4) generator._volatility = atof(argv[4]);
+	if (!generator._bookCnt || generator._bookCnt > 65536 || !generator._depth)
+	{
+		printf("ERROR: invalid generator parameters\n");
+		return -1;
+	}
+	if (generator.write(fileName))
+	{
+		printf("ERROR: unable to write %s\n", fileName);
+		return -1;
+	}
+	return 0;
+}
+
+// decoder thread feeding 1 to N shards, N is one less than the hardware threads
+void replaySharded(ReplayFile &file)
+{
+	unsigned maxShardCnt = std::thread::hardware_concurrency();
+	maxShardCnt = maxShardCnt > 2 ? maxShardCnt - 1 : 1;
+	if (maxShardCnt > MAX_SHARD_CNT) maxShardCnt = MAX_SHARD_CNT;
+
+	// single threaded reference for the top of book check
+	ReplayEngine reference;
+	reference.initialize(*file.header(), true);
+	reference.run(file.begin(), file.end(), false);
+
+	std::cout << "Shards,Msgs/sec,Executions" << std::endl;
+	for (unsigned shardCnt = 1; shardCnt <= maxShardCnt; ++shardCnt)
+	{
+		ShardedExchange exchange(shardCnt);
+		// leave cpu 0 to the decoder
+		exchange.start(*file.header(), true, 1);
+		uint64_t executionCnt(0);
+		auto onExecution = [&executionCnt](const ExecutionReport &) { ++executionCnt; };
+
+		auto start = std::chrono::steady_clock::now();
+		for (const ReplayMessage *message = file.begin(); message < file.end(); ++message) exchange.dispatch(*message, onExecution);
+		exchange.flush(onExecution);
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+		for (uint32_t book = 0; book < file.header()->_bookCnt; ++book)
+		{
+			OrderBook *orderBook = exchange.orderBook(book), *referenceBook = reference.orderBook(book);
+			if (orderBook->bid() != referenceBook->bid() || orderBook->ask() != referenceBook->ask())
+				printf("ERROR: %s top of book %u %u %u %u\n", orderBook->symbol(), referenceBook->bid(), referenceBook->ask(), orderBook->bid(), orderBook->ask());
+		}
+		exchange.stop(onExecution);
+		std::cout << shardCnt << ',' << file.header()->_messageCnt / duration.count() << ',' << executionCnt << std::endl;
+	}
+}
+
+// hardware cache miss counter for the calling thread, unavailable off Linux or without perf event access
+class CacheMissCounter
+{
+protected:
+	int _fd;
+public:
+	CacheMissCounter(bool lastLevel) : _fd(-1)
+	{
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		if (lastLevel)
+		{
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		}
+		else
+		{
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		}
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+	bool available() const { return _fd >= 0; }
+	void start()
+	{
+#ifdef __linux__
+		if (_fd < 0) return;
+		ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+	uint64_t stop()
+	{
+		uint64_t cnt(0);
+#ifdef __linux__
+		if (_fd < 0) return 0;
+		ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(_fd, &cnt, sizeof(cnt)) != sizeof(cnt)) cnt = 0;
+#endif
+		return cnt;
+	}
+	~CacheMissCounter()
+	{
+#ifdef __linux__
+		if (_fd >= 0) close(_fd);
+#endif
+	}
+};
+
+// cache misses per message for the BookOrder and PriceLevel layouts, n/a where the counters can not be read
+// - build with and without ORDER_BOOK_CACHE_ALIGNED to compare the cache line aligned and packed layouts
+void replayCacheMisses(ReplayFile &file)
+{
+#ifdef ORDER_BOOK_CACHE_ALIGNED
+	const char *layout = "aligned";
+#else
+	const char *layout = "compact";
+#endif
+	std::cout << "Book,Layout,BookOrder bytes,PriceLevel bytes,Msgs/sec,L1D misses/msg,LLC misses/msg" << std::endl;
+	for (int ladder = 0; ladder < 2; ++ladder)
+	{
+		// misses are from the fastest run
+		ReplayStats best = {};
+		uint64_t l1MissCnt(0), llcMissCnt(0);
+		CacheMissCounter l1Misses(false), llcMisses(true);
+		for (size_t t(0); t < TRIAL_CNT; ++t)
+		{
+			ReplayEngine engine;
+			engine.initialize(*file.header(), ladder != 0);
+			l1Misses.start();
+			llcMisses.start();
+			ReplayStats stats = engine.run(file.begin(), file.end(), false);
+			uint64_t l1MissRun = l1Misses.stop(), llcMissRun = llcMisses.stop();
+			if (stats._messagesPerSecond <= best._messagesPerSecond) continue;
+			best = stats;
+			l1MissCnt = l1MissRun;
+			llcMissCnt = llcMissRun;
+		}
+		std::cout << (ladder ? "Ladder" : "List") << ',' << layout << ',' << sizeof(BookOrder) << ',' << sizeof(PriceLevel) << ',' << best._messagesPerSecond << ',';
+		if (l1Misses.available()) std::cout << (double)l1MissCnt / best._messageCnt;
+		else std::cout << "n/a";
+		std::cout << ',';
+		if (llcMisses.available()) std::cout << (double)llcMissCnt / best._messageCnt;
+		else std::cout << "n/a";
+		std::cout << std::endl;
+	}
+}
+
+struct RestingOrder
+{
+	int side;
+	unsigned price;
+	uint64_t orderId;
+	unsigned shares;
+	bool operator == (const RestingOrder &order) const { return side == order.side && price == order.price && orderId == order.orderId && shares == order.shares; }
+};
+
+void restingOrders(ReplayEngine &engine, std::vector<RestingOrder> &orders)
+{
+	auto addOrder = [&orders](int side, unsigned price, const BookOrder *order) { orders.push_back(RestingOrder{side, price, order->_orderId, order->_shares}); };
+	for (size_t book = 0; book < engine.bookCnt(); ++book) engine.orderBook(book)->forEachOrder(addOrder);
+}
+
+// journal every message with a snapshot every SNAPSHOT_INTERVAL, then restart from the last snapshot and the journal tail
+void replayJournal(ReplayFile &file)
+{
+	const char *journalFileName = "replay.journal", *snapshotFileName = "replay.snapshot";
+	remove(journalFileName);
+	remove(snapshotFileName);
+
+	ReplayEngine engine;
+	engine.initialize(*file.header(), true);
+	Journal journal;
+	// undersized so the journal has to grow
+	if (journal.open(journalFileName, file.header()->_messageCnt / 4))
+	{
+		printf("ERROR: unable to open %s\n", journalFileName);
+		return;
+	}
+	bool snapshotFlag(false);
+	std::chrono::duration<double> snapshotDuration(0);
+	auto start = std::chrono::steady_clock::now();
+	uint64_t messageCnt(0);
+	for (const ReplayMessage *message = file.begin(); message < file.end(); ++message)
+	{
+		journal.append(*message);
+		engine.apply(*message);
+		if (++messageCnt % SNAPSHOT_INTERVAL == 0 && message + 1 < file.end())
+		{
+			auto snapshotStart = std::chrono::steady_clock::now();
+			if (Snapshot::write(engine, journal.sequence(), snapshotFileName)) printf("ERROR: unable to write %s\n", snapshotFileName);
+			snapshotDuration += std::chrono::steady_clock::now() - snapshotStart;
+			snapshotFlag = true;
+		}
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	// the process going away, the journal is left as it is
+	journal.close();
+
+	ReplayEngine recovered;
+	recovered.initialize(*file.header(), true);
+	uint64_t recoveredCnt(0);
+	start = std::chrono::steady_clock::now();
+	if (Snapshot::recover(recovered, snapshotFlag ? snapshotFileName : 0, journalFileName, &recoveredCnt)) printf("ERROR: recovery failed\n");
+	std::chrono::duration<double> recoveryDuration = std::chrono::steady_clock::now() - start;
+
+	// the whole journal, what a restart without snapshots would replay
+	ReplayEngine replayed;
+	replayed.initialize(*file.header(), true);
+	uint64_t replayedCnt(0);
+	start = std::chrono::steady_clock::now();
+	if (Snapshot::recover(replayed, 0, journalFileName, &replayedCnt)) printf("ERROR: journal replay failed\n");
+	std::chrono::duration<double> replayDuration = std::chrono::steady_clock::now() - start;
+
+	std::vector<RestingOrder> expected, actual, replayedOrders;
+	restingOrders(engine, expected);
+	restingOrders(recovered, actual);
+	restingOrders(replayed, replayedOrders);
+	if (actual != expected || replayedOrders != expected) printf("ERROR: recovered books differ, %zu %zu %zu resting orders\n", expected.size(), actual.size(), replayedOrders.size());
+
+	std::cout << "Journaled msgs/sec,Snapshot ms,Recovery records,Recovery ms,Journal records,Journal replay ms" << std::endl;
+	std::cout << messageCnt / duration.count() << ',' << snapshotDuration.count() * 1000 << ',' << recoveredCnt << ',' << recoveryDuration.count() * 1000 << ','
+		<< replayedCnt << ',' << replayDuration.count() * 1000 << std::endl;
+	remove(journalFileName);
+	remove(snapshotFileName);
+}
+
+// a record addressing a book past the header, or of an unknown type, fails open
+void checkReplayFile()
+{
+	const char *fileName = "replay_check.bin";
+	ReplayGenerator generator;
+	generator._bookCnt = 4;
+	generator._messageCnt = 1000;
+	generator._orderCnt = 100;
+	generator._depth = 10;
+	ReplayHeader header;
+	std::vector<ReplayMessage> messages;
+	generator.generate(header, messages);
+
+	auto writeFile = [&]()
+	{
+		FILE *file = fopen(fileName, "wb");
+		if (!file) return false;
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(messages.data(), sizeof(ReplayMessage), messages.size(), file) == messages.size();
+		return fclose(file) == 0 && written;
+	};
+	ReplayFile file;
+	if (!writeFile() || file.open(fileName)) printf("ERROR: unable to open a valid replay file\n");
+	file.close();
+	messages[500]._book = 4;
+	if (!writeFile() || !file.open(fileName)) printf("ERROR: opened a replay file with a book out of range\n");
+	messages[500]._book = 3;
+	messages[700]._type = REPLAY_REPLACE + 1;
+	if (!writeFile() || !file.open(fileName)) printf("ERROR: opened a replay file with an unknown message type\n");
+	remove(fileName);
+}
+
+// a journal record with an unknown type or side fails recovery, as one addressing a book past the engine does
+void checkJournalRecords()
+{
+	const char *journalFileName = "journal_check.journal";
+	ReplayGenerator generator;
+	generator._bookCnt = 4;
+	generator._messageCnt = 1000;
+	generator._orderCnt = 100;
+	generator._depth = 10;
+	ReplayHeader header;
+	std::vector<ReplayMessage> messages;
+	generator.generate(header, messages);
+
+	auto recover = [&](size_t corruptInt, ReplayMessage corrupt)
+	{
+		remove(journalFileName);
+		Journal journal;
+		if (journal.open(journalFileName, messages.size())) return -2;
+		for (size_t i = 0; i < messages.size(); ++i) journal.append(i == corruptInt ? corrupt : messages[i]);
+		journal.close();
+		ReplayEngine engine;
+		engine.initialize(header, true);
+		return Snapshot::recover(engine, 0, journalFileName);
+	};
+	if (recover(messages.size(), messages[0])) printf("ERROR: unable to recover a valid journal\n");
+	ReplayMessage corrupt = messages[500];
+	corrupt._side = 2;
+	if (!recover(500, corrupt)) printf("ERROR: recovered a journal with an unknown side\n");
+	corrupt = messages[500];
+	corrupt._type = REPLAY_REPLACE + 1;
+	if (!recover(500, corrupt)) printf("ERROR: recovered a journal with an unknown message type\n");
+	corrupt = messages[500];
+	corrupt._book = 4;
+	if (!recover(500, corrupt)) printf("ERROR: recovered a journal with a book out of range\n");
+	remove(journalFileName);
+}
+
+int main(int argc, const char *argv[])
+{
+	if (argc > 2 && !strcmp(argv[1], "generate")) return generate(argv[2], argc - 3, argv + 3) ? 1 : 0;
+
+	checkReplayFile();
+	checkJournalRecords();
+	const char *fileName = argc > 1 ? argv[1] : "replay.bin";
+	if (argc < 2 && generate(fileName, 0, 0)) return 1;
+
+	ReplayFile file;
+	if (file.open(fileName))
+	{
+		printf("ERROR: unable to map %s\n", fileName);
+		return 1;
+	}
+
+	std::cout << "Book,Messages,Msgs/sec,p50 ns,p90 ns,p99 ns,p99.9 ns,max ns" << std::endl;
+	for (int ladder = 0; ladder < 2; ++ladder)
+	{
+		// best throughput untimed, then one run timing every message
+		ReplayStats best = {};
+		for (size_t t(0); t < TRIAL_CNT; ++t)
+		{
+			ReplayEngine engine;
+			engine.initialize(*file.header(), ladder != 0);
+			ReplayStats stats = engine.run(file.begin(), file.end(), false);
+			if (stats._messagesPerSecond > best._messagesPerSecond) best = stats;
+		}
+		ReplayEngine engine;
+		engine.initialize(*file.header(), ladder != 0);
+		ReplayStats latency = engine.run(file.begin(), file.end(), true);
+		std::cout << (ladder ? "Ladder" : "List") << ',' << best._messageCnt << ',' << best._messagesPerSecond << ','
+			<< latency._p50 << ',' << latency._p90 << ',' << latency._p99 << ',' << latency._p999 << ',' << latency._max << std::endl;
+	}
+
+	replayCacheMisses(file);
+	replaySharded(file);
+	replayJournal(file);
+	file.close();
+	// a generated file is only for this run
+	if (argc < 2) remove(fileName);
+	return 0;
+}
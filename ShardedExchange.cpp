@@ -0,0 +1,108 @@
+#include "ShardedExchange.h"
+#include "BookDirectory.h"
+
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ShardedExchange::ShardedExchange(unsigned shardCnt, size_t queueSize) : _running(false), _queueSize(queueSize)
+{
+	if (!shardCnt) shardCnt = 1;
+	for (unsigned i = 0; i < shardCnt; ++i) _shards.push_back(new Shard(queueSize));
+}
+
+unsigned ShardedExchange::shardOf(const char *symbol, unsigned shardCnt)
+{
+	// the first 32 bytes, what the book keeps
+	Symbol<32> key;
+	key.set(symbol, 32);
+	return static_cast<unsigned>(SymbolHashFunction()(key) % shardCnt);
+}
+
+void ShardedExchange::_pin(int cpu)
+{
+	if (cpu < 0) return;
+	unsigned cpuCnt = std::thread::hardware_concurrency();
+	if (cpuCnt) cpu %= cpuCnt;
+#ifdef _MSC_VER
+	SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#else
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+int ShardedExchange::start(const ReplayHeader &header, bool ladderFlag, int firstCpu)
+{
+	if (_running.load() || !header._bookCnt) return -1;
+
+	unsigned shardCnt = this->shardCnt();
+	_bookShard.resize(header._bookCnt);
+	_bookPosition.resize(header._bookCnt);
+	for (uint32_t book = 0; book < header._bookCnt; ++book)
+	{
+		char symbol[32];
+		snprintf(symbol, sizeof(symbol), "S%u", book);
+		Shard *shard = _shards[_bookShard[book] = shardOf(symbol, shardCnt)];
+		_bookPosition[book] = static_cast<uint32_t>(shard->_books.size());
+		shard->_books.push_back(book);
+	}
+
+	_running.store(true);
+	for (unsigned i = 0; i < shardCnt; ++i)
+	{
+		Shard *shard = _shards[i];
+		shard->_cpu = firstCpu < 0 ? -1 : firstCpu + static_cast<int>(i);
+		shard->_thread = std::thread(&ShardedExchange::_run, this, shard, header, ladderFlag);
+	}
+	// books and pools are built by their worker, on its own node
+	for (Shard *shard : _shards)
+	{
+		while (!shard->_ready.load(std::memory_order_acquire)) std::this_thread::yield();
+	}
+	return 0;
+}
+
+void ShardedExchange::_run(Shard *shard, ReplayHeader header, bool ladderFlag)
+{
+	_pin(shard->_cpu);
+	ReplayEngine *engine = new ReplayEngine;
+	// a shard with no books still runs, it just never receives a message
+	if (!shard->_books.empty()) engine->initialize(header, ladderFlag, &shard->_books);
+	engine->exchange().setExecutionQueue(&shard->_output);
+	shard->_engine = engine;
+	shard->_ready.store(true, std::memory_order_release);
+
+	uint64_t processed(0);
+	unsigned spinCnt(0);
+	ReplayMessage message;
+	for (;;)
+	{
+		if (shard->_input.pop(message))
+		{
+			engine->apply(message);
+			shard->_processed.store(++processed, std::memory_order_release);
+			spinCnt = 0;
+		}
+		else if (!_running.load(std::memory_order_acquire)) break;
+		else SpscQueue<ReplayMessage>::backoff(spinCnt);
+	}
+}
+
+ShardedExchange::~ShardedExchange()
+{
+	auto discard = [](const ExecutionReport &) {};
+	stop(discard);
+	for (Shard *shard : _shards)
+	{
+		if (shard->_engine) delete shard->_engine;
+		delete shard;
+	}
+}
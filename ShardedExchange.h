@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Exchange.h"
+#include "Replay.h"
+#include "SpscQueue.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+** ShardedExchange
+** - books are partitioned over shards by a hash of their symbol
+** - each shard owns a ReplayEngine, with its own Exchange, books and pools, on a pinned worker thread
+** - the decoder thread dispatches messages through a per shard SPSC queue
+** - executions come back through a per shard ExecutionQueue and are handed to the decoder's callback
+** - the decoder drains executions whenever it waits, so neither side can block the other
+*/
+class ShardedExchange
+{
+protected:
+	struct Shard
+	{
+		SpscQueue<ReplayMessage> _input;
+		ExecutionQueue _output;
+		// global book numbers owned by the shard, messages carry the position in this list
+		std::vector<uint32_t> _books;
+		ReplayEngine *_engine;
+		std::thread _thread;
+		int _cpu;
+		// decoder only
+		uint64_t _dispatched;
+		alignas(64) std::atomic<uint64_t> _processed;
+		std::atomic<bool> _ready;
+
+		Shard(size_t queueSize) : _input(queueSize), _output(queueSize), _engine(0), _cpu(-1), _dispatched(0), _processed(0), _ready(false) {}
+	};
+
+	std::vector<Shard*> _shards;
+	std::vector<uint32_t> _bookShard;
+	std::vector<uint32_t> _bookPosition;
+	std::atomic<bool> _running;
+	size_t _queueSize;
+
+	void _run(Shard *shard, ReplayHeader header, bool ladderFlag);
+	static void _pin(int cpu);
+public:
+	ShardedExchange(unsigned shardCnt, size_t queueSize = 1 << 16);
+	static unsigned shardOf(const char *symbol, unsigned shardCnt);
+
+	// firstCpu pins shard i to cpu firstCpu + i, -1 leaves the workers unpinned
+	int start(const ReplayHeader &header, bool ladderFlag, int firstCpu = -1);
+	// waits for every dispatched message to be applied, then joins the workers
+	template<typename F>
+	void stop(F &onExecution);
+
+	template<typename F>
+	inline void dispatch(const ReplayMessage &message, F &onExecution);
+	template<typename F>
+	size_t pollExecutions(F &onExecution);
+	template<typename F>
+	void flush(F &onExecution);
+
+	unsigned shardCnt() const { return static_cast<unsigned>(_shards.size()); }
+	// only safe to read once flushed
+	OrderBook *orderBook(uint32_t book) { return _shards[_bookShard[book]]->_engine->orderBook(_bookPosition[book]); }
+
+	~ShardedExchange();
+private:
+	ShardedExchange(const ShardedExchange&) = delete;
+	ShardedExchange& operator = (const ShardedExchange&) = delete;
+};
+
+template<typename F>
+void ShardedExchange::dispatch(const ReplayMessage &message, F &onExecution)
+{
+	Shard *shard = _shards[_bookShard[message._book]];
+	ReplayMessage local = message;
+	local._book = static_cast<uint16_t>(_bookPosition[message._book]);
+	for (unsigned spinCnt(0); !shard->_input.push(local);)
+	{
+		if (!pollExecutions(onExecution)) SpscQueue<ReplayMessage>::backoff(spinCnt);
+	}
+	++shard->_dispatched;
+}
+
+template<typename F>
+size_t ShardedExchange::pollExecutions(F &onExecution)
+{
+	size_t cnt(0);
+	ExecutionReport report;
+	for (Shard *shard : _shards)
+	{
+		while (shard->_output.pop(report))
+		{
+			onExecution(report);
+			++cnt;
+		}
+	}
+	return cnt;
+}
+
+template<typename F>
+void ShardedExchange::flush(F &onExecution)
+{
+	for (Shard *shard : _shards)
+	{
+		for (unsigned spinCnt(0); shard->_processed.load(std::memory_order_acquire) != shard->_dispatched;)
+		{
+			if (!pollExecutions(onExecution)) SpscQueue<ReplayMessage>::backoff(spinCnt);
+		}
+	}
+	pollExecutions(onExecution);
+}
+
+template<typename F>
+void ShardedExchange::stop(F &onExecution)
+{
+	if (!_running.load()) return;
+	flush(onExecution);
+	_running.store(false, std::memory_order_release);
+	for (Shard *shard : _shards)
+	{
+		if (shard->_thread.joinable()) shard->_thread.join();
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+
+namespace Intrusive
+{
+
+/*
+** SkipListObject
+** - every level of the tower is doubly linked so unlink is O(height), expected O(1)
+** - the lowest INLINE_LEVELS links live in the object, taller towers use an overflow array
+** - the height is chosen on first insert and kept, so adjust and re-insert never allocate
+*/
+class SkipListObject
+{
+protected:
+	enum { INLINE_LEVELS = 2, MAX_LEVELS = 32 };
+	struct Link
+	{
+		SkipListObject *_prev;
+		SkipListObject *_next;
+	};
+	Link _links[INLINE_LEVELS];
+	Link *_overflow;
+	unsigned _height;
+
+	template<typename T, typename L>
+	friend class SkipList;
+
+	inline Link &link(unsigned level) { return level < INLINE_LEVELS ? _links[level] : _overflow[level - INLINE_LEVELS]; }
+	void setHeight(unsigned height)
+	{
+		_height = height;
+		if (height > INLINE_LEVELS) _overflow = new Link[height - INLINE_LEVELS];
+		for (unsigned level = 0; level < height; ++level) link(level)._prev = link(level)._next = this;
+	}
+public:
+	SkipListObject() : _overflow(0), _height(0) { _links[0]._prev = _links[0]._next = this; }
+	// copies start unlinked and never share the overflow tower
+	SkipListObject(const SkipListObject &) : _overflow(0), _height(0) { _links[0]._prev = _links[0]._next = this; }
+	SkipListObject& operator = (const SkipListObject &) { return *this; }
+	inline void unlink()
+	{
+		for (unsigned level = 0; level < _height; ++level)
+		{
+			Link &l = link(level);
+			l._prev->link(level)._next = l._next;
+			l._next->link(level)._prev = l._prev;
+			l._prev = l._next = this;
+		}
+	}
+	inline SkipListObject *next() { return _links[0]._next; }
+	inline SkipListObject *prev() { return _links[0]._prev; }
+	~SkipListObject() { if (_overflow) delete[] _overflow; }
+};
+
+/*
+** SkipList
+** - same interface as SortedList with O(log n) expected insert and adjust
+** - equal items are kept in insertion order
+*/
+template<typename T, typename L = std::less<T>>
+class SkipList
+{
+protected:
+	SkipListObject _head;
+	unsigned _level;
+	uint64_t _random;
+	L _less;
+
+	inline unsigned randomHeight();
+public:
+	SkipList(L &less = L()) : _level(1), _random(0x9E3779B97F4A7C15ULL), _less(less) { _head.setHeight(SkipListObject::MAX_LEVELS); }
+	inline void adjust(T *obj);
+	inline void insert(T *obj);
+	inline bool empty() { return _head._links[0]._next == &_head; }
+	inline void clear();
+	inline T* begin() { return static_cast<T*>(_head._links[0]._next); }
+	inline T* rbegin() { return static_cast<T*>(_head._links[0]._prev); }
+	inline T* end() { return static_cast<T*>(&_head); }
+	inline T* pop_front() { T *n(0); if (!empty()) { n = begin(); n->SkipListObject::unlink(); } return n; }
+	inline T* pop_back() { T *p(0); if (!empty()) { p = rbegin(); p->SkipListObject::unlink(); } return p; }
+	size_t size() { size_t s = 0; for (SkipListObject *o = _head._links[0]._next; o != &_head; o = o->_links[0]._next) ++s; return s; }
+	bool check();
+private:
+	SkipList(const SkipList&) = delete;
+	SkipList& operator = (const SkipList&) = delete;
+};
+
+template<typename T, typename L>
+unsigned SkipList<T, L>::randomHeight()
+{
+	// xorshift, one level per pair of zero bits (p = 1/4)
+	_random ^= _random << 13;
+	_random ^= _random >> 7;
+	_random ^= _random << 17;
+	unsigned height(1);
+	for (uint64_t r = _random; !(r & 3) && height < SkipListObject::MAX_LEVELS; r >>= 2) ++height;
+	return height;
+}
+
+template<typename T, typename L>
+void SkipList<T, L>::adjust(T *obj)
+{
+	SkipListObject *prev = obj->SkipListObject::prev(), *next = obj->SkipListObject::next();
+	if ((prev != &_head && _less(*obj, *static_cast<T*>(prev))) || (next != &_head && _less(*static_cast<T*>(next), *obj)))
+	{
+		obj->SkipListObject::unlink();
+		insert(obj);
+	}
+}
+
+template<typename T, typename L>
+void SkipList<T, L>::insert(T *obj)
+{
+	SkipListObject *item = obj;
+	if (!item->_height) item->setHeight(randomHeight());
+	unsigned height = item->_height;
+	if (height > _level) _level = height;
+
+	// insert after equal items, linking each level on the way down
+	SkipListObject *prev = &_head;
+	for (unsigned level = _level; level-- > 0;)
+	{
+		for (SkipListObject *next = prev->link(level)._next; next != &_head && !_less(*obj, *static_cast<T*>(next)); next = next->link(level)._next)
+			prev = next;
+		if (level < height)
+		{
+			SkipListObject::Link &link = item->link(level), &prevLink = prev->link(level);
+			link._prev = prev;
+			link._next = prevLink._next;
+			prevLink._next->link(level)._prev = item;
+			prevLink._next = item;
+		}
+	}
+}
+
+template<typename T, typename L>
+void SkipList<T, L>::clear()
+{
+	for (unsigned level = 0; level < SkipListObject::MAX_LEVELS; ++level)
+	{
+		SkipListObject::Link &link = _head.link(level);
+		link._prev = link._next = &_head;
+	}
+	_level = 1;
+}
+
+template<typename T, typename L>
+bool SkipList<T, L>::check()
+{
+	for (unsigned level = 0; level < _level; ++level)
+	{
+		SkipListObject *prev = &_head;
+		for (SkipListObject *next = _head.link(level)._next; next != &_head; next = next->link(level)._next)
+		{
+			if (next->link(level)._prev != prev) return false;
+			if (prev != &_head && _less(*static_cast<T*>(next), *static_cast<T*>(prev))) return false;
+			prev = next;
+		}
+	}
+	return true;
+}
+
+} // namespace Intrusive
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>
+
+#include <emmintrin.h>
+
+/*
+** SpscQueue
+** - bounded single producer, single consumer ring, capacity is rounded up to a power of 2
+** - head and tail live on their own cache lines
+** - each side caches the other side's index and only reloads it when the ring looks full or empty
+*/
+template<typename T>
+class SpscQueue
+{
+protected:
+	enum { CACHE_LINE = 64, SPIN_CNT = 1024 };
+
+	T *_items;
+	size_t _mask;
+	// consumer
+	alignas(CACHE_LINE) std::atomic<size_t> _head;
+	size_t _cachedTail;
+	// producer
+	alignas(CACHE_LINE) std::atomic<size_t> _tail;
+	size_t _cachedHead;
+	char _pad[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+public:
+	SpscQueue(size_t capacity) : _head(0), _cachedTail(0), _tail(0), _cachedHead(0)
+	{
+		size_t size(2);
+		for (; size < capacity; size <<= 1);
+		_items = new T[size];
+		_mask = size - 1;
+	}
+	// spin briefly while waiting on the other side, then give up the core
+	static void backoff(unsigned &spinCnt) { if (++spinCnt < SPIN_CNT) _mm_pause(); else std::this_thread::yield(); }
+
+	// producer, returns false if full
+	inline bool push(const T &item);
+	// consumer, returns false if empty
+	inline bool pop(T &item);
+	bool empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+	size_t capacity() const { return _mask + 1; }
+
+	~SpscQueue() { delete[] _items; }
+private:
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator = (const SpscQueue&) = delete;
+};
+
+template<typename T>
+bool SpscQueue<T>::push(const T &item)
+{
+	size_t tail = _tail.load(std::memory_order_relaxed);
+	if (tail - _cachedHead > _mask)
+	{
+		_cachedHead = _head.load(std::memory_order_acquire);
+		if (tail - _cachedHead > _mask) return false;
+	}
+	_items[tail & _mask] = item;
+	_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::pop(T &item)
+{
+	size_t head = _head.load(std::memory_order_relaxed);
+	if (head == _cachedTail)
+	{
+		_cachedTail = _tail.load(std::memory_order_acquire);
+		if (head == _cachedTail) return false;
+	}
+	item = _items[head & _mask];
+	_head.store(head + 1, std::memory_order_release);
+	return true;
+}